@@ -30,6 +30,24 @@ along with this program.  If not, see <http://www.gnu.org/licenses/
 #define GAMMA1 2.f
 #define GAMMA2 0.5f
 
+/**
+* Raises to one of the GAMMA powers. They're constants, so this folds down to the
+* multiplication or square root they usually amount to.
+* \param x the base
+* \param gamma the exponent
+*/
+static inline float
+gamma_pow(float x, float gamma)
+{
+	if (gamma == 1.f)
+		return x;
+	if (gamma == 2.f)
+		return x * x;
+	if (gamma == 0.5f)
+		return sqrtf(x);
+	return powf(x, gamma);
+}
+
 /**
 * Wiener substraction supression rule. Outputs the filter mirrored around nyquist.
 * \param fft_size_2 is half of the fft size
@@ -203,18 +221,20 @@ denoise_gain_gss(int fft_size_2, float *alpha, float *beta, float *spectrum,
 					  float *noise_thresholds, float *Gk)
 {
 	int k;
+	float ratio;
 
 	for (k = 0; k <= fft_size_2; k++)
 	{
 		if (spectrum[k] > FLT_MIN)
 		{
-			if (powf((noise_thresholds[k] / spectrum[k]), GAMMA1) < (1.f / (alpha[k] + beta[k])))
+			ratio = gamma_pow(noise_thresholds[k] / spectrum[k], GAMMA1);
+			if (ratio < (1.f / (alpha[k] + beta[k])))
 			{
-				Gk[k] = MAX(powf(1.f - (alpha[k] * powf((noise_thresholds[k] / spectrum[k]), GAMMA1)), GAMMA2), 0.f);
+				Gk[k] = MAX(gamma_pow(1.f - (alpha[k] * ratio), GAMMA2), 0.f);
 			}
 			else
 			{
-				Gk[k] = MAX(powf(beta[k] * powf((noise_thresholds[k] / spectrum[k]), GAMMA1), GAMMA2), 0.f);
+				Gk[k] = MAX(gamma_pow(beta[k] * ratio, GAMMA2), 0.f);
 			}
 		}
 		else
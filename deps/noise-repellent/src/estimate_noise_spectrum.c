@@ -76,39 +76,34 @@ compute_auto_thresholds(float *auto_thresholds, float fft_size, float fft_size_2
 }
 
 /**
-* Loizou noise-estimation algorithm for highly non-stationary environments.
+* Loizou noise-estimation algorithm for highly non-stationary environments. Every
+* estimate is updated in place from its value for the previous frame.
 * \param thresh Reference threshold for louizou algorithm
 * \param fft_size_2 is half of the fft size
 * \param p2 the power spectrum of current frame
-* \param s_pow_spec current smoothed power spectrum
-* \param prev_s_pow_spec previous smoothed power spectrum
+* \param s_pow_spec smoothed power spectrum
 * \param noise_thresholds_p2 the noise thresholds for each bin estimated
-* \param prev_noise noise thresholds estimated for previous frame
 * \param p_min spectrum of the local minimun values
-* \param prev_p_min spectrum of the previous local minimun values
 * \param speech_p_p speech presence probability spectrum
-* \param prev_speech_p_p speech presence probability spectrum of previous frame
 */
 static void
 estimate_noise_loizou(float *thresh, int fft_size_2, float *p2, float *s_pow_spec,
-                      float *prev_s_pow_spec, float *noise_thresholds_p2,
-                      float *prev_noise, float *p_min, float *prev_p_min,
-                      float *speech_p_p, float *prev_speech_p_p)
+                      float *noise_thresholds_p2, float *p_min, float *speech_p_p)
 {
   int k;
   float ratio_ns = 0.f;
-  float freq_s[fft_size_2 + 1];
-  float speech_p_d[fft_size_2 + 1];
+  float freq_s, speech_p_d, prev_s_pow_spec;
 
   for (k = 0; k <= fft_size_2; k++)
   {
     //1- Smooth between current and past noisy speech power spectrum
-    s_pow_spec[k] = N_SMOOTH * prev_s_pow_spec[k] + (1.f - N_SMOOTH) * p2[k]; //interpolation between
+    prev_s_pow_spec = s_pow_spec[k];
+    s_pow_spec[k] = N_SMOOTH * prev_s_pow_spec + (1.f - N_SMOOTH) * p2[k]; //interpolation between
 
     //2- Compute the local minimum of noisy speech
-    if (prev_p_min[k] < s_pow_spec[k])
+    if (p_min[k] < s_pow_spec[k])
     {
-      p_min[k] = GAMMA * prev_p_min[k] + ((1.f - GAMMA) / (1.f - BETA_AT)) * (s_pow_spec[k] - BETA_AT * prev_s_pow_spec[k]);
+      p_min[k] = GAMMA * p_min[k] + ((1.f - GAMMA) / (1.f - BETA_AT)) * (s_pow_spec[k] - BETA_AT * prev_s_pow_spec);
     }
     else
     {
@@ -120,51 +115,42 @@ estimate_noise_loizou(float *thresh, int fft_size_2, float *p2, float *s_pow_spe
 
     //4- Compute the indicator function I for speech present/absent detection
     if (ratio_ns > thresh[k])
-    {                      //thresh could be freq dependant
-      speech_p_d[k] = 1.f; //present
+    {                   //thresh could be freq dependant
+      speech_p_d = 1.f; //present
     }
     else
     {
-      speech_p_d[k] = 0.f; //absent
+      speech_p_d = 0.f; //absent
     }
 
     //5- Calculate speech presence probability using first-order recursion
-    speech_p_p[k] = ALPHA_P * prev_speech_p_p[k] + (1.f - ALPHA_P) * speech_p_d[k];
+    speech_p_p[k] = ALPHA_P * speech_p_p[k] + (1.f - ALPHA_P) * speech_p_d;
 
     //6- Compute time-frequency dependent smoothing constant
-    freq_s[k] = ALPHA_D + (1.f - ALPHA_D) * speech_p_p[k];
+    freq_s = ALPHA_D + (1.f - ALPHA_D) * speech_p_p[k];
 
     //7- Update noise estimate D using time-frequency dependent smoothing factor α s (λ,k).
-    noise_thresholds_p2[k] = freq_s[k] * prev_noise[k] + (1.f - freq_s[k]) * p2[k];
+    noise_thresholds_p2[k] = freq_s * noise_thresholds_p2[k] + (1.f - freq_s) * p2[k];
   }
 }
 
 /**
-* Wrapper for adaptive noise estimation.
+* Wrapper for adaptive noise estimation. The estimates are kept in place, so
+* there are no previous frame's copies to update.
 * \param p2 the power spectrum of current frame
 * \param fft_size_2 is half of the fft size
 * \param noise_thresholds_p2 the noise thresholds for each bin estimated
 * \param thresh Reference threshold for louizou algorithm
-* \param prev_noise_thresholds noise thresholds estimated for previous frame
-* \param s_pow_spec current smoothed power spectrum
-* \param prev_s_pow_spec previous smoothed power spectrum
+* \param s_pow_spec smoothed power spectrum
 * \param p_min spectrum of the local minimun values
-* \param prev_p_min spectrum of the previous local minimun values
 * \param speech_p_p speech presence probability spectrum
-* \param prev_speech_p_p speech presence probability spectrum of previous frame
 */
 static void
 adapt_noise(float *p2, int fft_size_2, float *noise_thresholds_p2, float *thresh,
-            float *prev_noise_thresholds, float *s_pow_spec, float *prev_s_pow_spec, float *p_min, float *prev_p_min, float *speech_p_p, float *prev_speech_p_p)
+            float *s_pow_spec, float *p_min, float *speech_p_p)
 {
-  estimate_noise_loizou(thresh, fft_size_2, p2, s_pow_spec, prev_s_pow_spec,
-                        noise_thresholds_p2, prev_noise_thresholds, p_min, prev_p_min, speech_p_p, prev_speech_p_p);
-
-  //Update previous variables
-  memcpy(prev_noise_thresholds, noise_thresholds_p2, sizeof(float) * (fft_size_2 + 1));
-  memcpy(prev_s_pow_spec, s_pow_spec, sizeof(float) * (fft_size_2 + 1));
-  memcpy(prev_p_min, p_min, sizeof(float) * (fft_size_2 + 1));
-  memcpy(prev_speech_p_p, speech_p_p, sizeof(float) * (fft_size_2 + 1));
+  estimate_noise_loizou(thresh, fft_size_2, p2, s_pow_spec, noise_thresholds_p2,
+                        p_min, speech_p_p);
 }
 
 /**
@@ -57,6 +57,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/
 
 #define TP_UPPER_LIMIT 5.f //This correspond to the upper limit of the adaptive threshold multiplier. Should be the same as the ttl configured one
 
+#include "vector_functions.c"
+
 /**
 * Method to force already-denormal float value to zero.
 * \param value to sanitize
@@ -752,7 +754,7 @@ apply_time_envelope(float *spectrum, float *spectrum_prev, float N, float releas
 * anylised by Dixon in 'Simple Spectrum-Based Onset Detection' would be better. Onset
 * detection is explained thoroughly in 'A tutorial on onset detection in music signals' * by Bello.
 * \param fft_p2 the current power spectrum
-* \param transient_preserv_prev the previous power spectrum
+* \param transient_preserv_prev the previous magnitude spectrum
 * \param fft_size_2 half of the fft size
 * \param tp_window_count tp_window_count counter for the rolling mean thresholding
 * \param tp_r_mean rolling mean value
@@ -765,7 +767,7 @@ transient_detection(float *fft_p2, float *transient_preserv_prev, float fft_size
   float adapted_threshold, reduction_function;
 
   //Transient protection by forcing wiener filtering when an onset is detected
-  reduction_function = spectral_flux(fft_p2, transient_preserv_prev, fft_size_2);
+  reduction_function = vector_spectral_flux(fft_p2, transient_preserv_prev, fft_size_2);
   //reduction_function = high_frequency_content(fft_p2, fft_size_2);
 
   *(tp_window_count) += 1.f;
@@ -781,8 +783,6 @@ transient_detection(float *fft_p2, float *transient_preserv_prev, float fft_size
 
   adapted_threshold = (TP_UPPER_LIMIT - transient_protection) * *(tp_r_mean);
 
-  memcpy(transient_preserv_prev, fft_p2, sizeof(float) * (fft_size_2 + 1));
-
   if (reduction_function > adapted_threshold)
   {
     return true;
@@ -44,6 +44,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/
 
 #define ARRAYACCESS(a, i, j) ((a)[(i)*N_BARK_BANDS + (j)]) //This is for SSF Matrix recall
 
+/**
+* Where each bark band lies in the spectrum, and its renormalization, which only
+* depend on the spectrum config and so are computed once.
+*/
+typedef struct
+{
+  float intermediate_band_bins[N_BARK_BANDS]; //bin numbers that are limits of each band
+  float n_bins_per_band[N_BARK_BANDS];        //number of bins in each band
+  float renormalization[N_BARK_BANDS];        //SSF convolution correction in db
+} BarkBands;
+
 //Proposed by Sinha and Tewfik and explained by Virag
 static const float
 relative_thresholds[N_BARK_BANDS] = {-16.f, -17.f, -18.f, -19.f, -20.f, -21.f, -22.f, -23.f, -24.f, -25.f, -25.f, -25.f, -25.f, -25.f, -25.f, -24.f, -23.f, -22.f, -19.f, -18.f, -18.f, -18.f, -18.f, -18.f, -18.f};
@@ -117,17 +128,16 @@ convolve_with_SSF(float *SSF, float *bark_spectrum, float *spreaded_spectrum)
 }
 
 /**
-* Computes the energy of each bark band taking a power or magnitude spectrum. It performs
-* the mapping from linear fft scale to the bark scale. Often called critical band Analysis
+* Computes the mapping from linear fft scale to the bark scale, and the
+* renormalization for each band.
+* \param bands the bark bands for current spectrum config
 * \param bark_z defines the bark to linear mapping for current spectrum config
-* \param bark_spectrum the bark spectrum values of current power spectrum
-* \param spectrum is the power spectum array
-* \param intermediate_band_bins holds the bin numbers that are limits of each band
-* \param n_bins_per_band holds the the number of bins in each band
+* \param fft_size_2 is half of the fft size
+* \param spreaded_unity_gain_bark_spectrum correction to be applied to SSF convolution
 */
 static void
-compute_bark_spectrum(float *bark_z, float *bark_spectrum, float *spectrum,
-                      float *intermediate_band_bins, float *n_bins_per_band)
+compute_bark_bands(BarkBands *bands, float *bark_z, int fft_size_2,
+                   float *spreaded_unity_gain_bark_spectrum)
 {
   int j;
   int last_position = 0;
@@ -138,19 +148,46 @@ compute_bark_spectrum(float *bark_z, float *bark_spectrum, float *spectrum,
     if (j == 0)
       cont = 1; //Do not take into account the DC component
 
-    bark_spectrum[j] = 0.f;
     //If we are on the same band for the bin
-    while (floor(bark_z[last_position + cont]) == (j + 1))
+    while (last_position + cont <= fft_size_2 &&
+           floor(bark_z[last_position + cont]) == (j + 1))
     { //First bark band is 1
-      bark_spectrum[j] += spectrum[last_position + cont];
       cont++;
     }
     //Move the position to the next group of bins from the upper bark band
     last_position += cont;
 
     //store bin information
-    n_bins_per_band[j] = cont;
-    intermediate_band_bins[j] = last_position;
+    bands->n_bins_per_band[j] = cont;
+    bands->intermediate_band_bins[j] = last_position;
+
+    bands->renormalization[j] = 10.f * log10f(spreaded_unity_gain_bark_spectrum[j]);
+  }
+}
+
+/**
+* Computes the energy of each bark band taking a power or magnitude spectrum. It performs
+* the mapping from linear fft scale to the bark scale. Often called critical band Analysis
+* \param bands the bark bands for current spectrum config
+* \param bark_spectrum the bark spectrum values of current power spectrum
+* \param spectrum is the power spectum array
+*/
+static void
+compute_bark_spectrum(const BarkBands *bands, float *bark_spectrum, float *spectrum)
+{
+  int j, k;
+  int start_pos = 1; //Do not take into account the DC component
+
+  for (j = 0; j < N_BARK_BANDS; j++)
+  {
+    int end_pos = bands->intermediate_band_bins[j];
+
+    bark_spectrum[j] = 0.f;
+    for (k = start_pos; k < end_pos; k++)
+    {
+      bark_spectrum[j] += spectrum[k];
+    }
+    start_pos = end_pos;
   }
 }
 
@@ -253,18 +290,20 @@ compute_absolute_thresholds(float *absolute_thresholds, int fft_size_2, int srat
 * logs some trickery is used as explained in https://en.wikipedia.org/wiki/Spectral_flatness
 * Robinsons thesis explains this further too.
 * \param spectrum is the power spectum array
-* \param intermediate_band_bins holds the bin numbers that are limits of each band
-* \param n_bins_per_band holds the the number of bins in each band
+* \param log_spectrum is the base 10 logarithm of the power spectrum, or NULL to compute it exactly
+* \param bands the bark bands for current spectrum config
 * \param band the bark band given
 */
 static float
-compute_tonality_factor(float *spectrum, float *intermediate_band_bins,
-                        float *n_bins_per_band, int band)
+compute_tonality_factor(float *spectrum, float *log_spectrum, const BarkBands *bands,
+                        int band)
 {
   int k;
   float SFM, tonality_factor;
   float sum_p = 0.f, sum_log_p = 0.f;
   int start_pos, end_pos = 0;
+  const float *intermediate_band_bins = bands->intermediate_band_bins;
+  const float *n_bins_per_band = bands->n_bins_per_band;
 
   //Mapping to bark bands
   if (band == 0)
@@ -283,7 +322,7 @@ compute_tonality_factor(float *spectrum, float *intermediate_band_bins,
   {
     //For spectral flatness measures
     sum_p += spectrum[k];
-    sum_log_p += log10f(spectrum[k]);
+    sum_log_p += log_spectrum ? log_spectrum[k] : log10f(spectrum[k]);
   }
   //spectral flatness measure using Geometric and Arithmetic means of the spectrum
   SFM = 10.f * (sum_log_p / (float)(n_bins_per_band[band]) - log10f(sum_p / (float)(n_bins_per_band[band]))); //this value is in db scale
@@ -300,42 +339,47 @@ compute_tonality_factor(float *spectrum, float *intermediate_band_bins,
 * Masking Properties of the Human Auditory System'. Some optimizations suggested in
 * Virags work are implemented but not used as they seem to not be necessary in modern
 * age computers.
-* \param bark_z defines the bark to linear mapping for current spectrum config
+* \param bands the bark bands for current spectrum config
 * \param absolute_thresholds defines the absolute thresholds of hearing for current spectrum config
 * \param SSF defines the spreading function matrix
 * \param spectrum is the power spectum array
 * \param fft_size_2 is half of the fft size
 * \param masking_thresholds the masking thresholds obtained in db scale
-* \param spreaded_unity_gain_bark_spectrum correction to be applied to SSF convolution
 * \param spl_reference_values defines the reference values for each bin to convert from db to db SPL
 */
 static void
-compute_masking_thresholds(float *bark_z, float *absolute_thresholds, float *SSF,
+compute_masking_thresholds(const BarkBands *bands, float *absolute_thresholds, float *SSF,
                            float *spectrum, int fft_size_2, float *masking_thresholds,
-                           float *spreaded_unity_gain_bark_spectrum,
                            float *spl_reference_values)
 {
   int k, j, start_pos, end_pos;
-  float intermediate_band_bins[N_BARK_BANDS];
-  float n_bins_per_band[N_BARK_BANDS];
+  const float *intermediate_band_bins = bands->intermediate_band_bins;
   float bark_spectrum[N_BARK_BANDS];
   float threshold_j[N_BARK_BANDS];
   float masking_offset[N_BARK_BANDS];
+  float masking_exponent[N_BARK_BANDS];
   float spreaded_spectrum[N_BARK_BANDS];
+  float log_spectrum[fft_size_2 + 1];
+  bool exact = vector_level == NREPEL_VECTOR_REFERENCE;
   float tonality_factor;
 
   //First we get the energy in each bark band
-  compute_bark_spectrum(bark_z, bark_spectrum, spectrum, intermediate_band_bins,
-                        n_bins_per_band);
+  compute_bark_spectrum(bands, bark_spectrum, spectrum);
 
   //Now that we have the bark spectrum
   //Convolution bewtween the bark spectrum and SSF (Toepliz matrix multiplication)
   convolve_with_SSF(SSF, bark_spectrum, spreaded_spectrum);
 
+  //Logarithms for the tonality factors, all at once
+  if (!exact)
+  {
+    vector_log10(log_spectrum, spectrum, fft_size_2 + 1);
+  }
+
   for (j = 0; j < N_BARK_BANDS; j++)
   {
     //Then we compute the tonality_factor for each band (1 tone like 0 noise like)
-    tonality_factor = compute_tonality_factor(spectrum, intermediate_band_bins, n_bins_per_band, j); //Uses power spectrum
+    tonality_factor = compute_tonality_factor(spectrum, exact ? NULL : log_spectrum, bands, j); //Uses power spectrum
 
     //Masking offset
     masking_offset[j] = (tonality_factor * (14.5f + (float)(j + 1)) + 5.5f * (1.f - tonality_factor));
@@ -348,11 +392,31 @@ compute_masking_thresholds(float *bark_z, float *absolute_thresholds, float *SSF
       masking_offset[j] += HIGH_FREQ_BIAS;
 #endif
 
-    //spread Masking threshold
-    threshold_j[j] = powf(10.f, log10f(spreaded_spectrum[j]) - (masking_offset[j] / 10.f));
+    masking_exponent[j] = -(masking_offset[j] / 10.f);
+  }
+
+  //spread Masking threshold
+  if (exact)
+  {
+    for (j = 0; j < N_BARK_BANDS; j++)
+    {
+      threshold_j[j] = powf(10.f, log10f(spreaded_spectrum[j]) + masking_exponent[j]);
+    }
+  }
+  else
+  {
+    //10^(log10(s) - o) is s * 10^-o
+    vector_exp10(threshold_j, masking_exponent, N_BARK_BANDS);
+    for (j = 0; j < N_BARK_BANDS; j++)
+    {
+      threshold_j[j] *= spreaded_spectrum[j];
+    }
+  }
 
+  for (j = 0; j < N_BARK_BANDS; j++)
+  {
     //Renormalization
-    threshold_j[j] -= 10.f * log10f(spreaded_unity_gain_bark_spectrum[j]);
+    threshold_j[j] -= bands->renormalization[j];
 
     //Relating the spread masking threshold to the critical band masking thresholds
     //Border case
@@ -398,19 +462,17 @@ compute_masking_thresholds(float *bark_z, float *absolute_thresholds, float *SSF
 * \param fft_size_2 is half of the fft size
 * \param alpha_masking is the array of oversubtraction factors for each bin
 * \param beta_masking is the array of the spectral flooring factors for each bin
-* \param bark_z defines the bark to linear mapping for current spectrum config
+* \param bands the bark bands for current spectrum config
 * \param absolute_thresholds defines the absolute thresholds of hearing for current spectrum config
 * \param SSF defines the spreading function matrix
-* \param spreaded_unity_gain_bark_spectrum correction to be applied to SSF convolution
 * \param spl_reference_values defines the reference values for each bin to convert from db to db SPL
 * \param masking_value is the limit max oversubtraction to be computed
 * \param reduction_value is the limit max the spectral flooring to be computed
 */
 static void
 compute_alpha_and_beta(float *fft_p2, float *noise_thresholds_p2, int fft_size_2,
-                       float *alpha_masking, float *beta_masking, float *bark_z,
+                       float *alpha_masking, float *beta_masking, const BarkBands *bands,
                        float *absolute_thresholds, float *SSF,
-                       float *spreaded_unity_gain_bark_spectrum,
                        float *spl_reference_values, float masking_value,
                        float reduction_value)
 {
@@ -430,9 +492,8 @@ compute_alpha_and_beta(float *fft_p2, float *noise_thresholds_p2, int fft_size_2
   }
 
   //Now we can compute noise masking threshold from this clean signal
-  compute_masking_thresholds(bark_z, absolute_thresholds, SSF, estimated_clean,
-                             fft_size_2, masking_thresholds,
-                             spreaded_unity_gain_bark_spectrum, spl_reference_values);
+  compute_masking_thresholds(bands, absolute_thresholds, SSF, estimated_clean,
+                             fft_size_2, masking_thresholds, spl_reference_values);
 
   //First we need the maximun and the minimun value of the masking threshold
   float max_masked_tmp = max_spectral_value(masking_thresholds, fft_size_2);
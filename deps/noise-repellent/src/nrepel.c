@@ -23,7 +23,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/
 * \brief The main file for host interaction
 */
 
+#include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
 
 #if 0
 #include "lv2/lv2plug.in/ns/lv2core/lv2.h"
@@ -44,8 +47,125 @@ along with this program.  If not, see <http://www.gnu.org/licenses/
 #define OUTPUT_WINDOW 3  //0 HANN 1 HAMMING 2 BLACKMAN 3 VORBIS Output windows for STFT algorithm
 #define OVERLAP_FACTOR 4 //4 is 75% overlap Values bigger than 4 will rescale correctly (if Vorbis windows is not used)
 
+//Speed and quality tiers, indexed by NrepelTier
+static const struct
+{
+	int fft_size;
+	float overlap_factor;
+	float masking;				//default masking, 0 for none
+	float transient_protection; //default transient protection, 0 for none
+} tiers[] = {
+	{FFT_SIZE, OVERLAP_FACTOR, 5.f, 6.f}, //best
+	{FFT_SIZE / 2, 2.f, 5.f, 6.f},		  //balanced
+	{FFT_SIZE / 2, 2.f, 0.f, 0.f},		  //fast
+};
+
+//Most memory nrepel_learn will use to remember spectra of repeated frames
+#define LEARN_CACHE_MAX (64 * 1024 * 1024)
+
 ///---------------------------------------------------------------------
 
+/**
+* FFTW's planner is not thread safe, so instances being created or destroyed on
+* different threads take turns planning.
+*/
+static pthread_mutex_t plan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//File FFTW's wisdom is kept in, if any
+static char *wisdom_file = NULL;
+
+//Stages timed by nrepel_kernel_timing
+enum
+{
+	KERNEL_STFT,
+	KERNEL_MASKING,
+	KERNEL_GAIN,
+	KERNEL_COUNT
+};
+
+//Whether stages are timed, and CPU nanoseconds spent in each, summed over every thread
+static int kernel_timing = 0;
+static uint64_t kernel_ns[KERNEL_COUNT];
+
+/**
+* Returns the thread's CPU time as a stage starts, or 0 if stages aren't timed.
+* CPU time isn't inflated by other threads' turns, as the wall clock would be.
+*/
+static inline uint64_t
+kernel_start(void)
+{
+	struct timespec ts;
+
+	if (!kernel_timing)
+		return 0;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+* Adds the time since start to a stage.
+*/
+static inline void
+kernel_end(int kernel, uint64_t start)
+{
+	if (kernel_timing)
+		__sync_fetch_and_add(&kernel_ns[kernel], kernel_start() - start);
+}
+
+/**
+* Saves all of FFTW's wisdom to the wisdom file. Other processes may be reading
+* it, so the new wisdom replaces it whole. Call with plan_lock held.
+*/
+static void
+save_wisdom(void)
+{
+	size_t len;
+	char *tmp;
+
+	if (!wisdom_file)
+		return;
+	len = strlen(wisdom_file) + 32;
+	tmp = (char *)malloc(len);
+	if (!tmp)
+		return;
+	snprintf(tmp, len, "%s.%lu.tmp", wisdom_file, (unsigned long)getpid());
+
+	if (fftwf_export_wisdom_to_filename(tmp))
+	{
+#ifdef _WIN32
+		unlink(wisdom_file);
+#endif
+		if (rename(tmp, wisdom_file) != 0)
+			unlink(tmp);
+	}
+	else
+	{
+		unlink(tmp);
+	}
+	free(tmp);
+}
+
+/**
+* Plans transforms of count frames, one after another. The fastest way is
+* measured unless the wisdom already knows it, so measurement is paid once per
+* machine if there is a wisdom file. Measuring overwrites the buffers. Call with
+* plan_lock held.
+*/
+static fftwf_plan
+plan_transforms(int fft_size, int count, float *in, float *out, fftwf_r2r_kind kind)
+{
+	fftwf_plan plan = fftwf_plan_many_r2r(1, &fft_size, count, in, NULL, 1, fft_size,
+										  out, NULL, 1, fft_size, &kind,
+										  FFTW_MEASURE | FFTW_WISDOM_ONLY);
+	if (!plan)
+	{
+		plan = fftwf_plan_many_r2r(1, &fft_size, count, in, NULL, 1, fft_size,
+								   out, NULL, 1, fft_size, &kind, FFTW_MEASURE);
+		save_wisdom();
+	}
+	return plan;
+}
+
 /**
 * Noise Profile state.
 */
@@ -115,8 +235,6 @@ typedef struct
 
 	//Arrays and variables for getting bins info
 	float *fft_p2;		  //power spectrum
-	float *fft_magnitude; //magnitude spectrum
-	float *fft_phase;	 //phase spectrum
 
 	//noise related
 	float *noise_thresholds_p2;		  //captured noise profile power spectrum
@@ -129,7 +247,7 @@ typedef struct
 	float *smoothed_spectrum_prev; //previous frame smoothed power spectrum for envelopes
 
 	//Transient preservation related
-	float *transient_preserv_prev; //previous frame smoothed power spectrum for envelopes
+	float *transient_preserv_prev; //previous frame magnitude spectrum for spectral flux
 	float tp_r_mean;
 	bool transient_present;
 	float tp_window_count;
@@ -137,11 +255,6 @@ typedef struct
 	//Reduction gains
 	float *Gk; //definitive gain
 
-	//Ensemble related
-	float *residual_spectrum;
-	float *denoised_spectrum;
-	float *final_spectrum;
-
 	//whitening related
 	float *residual_max_spectrum;
 	float max_decay_rate;
@@ -149,13 +262,9 @@ typedef struct
 
 	//Loizou algorithm
 	float *auto_thresholds; //Reference threshold for louizou algorithm
-	float *prev_noise_thresholds;
 	float *s_pow_spec;
-	float *prev_s_pow_spec;
 	float *p_min;
-	float *prev_p_min;
 	float *speech_p_p;
-	float *prev_speech_p_p;
 
 	//masking
 	float *bark_z;
@@ -164,11 +273,9 @@ typedef struct
 	float *spl_reference_values;
 	float *unity_gain_bark_spectrum;
 	float *spreaded_unity_gain_bark_spectrum;
+	BarkBands bark_bands; //bark band layout of the spectrum
 	float *alpha_masking;
 	float *beta_masking;
-	float *input_fft_buffer_at;
-	float *output_fft_buffer_at;
-	fftwf_plan forward_at;
 
 #if 0
 	//LV2 state URID (Save and restore noise profile)
@@ -183,13 +290,26 @@ typedef struct
 } Nrepel;
 
 /**
-* Instantiates the plugin.
+* Instantiates the plugin, at the best tier.
 */
 void *
 nrepel_instantiate(double rate)
+{
+	return nrepel_instantiate_tier(rate, NREPEL_TIER_BEST);
+}
+
+/**
+* Instantiates the plugin, at the given speed and quality tier.
+*/
+void *
+nrepel_instantiate_tier(double rate, int tier)
 {
 	//Actual struct declaration
-	Nrepel *self = (Nrepel *)calloc(1, sizeof(Nrepel));
+	Nrepel *self;
+
+	if (tier < NREPEL_TIER_BEST || tier > NREPEL_TIER_FAST)
+		return NULL;
+	self = (Nrepel *)calloc(1, sizeof(Nrepel));
 
 #if 0
 	//Retrieve the URID map callback, and needed URIDs
@@ -220,25 +340,29 @@ nrepel_instantiate(double rate)
 	self->amount_of_reduction = 10;
 	self->noise_thresholds_offset = 0;
 	self->release = 150;
-	self->masking = 5;
+	self->masking = tiers[tier].masking;
 	self->whitening_factor_pc = 0;
 	self->noise_learn_state = 0;
 	self->adaptive_state = 0;
 	self->reset_profile = 0;
 	self->residual_listen = 0;
-	self->transient_protection = 6;
+	self->transient_protection = tiers[tier].transient_protection;
 	self->enable = 1;
 
 	//Sampling related
 	self->samp_rate = (float)rate;
 
 	//FFT related
-	self->fft_size = FFT_SIZE;
+	self->fft_size = tiers[tier].fft_size;
 	self->fft_size_2 = self->fft_size / 2;
 	self->input_fft_buffer = (float *)calloc(self->fft_size, sizeof(float));
 	self->output_fft_buffer = (float *)calloc(self->fft_size, sizeof(float));
-	self->forward = fftwf_plan_r2r_1d(self->fft_size, self->input_fft_buffer, self->output_fft_buffer, FFTW_R2HC, FFTW_ESTIMATE);
-	self->backward = fftwf_plan_r2r_1d(self->fft_size, self->output_fft_buffer, self->input_fft_buffer, FFTW_HC2R, FFTW_ESTIMATE);
+	pthread_mutex_lock(&plan_lock);
+	if (vector_level < 0)
+		vector_choose_level(-1);
+	self->forward = plan_transforms(self->fft_size, 1, self->input_fft_buffer, self->output_fft_buffer, FFTW_R2HC);
+	self->backward = plan_transforms(self->fft_size, 1, self->output_fft_buffer, self->input_fft_buffer, FFTW_HC2R);
+	pthread_mutex_unlock(&plan_lock);
 
 	//STFT window related
 	self->window_option_input = INPUT_WINDOW;
@@ -250,7 +374,7 @@ nrepel_instantiate(double rate)
 	self->in_fifo = (float *)calloc(self->fft_size, sizeof(float));
 	self->out_fifo = (float *)calloc(self->fft_size, sizeof(float));
 	self->output_accum = (float *)calloc(self->fft_size * 2, sizeof(float));
-	self->overlap_factor = OVERLAP_FACTOR;
+	self->overlap_factor = tiers[tier].overlap_factor;
 	self->hop = self->fft_size / self->overlap_factor;
 	self->input_latency = self->fft_size - self->hop;
 	self->read_ptr = self->input_latency; //the initial position because we are that many samples ahead
@@ -261,8 +385,6 @@ nrepel_instantiate(double rate)
 
 	//Arrays for getting bins info
 	self->fft_p2 = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
-	self->fft_magnitude = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
-	self->fft_phase = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
 
 	//noise threshold related
 	self->noise_thresholds_p2 = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
@@ -272,13 +394,9 @@ nrepel_instantiate(double rate)
 
 	//noise adaptive estimation related
 	self->auto_thresholds = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
-	self->prev_noise_thresholds = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
 	self->s_pow_spec = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
-	self->prev_s_pow_spec = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
 	self->p_min = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
-	self->prev_p_min = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
 	self->speech_p_p = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
-	self->prev_speech_p_p = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
 
 	//smoothing related
 	self->smoothed_spectrum = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
@@ -299,9 +417,6 @@ nrepel_instantiate(double rate)
 	self->alpha_masking = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
 	self->beta_masking = (float *)calloc((self->fft_size_2 + 1), sizeof(float));
 	self->SSF = (float *)calloc((N_BARK_BANDS * N_BARK_BANDS), sizeof(float));
-	self->input_fft_buffer_at = (float *)calloc(self->fft_size, sizeof(float));
-	self->output_fft_buffer_at = (float *)calloc(self->fft_size, sizeof(float));
-	self->forward_at = fftwf_plan_r2r_1d(self->fft_size, self->input_fft_buffer_at, self->output_fft_buffer_at, FFTW_R2HC, FFTW_ESTIMATE);
 
 	//reduction gains related
 	self->Gk = (float *)calloc((self->fft_size), sizeof(float));
@@ -311,11 +426,6 @@ nrepel_instantiate(double rate)
 	self->max_decay_rate = expf(-1000.f / (((WHITENING_DECAY_RATE)*self->samp_rate) / self->hop));
 	self->whitening_window_count = 0.f;
 
-	//final ensemble related
-	self->residual_spectrum = (float *)calloc((self->fft_size), sizeof(float));
-	self->denoised_spectrum = (float *)calloc((self->fft_size), sizeof(float));
-	self->final_spectrum = (float *)calloc((self->fft_size), sizeof(float));
-
 	//Window combination initialization (pre processing window post processing window)
 	fft_pre_and_post_window(self->input_window, self->output_window,
 							self->fft_size, self->window_option_input,
@@ -332,9 +442,10 @@ nrepel_instantiate(double rate)
 	compute_bark_mapping(self->bark_z, self->fft_size_2, self->samp_rate);
 	compute_absolute_thresholds(self->absolute_thresholds, self->fft_size_2,
 								self->samp_rate);
+	//The forward transform's buffers are free until the first frame
 	spl_reference(self->spl_reference_values, self->fft_size_2, self->samp_rate,
-				  self->input_fft_buffer_at, self->output_fft_buffer_at,
-				  &self->forward_at);
+				  self->input_fft_buffer, self->output_fft_buffer,
+				  &self->forward);
 	compute_SSF(self->SSF);
 
 	//Initializing unity gain values for offset normalization
@@ -342,6 +453,8 @@ nrepel_instantiate(double rate)
 	//Convolve unitary energy bark spectrum with SSF
 	convolve_with_SSF(self->SSF, self->unity_gain_bark_spectrum,
 					  self->spreaded_unity_gain_bark_spectrum);
+	compute_bark_bands(&self->bark_bands, self->bark_z, self->fft_size_2,
+					   self->spreaded_unity_gain_bark_spectrum);
 
 	initialize_array(self->alpha_masking, 1.f, self->fft_size_2 + 1);
 	initialize_array(self->beta_masking, 0.f, self->fft_size_2 + 1);
@@ -349,6 +462,18 @@ nrepel_instantiate(double rate)
 	return (void *)self;
 }
 
+/**
+* Chooses the kernels for the spectral processing.
+*/
+int
+nrepel_vector_level(int level)
+{
+	pthread_mutex_lock(&plan_lock);
+	level = vector_choose_level(level);
+	pthread_mutex_unlock(&plan_lock);
+	return level;
+}
+
 /**
 * Used by the host to connect the ports of this plugin.
 */
@@ -420,13 +545,9 @@ reset_noise_profile(Nrepel *self)
 	initialize_array(self->residual_max_spectrum, 0.f, self->fft_size);
 	self->whitening_window_count = 0.f;
 
-	initialize_array(self->prev_noise_thresholds, 0.f, self->fft_size_2 + 1);
 	initialize_array(self->s_pow_spec, 0.f, self->fft_size_2 + 1);
-	initialize_array(self->prev_s_pow_spec, 0.f, self->fft_size_2 + 1);
 	initialize_array(self->p_min, 0.f, self->fft_size_2 + 1);
-	initialize_array(self->prev_p_min, 0.f, self->fft_size_2 + 1);
 	initialize_array(self->speech_p_p, 0.f, self->fft_size_2 + 1);
-	initialize_array(self->prev_speech_p_p, 0.f, self->fft_size_2 + 1);
 
 	initialize_array(self->alpha_masking, 1.f, self->fft_size_2 + 1);
 	initialize_array(self->beta_masking, 0.f, self->fft_size_2 + 1);
@@ -437,17 +558,143 @@ reset_noise_profile(Nrepel *self)
 }
 
 /**
-* Main process function of the plugin.
+* Copy out the learned noise profile, NREPEL_PROFILE_SIZE values, and the number
+* of windows it was learned from. Returns 0 if there is no profile.
+*/
+int
+nrepel_get_profile(void *instance, float *profile, float *window_count)
+{
+	Nrepel *self = (Nrepel *)instance;
+
+	if (!self->noise_thresholds_availables)
+		return 0;
+	memcpy(profile, self->noise_thresholds_p2, (self->fft_size_2 + 1) * sizeof(float));
+	*window_count = self->noise_window_count;
+	return 1;
+}
+
+/**
+* Load a previously learned noise profile, as if it had been learned by this
+* instance.
 */
 void
-nrepel_run(void *instance, uint32_t n_samples)
+nrepel_set_profile(void *instance, const float *profile, float window_count)
 {
 	Nrepel *self = (Nrepel *)instance;
 
-	//handy variables
+	memcpy(self->noise_thresholds_p2, profile, (self->fft_size_2 + 1) * sizeof(float));
+	self->noise_window_count = window_count;
+	self->noise_thresholds_availables = true;
+}
+
+/**
+* Learn a noise profile from a buffer of noise. The result is exactly what
+* running a fresh instance over the buffer repeats times in learning mode would
+* learn, but each distinct STFT frame is only transformed once: since the
+* frames are a hop apart, they repeat every lcm(n_samples, hop) samples.
+*/
+void
+nrepel_learn(void *instance, const float *samples, uint32_t n_samples, uint32_t repeats)
+{
+	Nrepel *self = (Nrepel *)instance;
+	uint64_t total = (uint64_t)n_samples * repeats;
+	uint64_t frames = total / self->hop;
+	uint64_t j;
+	uint32_t gcd, a, b;
+	uint32_t distinct = 0;
+	int bins = self->fft_size_2 + 1;
 	int k;
-	unsigned int pos;
+	float *cache = NULL;
+	char *cached = NULL;
+	unsigned int denormals;
+
+	if (!n_samples)
+		return;
+
+	//Frames start a whole number of hops in, so the distinct frames start gcd(n_samples, hop) apart
+	a = n_samples;
+	b = self->hop;
+	while (b)
+	{
+		uint32_t t = a % b;
+		a = b;
+		b = t;
+	}
+	gcd = a;
+	distinct = n_samples / gcd;
+	denormals = vector_enter();
+
+	//Only remember spectra if they repeat, and they fit
+	if ((uint64_t)distinct < frames && (uint64_t)distinct * bins * sizeof(float) <= LEARN_CACHE_MAX)
+	{
+		cache = (float *)malloc((size_t)distinct * bins * sizeof(float));
+		cached = (char *)calloc(distinct, 1);
+		if (!cache || !cached)
+		{
+			free(cache);
+			free(cached);
+			cache = NULL;
+			cached = NULL;
+		}
+	}
+
+	for (j = 0; j < frames; j++)
+	{
+		//This frame ends after the (j+1)th hop, and before the start is silence
+		int64_t start = (int64_t)self->hop * (int64_t)(j + 1) - self->fft_size;
+		float *fft_p2 = self->fft_p2;
+		uint32_t slot = 0;
+		bool reuse = false;
+
+		if (cache && start >= 0)
+		{
+			slot = (uint32_t)((uint64_t)start % n_samples) / gcd;
+			reuse = true;
+			if (cached[slot])
+			{
+				fft_p2 = cache + (size_t)slot * bins;
+			}
+		}
 
+		if (!reuse || !cached[slot])
+		{
+			for (k = 0; k < self->fft_size; k++)
+			{
+				int64_t t = start + k;
+				float sample = (t < 0) ? 0.f : samples[(uint64_t)t % n_samples];
+				self->input_fft_buffer[k] = sample * self->input_window[k];
+			}
+			fftwf_execute(self->forward);
+			vector_power_spectrum(self->fft_p2, self->output_fft_buffer,
+								  self->fft_size_2, self->fft_size);
+			if (reuse)
+			{
+				memcpy(cache + (size_t)slot * bins, self->fft_p2, bins * sizeof(float));
+				cached[slot] = 1;
+			}
+		}
+
+		//Accumulate just as nrepel_run does when learning
+		if (!is_empty(fft_p2, self->fft_size_2))
+		{
+			self->noise_window_count++;
+			get_noise_statistics(fft_p2, self->fft_size_2,
+								 self->noise_thresholds_p2, self->noise_window_count);
+			self->noise_thresholds_availables = true;
+		}
+	}
+
+	vector_leave(denormals);
+	free(cache);
+	free(cached);
+}
+
+/**
+* Sets up an instance's parameters for a run.
+*/
+static void
+prepare_run(Nrepel *self)
+{
 	//Inform latency at run call
 	if (self->report_latency)
 		*(self->report_latency) = (float)self->input_latency;
@@ -486,166 +733,350 @@ nrepel_run(void *instance, uint32_t n_samples)
 	self->amount_of_reduction_linear = from_dB(-1.f * self->amount_of_reduction);
 	self->thresholds_offset_linear = from_dB(self->noise_thresholds_offset);
 	self->whitening_factor = self->whitening_factor_pc / 100.f;
+}
+
+/**
+* Moves samples in and out of an instance's FIFOs, up to the end of the frame
+* being filled. Returns how many samples were moved. The frame is full when the
+* read pointer reaches the fft size.
+*/
+static uint32_t
+move_samples(Nrepel *self, uint32_t pos, uint32_t n_samples)
+{
+	uint32_t count = MIN(n_samples - pos, (uint32_t)(self->fft_size - self->read_ptr));
+
+	//Store samples int the input buffer
+	memcpy(self->in_fifo + self->read_ptr, self->input + pos, count * sizeof(float));
+	//Output samples in the output buffer (even zeros introduced by latency)
+	memcpy(self->output + pos, self->out_fifo + self->read_ptr - self->input_latency,
+		   count * sizeof(float));
+	//Now move the read pointer
+	self->read_ptr += count;
+
+	return count;
+}
+
+/**
+* Windows a full frame for the forward transform.
+* \param fft_buffer the input of the forward transform
+*/
+static void
+analyze_frame(Nrepel *self, float *fft_buffer)
+{
+	//Reset the input buffer position
+	self->read_ptr = self->input_latency;
+
+	//Adding and windowing the frame input values in the center (zero-phasing)
+	vector_multiply(fft_buffer, self->in_fifo, self->input_window, self->fft_size);
+}
+
+/**
+* Does the spectral processing of a frame.
+* \param fft_buffer the output of the forward transform, and input of the backward
+*/
+static void
+process_frame(Nrepel *self, float *fft_buffer)
+{
+	uint64_t start = kernel_start();
+
+	//-----------GET INFO FROM BINS--------------
+
+	//Only the power spectrum is used
+	vector_power_spectrum(self->fft_p2, fft_buffer,
+						  self->fft_size_2, self->fft_size);
+	kernel_end(KERNEL_STFT, start);
+
+	/////////////////////SPECTRAL PROCESSING//////////////////////////
+
+	/*This section countains the specific noise reduction processing blocks
+		but it could be replaced with any spectral processing (I'm looking at you future tinkerer)
+		Parameters for the STFT transform can be changed at the top of this file
+	*/
+
+	//If the spectrum is not silence
+	if (!is_empty(self->fft_p2, self->fft_size_2))
+	{
+		//If adaptive noise is selected the noise is adapted in time
+		if (self->adaptive_state == 1.f)
+		{
+			//This has to be revised(issue 8 on github)
+			adapt_noise(self->fft_p2, self->fft_size_2, self->noise_thresholds_p2,
+						self->auto_thresholds, self->s_pow_spec, self->p_min,
+						self->speech_p_p);
+
+			self->noise_thresholds_availables = true;
+		}
+
+		/*If selected estimate noise spectrum is based on selected portion of signal
+		 *do not process the signal
+		 */
+		if (self->noise_learn_state == 1.f)
+		{ //MANUAL
+
+			//Increase window count for rolling mean
+			self->noise_window_count++;
+
+			get_noise_statistics(self->fft_p2, self->fft_size_2,
+								 self->noise_thresholds_p2, self->noise_window_count);
+
+			self->noise_thresholds_availables = true;
+		}
+		else
+		{
+			//If there is a noise profile reduce noise
+			if (self->noise_thresholds_availables == true)
+			{
+				//Detector smoothing and oversubtraction
+				start = kernel_start();
+				preprocessing(self->thresholds_offset_linear, self->fft_p2,
+							  self->noise_thresholds_p2, self->noise_thresholds_scaled,
+							  self->smoothed_spectrum, self->smoothed_spectrum_prev,
+							  self->fft_size_2, &self->bark_bands, self->absolute_thresholds,
+							  self->SSF, self->release_coeff,
+							  self->spl_reference_values, self->alpha_masking,
+							  self->beta_masking, self->masking, self->adaptive_state,
+							  self->amount_of_reduction_linear, self->transient_preserv_prev,
+							  &self->tp_window_count, &self->tp_r_mean,
+							  &self->transient_present, self->transient_protection);
+				kernel_end(KERNEL_MASKING, start);
+
+				//Supression rule
+				start = kernel_start();
+				spectral_gain(self->fft_p2, self->noise_thresholds_p2,
+							  self->noise_thresholds_scaled, self->smoothed_spectrum,
+							  self->fft_size_2, self->adaptive_state, self->Gk,
+							  self->transient_protection, self->transient_present);
+
+				//apply gains, then ensemble the final spectrum using residual and denoised
+				final_spectrum_ensemble(self->fft_size, fft_buffer,
+										self->Gk, self->whitening_factor,
+										self->residual_max_spectrum,
+										&self->whitening_window_count,
+										self->max_decay_rate,
+										self->amount_of_reduction_linear,
+										self->residual_listen, self->wet_dry);
+				kernel_end(KERNEL_GAIN, start);
+			}
+		}
+	}
+}
+
+/**
+* Overlap-adds the inverse transform of a frame into the output FIFO.
+* \param fft_buffer the output of the backward transform
+*/
+static void
+synthesize_frame(Nrepel *self, const float *fft_buffer)
+{
+	//Normalizing, windowing, scaling and accumulation
+	vector_overlap_add(self->output_accum, fft_buffer, self->output_window,
+					   (float)self->fft_size,
+					   self->overlap_scale_factor * self->overlap_factor,
+					   self->fft_size);
+
+	//Output samples up to the hop size
+	memcpy(self->out_fifo, self->output_accum, self->hop * sizeof(float));
+
+	//shift FFT accumulator the hop size
+	memmove(self->output_accum, self->output_accum + self->hop,
+			self->fft_size * sizeof(float));
+
+	//move input FIFO
+	memmove(self->in_fifo, self->in_fifo + self->hop,
+			self->input_latency * sizeof(float));
+}
+
+/**
+* Main process function of the plugin.
+*/
+void
+nrepel_run(void *instance, uint32_t n_samples)
+{
+	Nrepel *self = (Nrepel *)instance;
+	uint32_t pos = 0;
+	unsigned int denormals;
+
+	prepare_run(self);
+	denormals = vector_enter();
 
 	//main loop for processing
-	for (pos = 0; pos < n_samples; pos++)
+	while (pos < n_samples)
 	{
-		//Store samples int the input buffer
-		self->in_fifo[self->read_ptr] = self->input[pos];
-		//Output samples in the output buffer (even zeros introduced by latency)
-		self->output[pos] = self->out_fifo[self->read_ptr - self->input_latency];
-		//Now move the read pointer
-		self->read_ptr++;
+		pos += move_samples(self, pos, n_samples);
 
 		//Once the buffer is full we can do stuff
 		if (self->read_ptr >= self->fft_size)
 		{
-			//Reset the input buffer position
-			self->read_ptr = self->input_latency;
+			uint64_t start = kernel_start();
 
 			//----------STFT Analysis------------
+			analyze_frame(self, self->input_fft_buffer);
+			fftwf_execute(self->forward);
+			kernel_end(KERNEL_STFT, start);
 
-			//Adding and windowing the frame input values in the center (zero-phasing)
-			for (k = 0; k < self->fft_size; k++)
-			{
-				self->input_fft_buffer[k] = self->in_fifo[k] * self->input_window[k];
-			}
-
-			//----------FFT Analysis------------
+			/////////////////////SPECTRAL PROCESSING//////////////////////////
+			process_frame(self, self->output_fft_buffer);
 
-			//Do transform
-			fftwf_execute(self->forward);
+			//----------STFT Synthesis------------
+			start = kernel_start();
+			fftwf_execute(self->backward);
+			synthesize_frame(self, self->input_fft_buffer);
+			kernel_end(KERNEL_STFT, start);
+		}
+	}
 
-			//-----------GET INFO FROM BINS--------------
+	vector_leave(denormals);
+}
 
-			get_info_from_bins(self->fft_p2, self->fft_magnitude, self->fft_phase,
-							   self->fft_size_2, self->fft_size,
-							   self->output_fft_buffer);
+/**
+* Instances run together, transforming every channel's frame at once.
+*/
+typedef struct
+{
+	int channels;
+	Nrepel **instances;
+	float *input_fft_buffer;  //each channel's frame, one after another
+	float *output_fft_buffer; //each channel's spectrum, one after another
+	fftwf_plan forward;
+	fftwf_plan backward;
+} NrepelBatch;
 
-			/////////////////////SPECTRAL PROCESSING//////////////////////////
+/**
+* Batches instances together. Returns NULL if they aren't in step.
+*/
+void *
+nrepel_batch(void **instances, int channels)
+{
+	NrepelBatch *batch;
+	Nrepel *first = (Nrepel *)instances[0];
+	int fft_size = first->fft_size;
+	int c;
 
-			/*This section countains the specific noise reduction processing blocks
-				but it could be replaced with any spectral processing (I'm looking at you future tinkerer)
-				Parameters for the STFT transform can be changed at the top of this file
-			*/
+	for (c = 1; c < channels; c++)
+	{
+		Nrepel *other = (Nrepel *)instances[c];
+		if (other->fft_size != fft_size || other->read_ptr != first->read_ptr)
+			return NULL;
+	}
 
-			//If the spectrum is not silence
-			if (!is_empty(self->fft_p2, self->fft_size_2))
-			{
-				//If adaptive noise is selected the noise is adapted in time
-				if (self->adaptive_state == 1.f)
-				{
-					//This has to be revised(issue 8 on github)
-					adapt_noise(self->fft_p2, self->fft_size_2, self->noise_thresholds_p2,
-								self->auto_thresholds, self->prev_noise_thresholds,
-								self->s_pow_spec, self->prev_s_pow_spec, self->p_min,
-								self->prev_p_min, self->speech_p_p, self->prev_speech_p_p);
-
-					self->noise_thresholds_availables = true;
-				}
-
-				/*If selected estimate noise spectrum is based on selected portion of signal
-				 *do not process the signal
-				 */
-				if (self->noise_learn_state == 1.f)
-				{ //MANUAL
-
-					//Increase window count for rolling mean
-					self->noise_window_count++;
-
-					get_noise_statistics(self->fft_p2, self->fft_size_2,
-										 self->noise_thresholds_p2, self->noise_window_count);
-
-					self->noise_thresholds_availables = true;
-				}
-				else
-				{
-					//If there is a noise profile reduce noise
-					if (self->noise_thresholds_availables == true)
-					{
-						//Detector smoothing and oversubtraction
-						preprocessing(self->thresholds_offset_linear, self->fft_p2,
-									  self->noise_thresholds_p2, self->noise_thresholds_scaled,
-									  self->smoothed_spectrum, self->smoothed_spectrum_prev,
-									  self->fft_size_2, self->bark_z, self->absolute_thresholds,
-									  self->SSF, self->release_coeff,
-									  self->spreaded_unity_gain_bark_spectrum,
-									  self->spl_reference_values, self->alpha_masking,
-									  self->beta_masking, self->masking, self->adaptive_state,
-									  self->amount_of_reduction_linear, self->transient_preserv_prev,
-									  &self->tp_window_count, &self->tp_r_mean,
-									  &self->transient_present, self->transient_protection);
-
-						//Supression rule
-						spectral_gain(self->fft_p2, self->noise_thresholds_p2,
-									  self->noise_thresholds_scaled, self->smoothed_spectrum,
-									  self->fft_size_2, self->adaptive_state, self->Gk,
-									  self->transient_protection, self->transient_present);
-
-						//apply gains
-						denoised_calulation(self->fft_size, self->output_fft_buffer,
-											self->denoised_spectrum, self->Gk);
-
-						//residual signal
-						residual_calulation(self->fft_size, self->output_fft_buffer,
-											self->residual_spectrum, self->denoised_spectrum,
-											self->whitening_factor, self->residual_max_spectrum,
-											&self->whitening_window_count, self->max_decay_rate);
-
-						//Ensemble the final spectrum using residual and denoised
-						final_spectrum_ensemble(self->fft_size, self->final_spectrum,
-												self->residual_spectrum,
-												self->denoised_spectrum,
-												self->amount_of_reduction_linear,
-												self->residual_listen);
-
-						soft_bypass(self->final_spectrum, self->output_fft_buffer,
-									self->wet_dry, self->fft_size);
-					}
-				}
-			}
+	batch = (NrepelBatch *)calloc(1, sizeof(NrepelBatch));
+	batch->channels = channels;
+	batch->instances = (Nrepel **)calloc(channels, sizeof(Nrepel *));
+	memcpy(batch->instances, instances, channels * sizeof(Nrepel *));
+	batch->input_fft_buffer = (float *)calloc(fft_size * channels, sizeof(float));
+	batch->output_fft_buffer = (float *)calloc(fft_size * channels, sizeof(float));
+
+	pthread_mutex_lock(&plan_lock);
+	batch->forward = plan_transforms(fft_size, channels, batch->input_fft_buffer,
+									 batch->output_fft_buffer, FFTW_R2HC);
+	batch->backward = plan_transforms(fft_size, channels, batch->output_fft_buffer,
+									  batch->input_fft_buffer, FFTW_HC2R);
+	pthread_mutex_unlock(&plan_lock);
+
+	return (void *)batch;
+}
 
-			///////////////////////////////////////////////////////////
+/**
+* Runs every instance in a batch over n_samples of its own input and output.
+*/
+void
+nrepel_batch_run(void *instance, uint32_t n_samples)
+{
+	NrepelBatch *batch = (NrepelBatch *)instance;
+	Nrepel **instances = batch->instances;
+	int fft_size = instances[0]->fft_size;
+	uint32_t pos = 0, count = 0;
+	unsigned int denormals;
+	int c;
+
+	for (c = 0; c < batch->channels; c++)
+		prepare_run(instances[c]);
+	denormals = vector_enter();
+
+	while (pos < n_samples)
+	{
+		//They're in step, so they all move the same samples
+		for (c = 0; c < batch->channels; c++)
+			count = move_samples(instances[c], pos, n_samples);
+		pos += count;
 
-			//----------STFT Synthesis------------
+		if (instances[0]->read_ptr >= fft_size)
+		{
+			uint64_t start = kernel_start();
+			for (c = 0; c < batch->channels; c++)
+				analyze_frame(instances[c], batch->input_fft_buffer + c * fft_size);
+			fftwf_execute(batch->forward);
+			kernel_end(KERNEL_STFT, start);
+
+			for (c = 0; c < batch->channels; c++)
+				process_frame(instances[c], batch->output_fft_buffer + c * fft_size);
+
+			start = kernel_start();
+			fftwf_execute(batch->backward);
+			for (c = 0; c < batch->channels; c++)
+				synthesize_frame(instances[c], batch->input_fft_buffer + c * fft_size);
+			kernel_end(KERNEL_STFT, start);
+		}
+	}
 
-			//------------FFT Synthesis-------------
+	vector_leave(denormals);
+}
 
-			//Do inverse transform
-			fftwf_execute(self->backward);
+/**
+* Frees a batch, but not its instances.
+*/
+void
+nrepel_batch_cleanup(void *instance)
+{
+	NrepelBatch *batch = (NrepelBatch *)instance;
 
-			//Normalizing value
-			for (k = 0; k < self->fft_size; k++)
-			{
-				self->input_fft_buffer[k] = self->input_fft_buffer[k] / self->fft_size;
-			}
+	pthread_mutex_lock(&plan_lock);
+	fftwf_destroy_plan(batch->forward);
+	fftwf_destroy_plan(batch->backward);
+	pthread_mutex_unlock(&plan_lock);
 
-			//------------OVERLAPADD-------------
+	free(batch->input_fft_buffer);
+	free(batch->output_fft_buffer);
+	free(batch->instances);
+	free(batch);
+}
 
-			//Windowing scaling and accumulation
-			for (k = 0; k < self->fft_size; k++)
-			{
-				self->output_accum[k] += (self->output_window[k] * self->input_fft_buffer[k]) / (self->overlap_scale_factor * self->overlap_factor);
-			}
+/**
+* Times the stages of every instance from now on, or stops.
+*/
+void
+nrepel_kernel_timing(int enable)
+{
+	int k;
 
-			//Output samples up to the hop size
-			for (k = 0; k < self->hop; k++)
-			{
-				self->out_fifo[k] = self->output_accum[k];
-			}
+	if (enable)
+		for (k = 0; k < KERNEL_COUNT; k++)
+			kernel_ns[k] = 0;
+	kernel_timing = enable;
+}
 
-			//shift FFT accumulator the hop size
-			memmove(self->output_accum, self->output_accum + self->hop,
-					self->fft_size * sizeof(float));
+/**
+* Gets the CPU seconds spent in each stage.
+*/
+void
+nrepel_kernel_times(double *stft, double *masking, double *gain)
+{
+	*stft = kernel_ns[KERNEL_STFT] / 1e9;
+	*masking = kernel_ns[KERNEL_MASKING] / 1e9;
+	*gain = kernel_ns[KERNEL_GAIN] / 1e9;
+}
 
-			//move input FIFO
-			for (k = 0; k < self->input_latency; k++)
-			{
-				self->in_fifo[k] = self->in_fifo[k + self->hop];
-			}
-			//-------------------------------
-		} //if
-	}	 //main loop
+/**
+* Keep FFTW's wisdom in a file.
+*/
+void
+nrepel_wisdom(const char *filename)
+{
+	pthread_mutex_lock(&plan_lock);
+	free(wisdom_file);
+	wisdom_file = strdup(filename);
+	fftwf_import_wisdom_from_filename(filename);
+	pthread_mutex_unlock(&plan_lock);
 }
 
 /**
@@ -654,7 +1085,41 @@ nrepel_run(void *instance, uint32_t n_samples)
 void
 nrepel_cleanup(void *instance)
 {
-	free(instance);
+	Nrepel *self = (Nrepel *)instance;
+
+	pthread_mutex_lock(&plan_lock);
+	fftwf_destroy_plan(self->forward);
+	fftwf_destroy_plan(self->backward);
+	pthread_mutex_unlock(&plan_lock);
+
+	free(self->input_fft_buffer);
+	free(self->output_fft_buffer);
+	free(self->input_window);
+	free(self->output_window);
+	free(self->in_fifo);
+	free(self->out_fifo);
+	free(self->output_accum);
+	free(self->fft_p2);
+	free(self->noise_thresholds_p2);
+	free(self->noise_thresholds_scaled);
+	free(self->auto_thresholds);
+	free(self->s_pow_spec);
+	free(self->p_min);
+	free(self->speech_p_p);
+	free(self->smoothed_spectrum);
+	free(self->smoothed_spectrum_prev);
+	free(self->transient_preserv_prev);
+	free(self->bark_z);
+	free(self->absolute_thresholds);
+	free(self->unity_gain_bark_spectrum);
+	free(self->spreaded_unity_gain_bark_spectrum);
+	free(self->spl_reference_values);
+	free(self->alpha_masking);
+	free(self->beta_masking);
+	free(self->SSF);
+	free(self->Gk);
+	free(self->residual_max_spectrum);
+	free(self);
 }
 
 #if 0
@@ -21,9 +21,58 @@ typedef enum {
 	NREPEL_OUTPUT = 13,
 } PortIndex;
 
+/**
+* Speed and quality tiers. The best tier uses 2048-point FFTs with 75% overlap,
+* bark masking and transient protection. The balanced tier uses 1024-point FFTs
+* with 50% overlap. The fast tier does too, and also skips masking and transient
+* protection. Masking and transient protection are only defaults, and may be
+* connected like any other port.
+*/
+typedef enum {
+	NREPEL_TIER_BEST = 0,
+	NREPEL_TIER_BALANCED = 1,
+	NREPEL_TIER_FAST = 2,
+} NrepelTier;
+
+/**
+* Size of a noise profile of the best tier, in floats. Profiles of faster tiers
+* are smaller, and only fit instances of the same tier.
+*/
+#define NREPEL_PROFILE_SIZE 1025
+
+/**
+* STFT hop size of the best tier, which every tier's hop divides. Instances
+* that start on the same hop boundary analyze the same frames.
+*/
+#define NREPEL_HOP 512
+
+/**
+* Kernels for the spectral processing. The reference level is the original
+* arithmetic, bit for bit. The scalar level flushes nothing and vectorizes
+* nothing, but approximates the masking thresholds' logarithms; the SSE2 and
+* AVX2 levels do the same with vector instructions and flush denormals to zero.
+*/
+typedef enum {
+	NREPEL_VECTOR_REFERENCE = 0,
+	NREPEL_VECTOR_SCALAR = 1,
+	NREPEL_VECTOR_SSE2 = 2,
+	NREPEL_VECTOR_AVX2 = 3,
+} NrepelVectorLevel;
+
+/**
+* Chooses the kernels for every instance, up to the best the CPU supports, and
+* returns the level chosen. A negative level chooses the best, which is also
+* the default. Call it before instantiating.
+*/
+int
+nrepel_vector_level(int level);
+
 void *
 nrepel_instantiate(double rate);
 
+void *
+nrepel_instantiate_tier(double rate, int tier);
+
 void
 nrepel_connect_port(void *instance, uint32_t port, void *data);
 
@@ -33,4 +82,52 @@ nrepel_run(void *instance, uint32_t n_samples);
 void
 nrepel_cleanup(void *instance);
 
+void
+nrepel_learn(void *instance, const float *samples, uint32_t n_samples, uint32_t repeats);
+
+int
+nrepel_get_profile(void *instance, float *profile, float *window_count);
+
+void
+nrepel_set_profile(void *instance, const float *profile, float window_count);
+
+/**
+* Batch instances, usually one per channel, to run them together: each hop,
+* every channel's frame is transformed by one plan. The instances keep their
+* own ports and state, and must be in step, i.e. have run the same number of
+* samples. Returns NULL if they aren't.
+*/
+void *
+nrepel_batch(void **instances, int channels);
+
+void
+nrepel_batch_run(void *batch, uint32_t n_samples);
+
+void
+nrepel_batch_cleanup(void *batch);
+
+/**
+* Keep FFTW's wisdom in this file. Plans are measured, so this saves measuring
+* them again in later processes. Call it before instantiating.
+*/
+void
+nrepel_wisdom(const char *filename);
+
+/**
+* Times the STFT, masking and gain stages of every instance, for benchmarks.
+* Enabling clears the times. Timing is off by default, since reading the clock
+* costs a little itself.
+*/
+void
+nrepel_kernel_timing(int enable);
+
+/**
+* Gets the CPU seconds every instance spent in each stage while timing was
+* enabled, summed over all threads. The STFT includes windowing, both transforms and
+* overlap-adding; masking includes smoothing and transient detection; the gain
+* includes applying it.
+*/
+void
+nrepel_kernel_times(double *stft, double *masking, double *gain);
+
 #endif
@@ -42,18 +42,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/
 * \param smoothed_spectrum_prev the power specturm with time smoothing applied of previous frame
 * \param fft_size_2 is half of the fft size
 * \param prev_beta beta of previous frame for adaptive smoothing (not used yet)
-* \param bark_z defines the bark to linear mapping for current spectrum config
+* \param bands the bark bands for current spectrum config
 * \param absolute_thresholds defines the absolute thresholds of hearing for current spectrum config
 * \param SSF defines the spreading function matrix
 * \param release_coeff release coefficient for time smoothing
-* \param spreaded_unity_gain_bark_spectrum correction to be applied to SSF convolution
 * \param spl_reference_values defines the reference values for each bin to convert from db to db SPL
 * \param alpha_masking is the array of oversubtraction factors for each bin
 * \param beta_masking is the array of the spectral flooring factors for each bin
 * \param masking_value is the limit max oversubtraction to be computed
 * \param adaptive flag that indicates if the noise is being estimated adaptively
 * \param reduction_value is the limit max the spectral flooring to be computed
-* \param transient_preserv_prev is the previous frame for spectral flux computing
+* \param transient_preserv_prev is the previous frame's magnitude spectrum for spectral flux computing
 * \param tp_window_count is the frame counter for the rolling mean thresholding for onset detection
 * \param tp_r_mean is the rolling mean value for onset detection
 * \param transient_present indicates if current frame is an onset or not (contains a transient)
@@ -64,9 +63,8 @@ preprocessing(float noise_thresholds_offset, float *fft_p2,
               float *noise_thresholds_p2,
               float *noise_thresholds_scaled, float *smoothed_spectrum,
               float *smoothed_spectrum_prev, int fft_size_2,
-              float *bark_z, float *absolute_thresholds, float *SSF,
-              float release_coeff, float *spreaded_unity_gain_bark_spectrum,
-              float *spl_reference_values, float *alpha_masking, float *beta_masking,
+              const BarkBands *bands, float *absolute_thresholds, float *SSF,
+              float release_coeff, float *spl_reference_values, float *alpha_masking, float *beta_masking,
               float masking_value, float adaptive_state, float reduction_value,
               float *transient_preserv_prev, float *tp_window_count, float *tp_r_mean,
               bool *transient_present, float transient_protection)
@@ -89,8 +87,8 @@ preprocessing(float noise_thresholds_offset, float *fft_p2,
 	if (masking_value > 1.f && adaptive_state == 0.f)
 	{ //Only when adaptive is off
 		compute_alpha_and_beta(fft_p2, noise_thresholds_p2, fft_size_2,
-							   alpha_masking, beta_masking, bark_z, absolute_thresholds,
-							   SSF, spreaded_unity_gain_bark_spectrum, spl_reference_values,
+							   alpha_masking, beta_masking, bands, absolute_thresholds,
+							   SSF, spl_reference_values,
 							   masking_value, reduction_value);
 	}
 	else
@@ -117,11 +115,8 @@ preprocessing(float noise_thresholds_offset, float *fft_p2,
 
 	if (adaptive_state == 0.f) //Only when adaptive is off
 	{
-		memcpy(smoothed_spectrum, fft_p2, sizeof(float) * (fft_size_2 + 1));
-
-		apply_time_envelope(smoothed_spectrum, smoothed_spectrum_prev, fft_size_2, release_coeff);
-
-		memcpy(smoothed_spectrum_prev, smoothed_spectrum, sizeof(float) * (fft_size_2 + 1));
+		vector_time_envelope(smoothed_spectrum, smoothed_spectrum_prev, fft_p2, fft_size_2,
+							 release_coeff);
 	}
 }
 
@@ -164,111 +159,41 @@ spectral_gain(float *fft_p2, float *noise_thresholds_p2, float *noise_thresholds
 }
 
 /**
-* Applies the filter to the complex spectrum and gets the clean signal.
+* Applies the filter to the complex spectrum, gets the residual of the reduction
+* and mixes the two taking into account the reduction configured by the user,
+* then bypasses softly. Outputs the final signal or the residual only.
 * \param fft_size size of the fft
-* \param output_fft_buffer the unprocessed spectrum remaining in the fft buffer
-* \param denoised_spectrum the spectrum of the cleaned signal
+* \param output_fft_buffer the unprocessed spectrum remaining in the fft buffer, replaced by the final one
 * \param Gk is the filter computed by the supression rule for each bin of the spectrum
-*/
-static void
-denoised_calulation(int fft_size, float *output_fft_buffer,
-                    float *denoised_spectrum, float *Gk)
-{
-	int k;
-
-	//Apply the computed gain to the signal and store it in denoised array
-	for (k = 0; k < fft_size; k++)
-	{
-		denoised_spectrum[k] = output_fft_buffer[k] * Gk[k];
-	}
-}
-
-/**
-* Gets the residual signal of the reduction.
-* \param fft_size size of the fft
-* \param output_fft_buffer the unprocessed spectrum remaining in the fft buffer
-* \param denoised_spectrum the spectrum of the cleaned signal
 * \param whitening_factor the mix coefficient between whitened and not whitened residual spectrum
 * \param residual_max_spectrum contains the maximun temporal value in each residual bin
 * \param whitening_window_count counts frames to distinguish the first from the others
 * \param max_decay_rate coefficient that sets the memory for each temporal maximun
-*/
-static void
-residual_calulation(int fft_size, float *output_fft_buffer,
-                    float *residual_spectrum, float *denoised_spectrum,
-                    float whitening_factor, float *residual_max_spectrum,
-                    float *whitening_window_count, float max_decay_rate)
-{
-
-	int k;
-
-	//Residual signal
-	for (k = 0; k < fft_size; k++)
-	{
-		residual_spectrum[k] = output_fft_buffer[k] - denoised_spectrum[k];
-	}
-
-	////////////POSTPROCESSING RESIDUAL
-	//Whitening (residual spectrum more similar to white noise)
-	if (whitening_factor > 0.f)
-	{
-		spectral_whitening(residual_spectrum, whitening_factor, fft_size,
-						   residual_max_spectrum, whitening_window_count, max_decay_rate);
-	}
-	////////////
-}
-
-/**
-* Mixes the cleaned signal with the residual taking into account the reduction configured
-* by the user. Outputs the final signal or the residual only.
-* \param fft_size size of the fft
-* \param final_spectrum the spectrum to output from the plugin
-* \param residual_spectrum the spectrum of the reduction residual
-* \param denoised_spectrum the spectrum of the cleaned signal
 * \param reduction_amount the amount of dB power to reduce setted by the user
 * \param noise_listen control variable that decides whether to output the mixed noise reduced signal or the residual only
+* \param wet_dry mixing coefficient
 */
 static void
-final_spectrum_ensemble(int fft_size, float *final_spectrum,
-                        float *residual_spectrum, float *denoised_spectrum,
-                        float reduction_amount, float noise_listen)
+final_spectrum_ensemble(int fft_size, float *output_fft_buffer, float *Gk,
+                        float whitening_factor, float *residual_max_spectrum,
+                        float *whitening_window_count, float max_decay_rate,
+                        float reduction_amount, float noise_listen, float wet_dry)
 {
-	int k;
+	EnsembleParams params;
 
-	//OUTPUT RESULTS using smooth bypass and parametric subtraction
-	if (noise_listen == 0.f)
+	//Whitening (residual spectrum more similar to white noise)
+	if (whitening_factor > 0.f)
 	{
-		//Mix residual and processed (Parametric way of noise reduction)
-		for (k = 0; k < fft_size; k++)
-		{
-			final_spectrum[k] = denoised_spectrum[k] + residual_spectrum[k] * reduction_amount;
-		}
+		*(whitening_window_count) += 1.f;
 	}
-	else
-	{
-		//Output noise only
-		for (k = 0; k < fft_size; k++)
-		{
-			final_spectrum[k] = residual_spectrum[k];
-		}
-	}
-}
 
-/**
-* Mixes unprocessed and processed signal to bypass softly.
-* \param final_spectrum the spectrum to output from the plugin
-* \param output_fft_buffer the unprocessed spectrum remaining in the fft buffer
-* \param wet_dry mixing coefficient
-* \param fft_size size of the fft
-*/
-static void
-soft_bypass(float *final_spectrum, float *output_fft_buffer, float wet_dry,
-            int fft_size)
-{
-	int k;
+	params.whitening_factor = whitening_factor;
+	params.whitening_first = *(whitening_window_count) <= 1.f;
+	params.max_decay_rate = max_decay_rate;
+	params.reduction_amount = reduction_amount;
+	params.noise_listen = noise_listen != 0.f;
+	params.wet_dry = wet_dry;
 
-	for (k = 0; k < fft_size; k++)
-	{
-		output_fft_buffer[k] = (1.f - wet_dry) * output_fft_buffer[k] + final_spectrum[k] * wet_dry;
-	}
+	//Everything is per bin, so it's one pass
+	vector_ensemble(output_fft_buffer, Gk, residual_max_spectrum, &params, fft_size);
 }
@@ -1 +1,265 @@
-int main() { return 0; }
+/*
+noise-repellent -- Noise Reduction LV2
+
+Copyright 2022 Gregor Richards
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/
+*/
+
+/**
+* \file test.c
+* \brief Accuracy of the vectorized kernels against the reference arithmetic
+*
+* Checks the approximated logarithm and exponential against their stated error
+* bounds at every supported level, then denoises the same synthetic signal at
+* every level and checks each against the reference level. Also checks that
+* nrepel_learn learns exactly what running in learning mode does, at every
+* tier. Exits nonzero if anything is out of bounds.
+*/
+
+#include <stdint.h>
+
+#include "extra_functions.c"
+
+//Largest difference from the reference level allowed in the output, relative to its peak
+#define TEST_MAX_ERROR_DB -100.f
+
+#define TEST_RATE 48000
+#define TEST_SECONDS 4
+#define TEST_BLOCK 1000
+#define TEST_LEARN_REPEATS 128
+
+static const char *level_names[] = {"reference", "scalar", "sse2", "avx2"};
+static const char *tier_names[] = {"best", "balanced", "fast"};
+
+/**
+* Checks vector_log10 over the whole range of normal floats.
+*/
+static int
+test_log10(int level)
+{
+  static float in[4096], out[4096];
+  uint32_t bits = 0x00800000; //FLT_MIN
+  double worst = 0.;
+  int n, k;
+
+  vector_choose_level(level);
+  while (bits < 0x7f800000)
+  {
+    for (n = 0; n < 4096 && bits < 0x7f800000; n++, bits += 61)
+    {
+      union { uint32_t i; float f; } u = {bits};
+      in[n] = u.f;
+    }
+    vector_log10(out, in, n);
+    for (k = 0; k < n; k++)
+    {
+      double error = fabs((double)out[k] - log10((double)in[k]));
+      if (error > worst)
+        worst = error;
+    }
+  }
+
+  printf("%-9s log10: largest error %g (bound %g)\n", level_names[level], worst,
+         (double)VECTOR_LOG10_ERROR);
+  return worst <= VECTOR_LOG10_ERROR;
+}
+
+/**
+* Checks vector_exp10 over the exponents the masking thresholds use.
+*/
+static int
+test_exp10(int level)
+{
+  static float in[4096], out[4096];
+  double worst = 0.;
+  int i, n, k;
+
+  vector_choose_level(level);
+  for (i = 0; i < 1000; i++)
+  {
+    for (n = 0; n < 4096; n++)
+      in[n] = -30.f + 60.f * (float)(i * 4096 + n) / (1000.f * 4096.f);
+    vector_exp10(out, in, n);
+    for (k = 0; k < n; k++)
+    {
+      double exact = pow(10., (double)in[k]);
+      double error = fabs((double)out[k] - exact) / exact;
+      if (error > worst)
+        worst = error;
+    }
+  }
+
+  printf("%-9s exp10: largest relative error %g (bound %g)\n", level_names[level], worst,
+         (double)VECTOR_EXP10_ERROR);
+  return worst <= VECTOR_EXP10_ERROR;
+}
+
+/**
+* Denoises tones in noise after learning the noise alone.
+*/
+static float *
+denoise(int level, const float *noise, const float *signal, int n_samples)
+{
+  float amount = 20.f, offset = 0.f, release = 150.f, masking = 5.f, protect = 6.f;
+  float whitening = 25.f, off = 0.f, on = 1.f, latency;
+  float *output = (float *)calloc(n_samples, sizeof(float));
+  void *nr;
+  int i;
+
+  nrepel_vector_level(level);
+  nr = nrepel_instantiate(TEST_RATE);
+  nrepel_connect_port(nr, NREPEL_AMOUNT, &amount);
+  nrepel_connect_port(nr, NREPEL_NOFFSET, &offset);
+  nrepel_connect_port(nr, NREPEL_RELEASE, &release);
+  nrepel_connect_port(nr, NREPEL_MASKING, &masking);
+  nrepel_connect_port(nr, NREPEL_T_PROTECT, &protect);
+  nrepel_connect_port(nr, NREPEL_WHITENING, &whitening);
+  nrepel_connect_port(nr, NREPEL_N_LEARN, &off);
+  nrepel_connect_port(nr, NREPEL_N_ADAPTIVE, &off);
+  nrepel_connect_port(nr, NREPEL_RESET, &off);
+  nrepel_connect_port(nr, NREPEL_RESIDUAL_LISTEN, &off);
+  nrepel_connect_port(nr, NREPEL_ENABLE, &on);
+  nrepel_connect_port(nr, NREPEL_LATENCY, &latency);
+
+  nrepel_learn(nr, noise, TEST_RATE, 1);
+  for (i = 0; i < n_samples; i += TEST_BLOCK)
+  {
+    nrepel_connect_port(nr, NREPEL_INPUT, (void *)(signal + i));
+    nrepel_connect_port(nr, NREPEL_OUTPUT, output + i);
+    nrepel_run(nr, MIN(TEST_BLOCK, n_samples - i));
+  }
+  nrepel_cleanup(nr);
+  return output;
+}
+
+/**
+* Learns the noise both ways on fresh instances of a tier, by running over it
+* repeatedly in learning mode and with nrepel_learn, and checks that the
+* profiles are identical, bit for bit.
+*/
+static int
+test_learn(int tier, const float *noise)
+{
+  float amount = 20.f, offset = 0.f, release = 150.f, masking = 5.f, protect = 6.f;
+  float whitening = 25.f, off = 0.f, on = 1.f, latency;
+  float *output = (float *)malloc(TEST_BLOCK * sizeof(float));
+  float run_profile[NREPEL_PROFILE_SIZE], learn_profile[NREPEL_PROFILE_SIZE];
+  float run_count = 0.f, learn_count = 0.f;
+  int have_run, have_learn, same;
+  void *run_nr, *learn_nr;
+  int r, i;
+
+  //Faster tiers' profiles are shorter, so the rest must match too
+  memset(run_profile, 0, sizeof(run_profile));
+  memset(learn_profile, 0, sizeof(learn_profile));
+
+  nrepel_vector_level(-1);
+  run_nr = nrepel_instantiate_tier(TEST_RATE, tier);
+  nrepel_connect_port(run_nr, NREPEL_AMOUNT, &amount);
+  nrepel_connect_port(run_nr, NREPEL_NOFFSET, &offset);
+  nrepel_connect_port(run_nr, NREPEL_RELEASE, &release);
+  nrepel_connect_port(run_nr, NREPEL_MASKING, &masking);
+  nrepel_connect_port(run_nr, NREPEL_T_PROTECT, &protect);
+  nrepel_connect_port(run_nr, NREPEL_WHITENING, &whitening);
+  nrepel_connect_port(run_nr, NREPEL_N_LEARN, &on);
+  nrepel_connect_port(run_nr, NREPEL_N_ADAPTIVE, &off);
+  nrepel_connect_port(run_nr, NREPEL_RESET, &off);
+  nrepel_connect_port(run_nr, NREPEL_RESIDUAL_LISTEN, &off);
+  nrepel_connect_port(run_nr, NREPEL_ENABLE, &on);
+  nrepel_connect_port(run_nr, NREPEL_LATENCY, &latency);
+  nrepel_connect_port(run_nr, NREPEL_OUTPUT, output);
+  for (r = 0; r < TEST_LEARN_REPEATS; r++)
+  {
+    for (i = 0; i < TEST_RATE; i += TEST_BLOCK)
+    {
+      nrepel_connect_port(run_nr, NREPEL_INPUT, (void *)(noise + i));
+      nrepel_run(run_nr, MIN(TEST_BLOCK, TEST_RATE - i));
+    }
+  }
+  have_run = nrepel_get_profile(run_nr, run_profile, &run_count);
+
+  learn_nr = nrepel_instantiate_tier(TEST_RATE, tier);
+  nrepel_learn(learn_nr, noise, TEST_RATE, TEST_LEARN_REPEATS);
+  have_learn = nrepel_get_profile(learn_nr, learn_profile, &learn_count);
+
+  same = have_run && have_learn && run_count == learn_count &&
+         !memcmp(run_profile, learn_profile, sizeof(run_profile));
+  printf("%-9s learn: %s (%g and %g windows)\n", tier_names[tier],
+         same ? "identical" : "DIFFERENT", (double)run_count, (double)learn_count);
+
+  nrepel_cleanup(run_nr);
+  nrepel_cleanup(learn_nr);
+  free(output);
+  return same;
+}
+
+int
+main()
+{
+  int n_samples = TEST_RATE * TEST_SECONDS;
+  float *noise = (float *)malloc(TEST_RATE * sizeof(float));
+  float *signal = (float *)malloc(n_samples * sizeof(float));
+  float *reference;
+  int best, level, i;
+  int ok = 1;
+
+  vector_choose_level(-1);
+  best = vector_level;
+
+  for (level = NREPEL_VECTOR_SCALAR; level <= best; level++)
+  {
+    ok &= test_log10(level);
+    ok &= test_exp10(level);
+  }
+
+  //Noise to learn, then the same noise under tones fading in and out
+  srand(1);
+  for (i = 0; i < TEST_RATE; i++)
+    noise[i] = 0.01f * ((float)rand() / RAND_MAX - 0.5f);
+  for (i = 0; i < n_samples; i++)
+  {
+    float t = (float)i / TEST_RATE;
+    float envelope = 0.5f - 0.5f * cosf(2.f * M_PI * t);
+    signal[i] = noise[i % TEST_RATE] +
+                envelope * (0.3f * sinf(2.f * M_PI * 440.f * t) + 0.1f * sinf(2.f * M_PI * 3150.f * t));
+  }
+
+  reference = denoise(NREPEL_VECTOR_REFERENCE, noise, signal, n_samples);
+  for (level = NREPEL_VECTOR_SCALAR; level <= best; level++)
+  {
+    float *output = denoise(level, noise, signal, n_samples);
+    float peak = 0.f, difference = 0.f, db;
+
+    for (i = 0; i < n_samples; i++)
+    {
+      peak = MAX(peak, fabsf(reference[i]));
+      difference = MAX(difference, fabsf(output[i] - reference[i]));
+    }
+    db = difference > 0.f ? 20.f * log10f(difference / peak) : -INFINITY;
+    printf("%-9s output: largest difference %.1f dB from peak (bound %.1f dB)\n",
+           level_names[level], db, TEST_MAX_ERROR_DB);
+    ok &= db <= TEST_MAX_ERROR_DB;
+    free(output);
+  }
+
+  for (i = NREPEL_TIER_BEST; i <= NREPEL_TIER_FAST; i++)
+    ok &= test_learn(i, noise);
+
+  free(reference);
+  free(signal);
+  free(noise);
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,907 @@
+/*
+noise-repellent -- Noise Reduction LV2
+
+Copyright 2022 Gregor Richards
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/
+*/
+
+/**
+* \file vector_functions.c
+* \brief Vectorized kernels for the spectral processing done every hop
+*
+* Every kernel has a scalar version and, on x86, SSE2 and AVX2 versions chosen at
+* run time. The elementwise kernels do exactly the arithmetic of the scalar code
+* they replace, in the same order and without fused multiply-adds, so they give
+* bit-identical results at every level. Only the logarithm and exponential are
+* approximations, the Cephes single-precision polynomials, which are within
+* VECTOR_LOG10_ERROR and VECTOR_EXP10_ERROR of the exact functions for normal
+* inputs. Those bounds are checked by test.c.
+*/
+
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "nrepel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+//Largest absolute error of vector_log10, for inputs from FLT_MIN to FLT_MAX (about an ulp of 38)
+#define VECTOR_LOG10_ERROR 5e-6f
+//Largest relative error of vector_exp10, for inputs from -30 to 30 (mostly from rounding x*ln(10))
+#define VECTOR_EXP10_ERROR 5e-6f
+
+//Cephes logf and expf constants
+#define CEPHES_SQRTHF 0.707106781186547524f
+#define CEPHES_LOG_P0 7.0376836292E-2f
+#define CEPHES_LOG_P1 -1.1514610310E-1f
+#define CEPHES_LOG_P2 1.1676998740E-1f
+#define CEPHES_LOG_P3 -1.2420140846E-1f
+#define CEPHES_LOG_P4 1.4249322787E-1f
+#define CEPHES_LOG_P5 -1.6668057665E-1f
+#define CEPHES_LOG_P6 2.0000714765E-1f
+#define CEPHES_LOG_P7 -2.4999993993E-1f
+#define CEPHES_LOG_P8 3.3333331174E-1f
+#define CEPHES_LOG_Q1 -2.12194440e-4f
+#define CEPHES_LOG_Q2 0.693359375f
+#define CEPHES_EXP_HI 88.3762626647949f
+#define CEPHES_EXP_LO -88.3762626647949f
+#define CEPHES_LOG2EF 1.44269504088896341f
+#define CEPHES_EXP_C1 0.693359375f
+#define CEPHES_EXP_C2 -2.12194440e-4f
+#define CEPHES_EXP_P0 1.9875691500E-4f
+#define CEPHES_EXP_P1 1.3981999507E-3f
+#define CEPHES_EXP_P2 8.3334519073E-3f
+#define CEPHES_EXP_P3 4.1665795894E-2f
+#define CEPHES_EXP_P4 1.6666665459E-1f
+#define CEPHES_EXP_P5 5.0000001201E-1f
+#define LOG10_E 0.43429448190325182765f
+#define LN_10 2.30258509299404568402f
+
+//Kernels in use, or -1 if not chosen yet
+static int vector_level = -1;
+
+/**
+* Finds the best kernels this CPU supports.
+*/
+static int
+vector_best_level(void)
+{
+#ifdef VECTOR_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return NREPEL_VECTOR_AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return NREPEL_VECTOR_SSE2;
+#endif
+  return NREPEL_VECTOR_SCALAR;
+}
+
+/**
+* Chooses the kernels to use, up to the best supported. A negative level
+* chooses the best.
+* \param level the requested level
+*/
+static int
+vector_choose_level(int level)
+{
+  int best = vector_best_level();
+  if (level < 0 || level > best)
+  {
+    level = best;
+  }
+  vector_level = level;
+  return level;
+}
+
+//------------DENORMALS------------
+
+#ifdef VECTOR_X86
+TARGET_SSE2 static unsigned int
+vector_enter_sse2(void)
+{
+  unsigned int state = _mm_getcsr();
+  _mm_setcsr(state | _MM_FLUSH_ZERO_ON | _MM_DENORMALS_ZERO_ON);
+  return state;
+}
+
+TARGET_SSE2 static void
+vector_leave_sse2(unsigned int state)
+{
+  _mm_setcsr(state);
+}
+#endif
+
+/**
+* Flushes denormals to zero until vector_leave. Denormals are far below anything
+* audible, but slow down every operation they reach, and decaying spectra reach
+* them. The reference level keeps them, to match the original code exactly.
+* Returns the state to restore.
+*/
+static unsigned int
+vector_enter(void)
+{
+#ifdef VECTOR_X86
+  if (vector_level >= NREPEL_VECTOR_SSE2)
+    return vector_enter_sse2();
+#endif
+  return 0;
+}
+
+/**
+* Restores the denormal handling vector_enter replaced.
+* \param state what vector_enter returned
+*/
+static void
+vector_leave(unsigned int state)
+{
+#ifdef VECTOR_X86
+  if (vector_level >= NREPEL_VECTOR_SSE2)
+    vector_leave_sse2(state);
+#endif
+  (void)state;
+}
+
+//------------ELEMENTWISE------------
+
+#ifdef VECTOR_X86
+TARGET_SSE2 static void
+vector_multiply_sse2(float *out, const float *a, const float *b, int n)
+{
+  int k;
+  for (k = 0; k + 4 <= n; k += 4)
+    _mm_storeu_ps(out + k, _mm_mul_ps(_mm_loadu_ps(a + k), _mm_loadu_ps(b + k)));
+  for (; k < n; k++)
+    out[k] = a[k] * b[k];
+}
+
+TARGET_AVX2 static void
+vector_multiply_avx2(float *out, const float *a, const float *b, int n)
+{
+  int k;
+  for (k = 0; k + 8 <= n; k += 8)
+    _mm256_storeu_ps(out + k, _mm256_mul_ps(_mm256_loadu_ps(a + k), _mm256_loadu_ps(b + k)));
+  for (; k < n; k++)
+    out[k] = a[k] * b[k];
+}
+#endif
+
+/**
+* Multiplies two arrays, as for windowing.
+* \param out the product
+* \param a the first array
+* \param b the second array
+* \param n the size of the arrays
+*/
+static void
+vector_multiply(float *out, const float *a, const float *b, int n)
+{
+  int k;
+#ifdef VECTOR_X86
+  if (vector_level >= NREPEL_VECTOR_AVX2)
+  {
+    vector_multiply_avx2(out, a, b, n);
+    return;
+  }
+  if (vector_level >= NREPEL_VECTOR_SSE2)
+  {
+    vector_multiply_sse2(out, a, b, n);
+    return;
+  }
+#endif
+  for (k = 0; k < n; k++)
+    out[k] = a[k] * b[k];
+}
+
+#ifdef VECTOR_X86
+TARGET_SSE2 static int
+vector_power_spectrum_sse2(float *fft_p2, const float *fft_buffer, int fft_size_2, int fft_size)
+{
+  int k;
+  for (k = 1; k + 4 <= fft_size_2; k += 4)
+  {
+    __m128 real_p = _mm_loadu_ps(fft_buffer + k);
+    __m128 imag_n = _mm_loadu_ps(fft_buffer + fft_size - k - 3);
+    imag_n = _mm_shuffle_ps(imag_n, imag_n, _MM_SHUFFLE(0, 1, 2, 3));
+    _mm_storeu_ps(fft_p2 + k, _mm_add_ps(_mm_mul_ps(real_p, real_p), _mm_mul_ps(imag_n, imag_n)));
+  }
+  return k;
+}
+
+TARGET_AVX2 static int
+vector_power_spectrum_avx2(float *fft_p2, const float *fft_buffer, int fft_size_2, int fft_size)
+{
+  int k;
+  const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  for (k = 1; k + 8 <= fft_size_2; k += 8)
+  {
+    __m256 real_p = _mm256_loadu_ps(fft_buffer + k);
+    __m256 imag_n = _mm256_loadu_ps(fft_buffer + fft_size - k - 7);
+    imag_n = _mm256_permutevar8x32_ps(imag_n, reverse);
+    _mm256_storeu_ps(fft_p2 + k, _mm256_add_ps(_mm256_mul_ps(real_p, real_p), _mm256_mul_ps(imag_n, imag_n)));
+  }
+  return k;
+}
+#endif
+
+/**
+* Computes the power spectrum of a half complex spectrum. This is the part of
+* get_info_from_bins processing needs: the magnitude and phase are never read.
+* \param fft_p2 the power spectrum (half the fft size plus 1)
+* \param fft_buffer buffer with the complex spectrum of the fft transform
+* \param fft_size_2 half of the fft size
+* \param fft_size size of the fft
+*/
+static void
+vector_power_spectrum(float *fft_p2, const float *fft_buffer, int fft_size_2, int fft_size)
+{
+  int k = 1;
+
+  //DC and nyquist are real
+  fft_p2[0] = fft_buffer[0] * fft_buffer[0];
+  fft_p2[fft_size_2] = fft_buffer[fft_size_2] * fft_buffer[fft_size_2];
+
+#ifdef VECTOR_X86
+  if (vector_level >= NREPEL_VECTOR_AVX2)
+    k = vector_power_spectrum_avx2(fft_p2, fft_buffer, fft_size_2, fft_size);
+  else if (vector_level >= NREPEL_VECTOR_SSE2)
+    k = vector_power_spectrum_sse2(fft_p2, fft_buffer, fft_size_2, fft_size);
+#endif
+  for (; k < fft_size_2; k++)
+  {
+    float real_p = fft_buffer[k];
+    float imag_n = fft_buffer[fft_size - k];
+    fft_p2[k] = real_p * real_p + imag_n * imag_n;
+  }
+}
+
+#ifdef VECTOR_X86
+TARGET_SSE2 static void
+vector_sqrt_sse2(float *out, const float *in, int n)
+{
+  int k;
+  for (k = 0; k + 4 <= n; k += 4)
+    _mm_storeu_ps(out + k, _mm_sqrt_ps(_mm_loadu_ps(in + k)));
+  for (; k < n; k++)
+    out[k] = sqrtf(in[k]);
+}
+
+TARGET_AVX2 static void
+vector_sqrt_avx2(float *out, const float *in, int n)
+{
+  int k;
+  for (k = 0; k + 8 <= n; k += 8)
+    _mm256_storeu_ps(out + k, _mm256_sqrt_ps(_mm256_loadu_ps(in + k)));
+  for (; k < n; k++)
+    out[k] = sqrtf(in[k]);
+}
+#endif
+
+/**
+* Outputs the spectral flux between the current power spectrum and the previous
+* magnitude spectrum, like spectral_flux, then replaces the previous magnitude
+* spectrum with the current one, so each magnitude is only computed once. The sum
+* is in the original order, since it's compared against a threshold.
+* \param fft_p2 the current power spectrum
+* \param magnitude_prev the previous magnitude spectrum
+* \param N the size of the spectrum (half the fft size plus 1)
+*/
+static float
+vector_spectral_flux(const float *fft_p2, float *magnitude_prev, int N)
+{
+  int i;
+  float magnitude[N + 1];
+  float spectral_flux = 0.f;
+  float temp;
+
+#ifdef VECTOR_X86
+  if (vector_level >= NREPEL_VECTOR_AVX2)
+    vector_sqrt_avx2(magnitude, fft_p2, N + 1);
+  else if (vector_level >= NREPEL_VECTOR_SSE2)
+    vector_sqrt_sse2(magnitude, fft_p2, N + 1);
+  else
+#endif
+    for (i = 0; i <= N; i++)
+      magnitude[i] = sqrtf(fft_p2[i]);
+
+  for (i = 0; i <= N; i++)
+  {
+    temp = magnitude[i] - magnitude_prev[i];
+    spectral_flux += (temp + fabs(temp)) / 2.f;
+  }
+  memcpy(magnitude_prev, magnitude, sizeof(float) * (N + 1));
+  return spectral_flux;
+}
+
+#ifdef VECTOR_X86
+TARGET_SSE2 static int
+vector_time_envelope_sse2(float *spectrum, float *spectrum_prev, const float *fft_p2, int n,
+                          float release_coeff)
+{
+  int k;
+  const __m128 rc = _mm_set1_ps(release_coeff), rc1 = _mm_set1_ps(1.f - release_coeff);
+  for (k = 0; k + 4 <= n; k += 4)
+  {
+    __m128 cur = _mm_loadu_ps(fft_p2 + k);
+    __m128 prev = _mm_loadu_ps(spectrum_prev + k);
+    __m128 rel = _mm_add_ps(_mm_mul_ps(rc, prev), _mm_mul_ps(rc1, cur));
+    __m128 mask = _mm_cmpgt_ps(cur, prev);
+    cur = _mm_or_ps(_mm_and_ps(mask, rel), _mm_andnot_ps(mask, cur));
+    _mm_storeu_ps(spectrum + k, cur);
+    _mm_storeu_ps(spectrum_prev + k, cur);
+  }
+  return k;
+}
+
+TARGET_AVX2 static int
+vector_time_envelope_avx2(float *spectrum, float *spectrum_prev, const float *fft_p2, int n,
+                          float release_coeff)
+{
+  int k;
+  const __m256 rc = _mm256_set1_ps(release_coeff), rc1 = _mm256_set1_ps(1.f - release_coeff);
+  for (k = 0; k + 8 <= n; k += 8)
+  {
+    __m256 cur = _mm256_loadu_ps(fft_p2 + k);
+    __m256 prev = _mm256_loadu_ps(spectrum_prev + k);
+    __m256 rel = _mm256_add_ps(_mm256_mul_ps(rc, prev), _mm256_mul_ps(rc1, cur));
+    cur = _mm256_blendv_ps(cur, rel, _mm256_cmp_ps(cur, prev, _CMP_GT_OQ));
+    _mm256_storeu_ps(spectrum + k, cur);
+    _mm256_storeu_ps(spectrum_prev + k, cur);
+  }
+  return k;
+}
+#endif
+
+/**
+* Applies a release envelope to the power spectrum, like apply_time_envelope,
+* writing the smoothed spectrum to both the output and the previous spectrum.
+* \param spectrum the smoothed power spectrum
+* \param spectrum_prev the previous smoothed power spectrum, updated
+* \param fft_p2 the current power spectrum
+* \param N half of the fft size
+* \param release_coeff release coefficient
+*/
+static void
+vector_time_envelope(float *spectrum, float *spectrum_prev, const float *fft_p2, int N,
+                     float release_coeff)
+{
+  int k = 0;
+
+#ifdef VECTOR_X86
+  if (vector_level >= NREPEL_VECTOR_AVX2)
+    k = vector_time_envelope_avx2(spectrum, spectrum_prev, fft_p2, N + 1, release_coeff);
+  else if (vector_level >= NREPEL_VECTOR_SSE2)
+    k = vector_time_envelope_sse2(spectrum, spectrum_prev, fft_p2, N + 1, release_coeff);
+#endif
+  for (; k <= N; k++)
+  {
+    float value = fft_p2[k];
+    if (value > spectrum_prev[k])
+    {
+      value = release_coeff * spectrum_prev[k] + (1.f - release_coeff) * value;
+    }
+    spectrum[k] = value;
+    spectrum_prev[k] = value;
+  }
+}
+
+/**
+* Parameters of vector_ensemble that are the same for every bin.
+*/
+typedef struct
+{
+  float whitening_factor;
+  bool whitening_first; //first whitened frame, so no previous maximums
+  float max_decay_rate;
+  float reduction_amount;
+  bool noise_listen;
+  float wet_dry;
+} EnsembleParams;
+
+#ifdef VECTOR_X86
+TARGET_SSE2 static int
+vector_ensemble_sse2(float *fft_buffer, const float *Gk, float *residual_max_spectrum,
+                     const EnsembleParams *p, int n)
+{
+  int k;
+  const __m128 b = _mm_set1_ps(p->whitening_factor), b1 = _mm_set1_ps(1.f - p->whitening_factor);
+  const __m128 whiten_floor = _mm_set1_ps(WHITENING_FLOOR), decay = _mm_set1_ps(p->max_decay_rate);
+  const __m128 flt_min = _mm_set1_ps(FLT_MIN);
+  const __m128 reduction = _mm_set1_ps(p->reduction_amount);
+  const __m128 wet = _mm_set1_ps(p->wet_dry), dry = _mm_set1_ps(1.f - p->wet_dry);
+
+  for (k = 0; k + 4 <= n; k += 4)
+  {
+    __m128 out = _mm_loadu_ps(fft_buffer + k);
+    __m128 denoised = _mm_mul_ps(out, _mm_loadu_ps(Gk + k));
+    __m128 residual = _mm_sub_ps(out, denoised);
+    __m128 final;
+
+    if (p->whitening_factor > 0.f)
+    {
+      __m128 max = _mm_max_ps(residual, whiten_floor);
+      __m128 mask, whitened;
+      if (!p->whitening_first)
+        max = _mm_max_ps(max, _mm_mul_ps(_mm_loadu_ps(residual_max_spectrum + k), decay));
+      _mm_storeu_ps(residual_max_spectrum + k, max);
+      whitened = _mm_add_ps(_mm_mul_ps(b1, residual), _mm_mul_ps(b, _mm_div_ps(residual, max)));
+      mask = _mm_cmpgt_ps(residual, flt_min);
+      residual = _mm_or_ps(_mm_and_ps(mask, whitened), _mm_andnot_ps(mask, residual));
+    }
+
+    if (p->noise_listen)
+      final = residual;
+    else
+      final = _mm_add_ps(denoised, _mm_mul_ps(residual, reduction));
+
+    _mm_storeu_ps(fft_buffer + k, _mm_add_ps(_mm_mul_ps(dry, out), _mm_mul_ps(final, wet)));
+  }
+  return k;
+}
+
+TARGET_AVX2 static int
+vector_ensemble_avx2(float *fft_buffer, const float *Gk, float *residual_max_spectrum,
+                     const EnsembleParams *p, int n)
+{
+  int k;
+  const __m256 b = _mm256_set1_ps(p->whitening_factor), b1 = _mm256_set1_ps(1.f - p->whitening_factor);
+  const __m256 whiten_floor = _mm256_set1_ps(WHITENING_FLOOR), decay = _mm256_set1_ps(p->max_decay_rate);
+  const __m256 flt_min = _mm256_set1_ps(FLT_MIN);
+  const __m256 reduction = _mm256_set1_ps(p->reduction_amount);
+  const __m256 wet = _mm256_set1_ps(p->wet_dry), dry = _mm256_set1_ps(1.f - p->wet_dry);
+
+  for (k = 0; k + 8 <= n; k += 8)
+  {
+    __m256 out = _mm256_loadu_ps(fft_buffer + k);
+    __m256 denoised = _mm256_mul_ps(out, _mm256_loadu_ps(Gk + k));
+    __m256 residual = _mm256_sub_ps(out, denoised);
+    __m256 final;
+
+    if (p->whitening_factor > 0.f)
+    {
+      __m256 max = _mm256_max_ps(residual, whiten_floor);
+      __m256 whitened;
+      if (!p->whitening_first)
+        max = _mm256_max_ps(max, _mm256_mul_ps(_mm256_loadu_ps(residual_max_spectrum + k), decay));
+      _mm256_storeu_ps(residual_max_spectrum + k, max);
+      whitened = _mm256_add_ps(_mm256_mul_ps(b1, residual), _mm256_mul_ps(b, _mm256_div_ps(residual, max)));
+      residual = _mm256_blendv_ps(residual, whitened, _mm256_cmp_ps(residual, flt_min, _CMP_GT_OQ));
+    }
+
+    if (p->noise_listen)
+      final = residual;
+    else
+      final = _mm256_add_ps(denoised, _mm256_mul_ps(residual, reduction));
+
+    _mm256_storeu_ps(fft_buffer + k, _mm256_add_ps(_mm256_mul_ps(dry, out), _mm256_mul_ps(final, wet)));
+  }
+  return k;
+}
+#endif
+
+/**
+* Applies the gains, whitens the residual, mixes the two and soft bypasses, all
+* in one pass over the spectrum. Per bin, the arithmetic is exactly that of
+* applying Gk, taking the residual, spectral_whitening, mixing by the reduction
+* amount and soft bypassing, but without storing the intermediate spectra.
+* \param fft_buffer the unprocessed spectrum, replaced by the processed one
+* \param Gk is the filter computed by the supression rule for each bin of the spectrum
+* \param residual_max_spectrum contains the maximun temporal value in each residual bin
+* \param p the parameters for the whole spectrum
+* \param fft_size size of the fft
+*/
+static void
+vector_ensemble(float *fft_buffer, const float *Gk, float *residual_max_spectrum,
+                const EnsembleParams *p, int fft_size)
+{
+  int k = 0;
+
+#ifdef VECTOR_X86
+  if (vector_level >= NREPEL_VECTOR_AVX2)
+    k = vector_ensemble_avx2(fft_buffer, Gk, residual_max_spectrum, p, fft_size);
+  else if (vector_level >= NREPEL_VECTOR_SSE2)
+    k = vector_ensemble_sse2(fft_buffer, Gk, residual_max_spectrum, p, fft_size);
+#endif
+  for (; k < fft_size; k++)
+  {
+    float denoised = fft_buffer[k] * Gk[k];
+    float residual = fft_buffer[k] - denoised;
+    float final;
+
+    if (p->whitening_factor > 0.f)
+    {
+      if (!p->whitening_first)
+      {
+        residual_max_spectrum[k] = MAX(MAX(residual, WHITENING_FLOOR), residual_max_spectrum[k] * p->max_decay_rate);
+      }
+      else
+      {
+        residual_max_spectrum[k] = MAX(residual, WHITENING_FLOOR);
+      }
+      if (residual > FLT_MIN)
+      {
+        float whitened = residual / residual_max_spectrum[k];
+        residual = (1.f - p->whitening_factor) * residual + p->whitening_factor * whitened;
+      }
+    }
+
+    if (p->noise_listen)
+    {
+      final = residual;
+    }
+    else
+    {
+      final = denoised + residual * p->reduction_amount;
+    }
+
+    fft_buffer[k] = (1.f - p->wet_dry) * fft_buffer[k] + final * p->wet_dry;
+  }
+}
+
+#ifdef VECTOR_X86
+TARGET_SSE2 static int
+vector_overlap_add_sse2(float *output_accum, const float *fft_buffer, const float *window,
+                        float normalization, float scale, int n)
+{
+  int k;
+  const __m128 norm = _mm_set1_ps(normalization), sc = _mm_set1_ps(scale);
+  for (k = 0; k + 4 <= n; k += 4)
+  {
+    __m128 value = _mm_div_ps(_mm_loadu_ps(fft_buffer + k), norm);
+    value = _mm_div_ps(_mm_mul_ps(_mm_loadu_ps(window + k), value), sc);
+    _mm_storeu_ps(output_accum + k, _mm_add_ps(_mm_loadu_ps(output_accum + k), value));
+  }
+  return k;
+}
+
+TARGET_AVX2 static int
+vector_overlap_add_avx2(float *output_accum, const float *fft_buffer, const float *window,
+                        float normalization, float scale, int n)
+{
+  int k;
+  const __m256 norm = _mm256_set1_ps(normalization), sc = _mm256_set1_ps(scale);
+  for (k = 0; k + 8 <= n; k += 8)
+  {
+    __m256 value = _mm256_div_ps(_mm256_loadu_ps(fft_buffer + k), norm);
+    value = _mm256_div_ps(_mm256_mul_ps(_mm256_loadu_ps(window + k), value), sc);
+    _mm256_storeu_ps(output_accum + k, _mm256_add_ps(_mm256_loadu_ps(output_accum + k), value));
+  }
+  return k;
+}
+#endif
+
+/**
+* Normalizes the inverse transform, windows it and accumulates it.
+* \param output_accum the overlap-add accumulator
+* \param fft_buffer the inverse transform
+* \param window the output window
+* \param normalization the fft normalization (the fft size)
+* \param scale the window and overlap scaling
+* \param n the fft size
+*/
+static void
+vector_overlap_add(float *output_accum, const float *fft_buffer, const float *window,
+                   float normalization, float scale, int n)
+{
+  int k = 0;
+
+#ifdef VECTOR_X86
+  if (vector_level >= NREPEL_VECTOR_AVX2)
+    k = vector_overlap_add_avx2(output_accum, fft_buffer, window, normalization, scale, n);
+  else if (vector_level >= NREPEL_VECTOR_SSE2)
+    k = vector_overlap_add_sse2(output_accum, fft_buffer, window, normalization, scale, n);
+#endif
+  for (; k < n; k++)
+  {
+    output_accum[k] += (window[k] * (fft_buffer[k] / normalization)) / scale;
+  }
+}
+
+//------------APPROXIMATIONS------------
+
+/**
+* Cephes logf, for one value. The vector versions do the same operations.
+*/
+static float
+cephes_logf(float value)
+{
+  union { float f; int32_t i; } u;
+  float x, y, z, e;
+  int32_t exponent;
+
+  u.f = value;
+  exponent = ((u.i >> 23) & 0xff) - 126;
+  u.i = (u.i & 0x807fffff) | 0x3f000000; //mantissa in [0.5, 1)
+  x = u.f;
+
+  //Center the mantissa around 1
+  if (x < CEPHES_SQRTHF)
+  {
+    exponent--;
+    x = (x - 1.f) + x;
+  }
+  else
+  {
+    x = x - 1.f;
+  }
+  e = (float)exponent;
+
+  z = x * x;
+  y = CEPHES_LOG_P0;
+  y = y * x + CEPHES_LOG_P1;
+  y = y * x + CEPHES_LOG_P2;
+  y = y * x + CEPHES_LOG_P3;
+  y = y * x + CEPHES_LOG_P4;
+  y = y * x + CEPHES_LOG_P5;
+  y = y * x + CEPHES_LOG_P6;
+  y = y * x + CEPHES_LOG_P7;
+  y = y * x + CEPHES_LOG_P8;
+  y = y * x;
+  y = y * z;
+  y = y + e * CEPHES_LOG_Q1;
+  y = y - z * 0.5f;
+  x = x + y;
+  x = x + e * CEPHES_LOG_Q2;
+  return x;
+}
+
+/**
+* Cephes expf, for one value. The vector versions do the same operations.
+*/
+static float
+cephes_expf(float x)
+{
+  union { float f; int32_t i; } u;
+  float fx, y, z;
+
+  x = MIN(x, CEPHES_EXP_HI);
+  x = MAX(x, CEPHES_EXP_LO);
+
+  //x = n*ln(2) + r, with |r| <= ln(2)/2
+  fx = x * CEPHES_LOG2EF + 0.5f;
+  y = (float)(int32_t)fx;
+  if (y > fx)
+    y = y - 1.f;
+  fx = y;
+  x = x - fx * CEPHES_EXP_C1;
+  x = x - fx * CEPHES_EXP_C2;
+
+  z = x * x;
+  y = CEPHES_EXP_P0;
+  y = y * x + CEPHES_EXP_P1;
+  y = y * x + CEPHES_EXP_P2;
+  y = y * x + CEPHES_EXP_P3;
+  y = y * x + CEPHES_EXP_P4;
+  y = y * x + CEPHES_EXP_P5;
+  y = y * z;
+  y = y + x;
+  y = y + 1.f;
+
+  //Times 2^n
+  u.i = ((int32_t)fx + 127) << 23;
+  return y * u.f;
+}
+
+#ifdef VECTOR_X86
+TARGET_SSE2 static int
+vector_log10_sse2(float *out, const float *in, int n)
+{
+  int k;
+  const __m128 one = _mm_set1_ps(1.f);
+  for (k = 0; k + 4 <= n; k += 4)
+  {
+    __m128i bits = _mm_castps_si128(_mm_max_ps(_mm_loadu_ps(in + k), _mm_set1_ps(FLT_MIN)));
+    __m128i exponent = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(bits, 23), _mm_set1_epi32(0xff)),
+                                     _mm_set1_epi32(126));
+    __m128 x = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x807fffff)),
+                                             _mm_set1_epi32(0x3f000000)));
+    __m128 mask = _mm_cmplt_ps(x, _mm_set1_ps(CEPHES_SQRTHF));
+    __m128 y, z, e;
+
+    exponent = _mm_add_epi32(exponent, _mm_castps_si128(mask)); //minus one where masked
+    x = _mm_add_ps(_mm_sub_ps(x, one), _mm_and_ps(mask, x));
+    e = _mm_cvtepi32_ps(exponent);
+
+    z = _mm_mul_ps(x, x);
+    y = _mm_set1_ps(CEPHES_LOG_P0);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(CEPHES_LOG_P1));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(CEPHES_LOG_P2));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(CEPHES_LOG_P3));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(CEPHES_LOG_P4));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(CEPHES_LOG_P5));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(CEPHES_LOG_P6));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(CEPHES_LOG_P7));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(CEPHES_LOG_P8));
+    y = _mm_mul_ps(y, x);
+    y = _mm_mul_ps(y, z);
+    y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(CEPHES_LOG_Q1)));
+    y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+    x = _mm_add_ps(x, y);
+    x = _mm_add_ps(x, _mm_mul_ps(e, _mm_set1_ps(CEPHES_LOG_Q2)));
+    _mm_storeu_ps(out + k, _mm_mul_ps(x, _mm_set1_ps(LOG10_E)));
+  }
+  return k;
+}
+
+TARGET_AVX2 static int
+vector_log10_avx2(float *out, const float *in, int n)
+{
+  int k;
+  const __m256 one = _mm256_set1_ps(1.f);
+  for (k = 0; k + 8 <= n; k += 8)
+  {
+    __m256i bits = _mm256_castps_si256(_mm256_max_ps(_mm256_loadu_ps(in + k), _mm256_set1_ps(FLT_MIN)));
+    __m256i exponent = _mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0xff)),
+                                        _mm256_set1_epi32(126));
+    __m256 x = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x807fffff)),
+                                                   _mm256_set1_epi32(0x3f000000)));
+    __m256 mask = _mm256_cmp_ps(x, _mm256_set1_ps(CEPHES_SQRTHF), _CMP_LT_OQ);
+    __m256 y, z, e;
+
+    exponent = _mm256_add_epi32(exponent, _mm256_castps_si256(mask)); //minus one where masked
+    x = _mm256_add_ps(_mm256_sub_ps(x, one), _mm256_and_ps(mask, x));
+    e = _mm256_cvtepi32_ps(exponent);
+
+    z = _mm256_mul_ps(x, x);
+    y = _mm256_set1_ps(CEPHES_LOG_P0);
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(CEPHES_LOG_P1));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(CEPHES_LOG_P2));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(CEPHES_LOG_P3));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(CEPHES_LOG_P4));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(CEPHES_LOG_P5));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(CEPHES_LOG_P6));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(CEPHES_LOG_P7));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(CEPHES_LOG_P8));
+    y = _mm256_mul_ps(y, x);
+    y = _mm256_mul_ps(y, z);
+    y = _mm256_add_ps(y, _mm256_mul_ps(e, _mm256_set1_ps(CEPHES_LOG_Q1)));
+    y = _mm256_sub_ps(y, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+    x = _mm256_add_ps(x, y);
+    x = _mm256_add_ps(x, _mm256_mul_ps(e, _mm256_set1_ps(CEPHES_LOG_Q2)));
+    _mm256_storeu_ps(out + k, _mm256_mul_ps(x, _mm256_set1_ps(LOG10_E)));
+  }
+  return k;
+}
+#endif
+
+/**
+* Fast base 10 logarithm of an array, within VECTOR_LOG10_ERROR. Values below
+* FLT_MIN, which the spectra never hold, are taken as FLT_MIN.
+* \param out the logarithms
+* \param in the values
+* \param n the size of the arrays
+*/
+static void
+vector_log10(float *out, const float *in, int n)
+{
+  int k = 0;
+
+#ifdef VECTOR_X86
+  if (vector_level >= NREPEL_VECTOR_AVX2)
+    k = vector_log10_avx2(out, in, n);
+  else if (vector_level >= NREPEL_VECTOR_SSE2)
+    k = vector_log10_sse2(out, in, n);
+#endif
+  for (; k < n; k++)
+  {
+    out[k] = cephes_logf(MAX(in[k], FLT_MIN)) * LOG10_E;
+  }
+}
+
+#ifdef VECTOR_X86
+TARGET_SSE2 static int
+vector_exp10_sse2(float *out, const float *in, int n)
+{
+  int k;
+  for (k = 0; k + 4 <= n; k += 4)
+  {
+    __m128 x = _mm_mul_ps(_mm_loadu_ps(in + k), _mm_set1_ps(LN_10));
+    __m128 fx, y, z;
+    __m128i whole;
+
+    x = _mm_min_ps(x, _mm_set1_ps(CEPHES_EXP_HI));
+    x = _mm_max_ps(x, _mm_set1_ps(CEPHES_EXP_LO));
+
+    fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(CEPHES_LOG2EF)), _mm_set1_ps(0.5f));
+    y = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+    y = _mm_sub_ps(y, _mm_and_ps(_mm_cmpgt_ps(y, fx), _mm_set1_ps(1.f)));
+    fx = y;
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(CEPHES_EXP_C1)));
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(CEPHES_EXP_C2)));
+
+    z = _mm_mul_ps(x, x);
+    y = _mm_set1_ps(CEPHES_EXP_P0);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(CEPHES_EXP_P1));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(CEPHES_EXP_P2));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(CEPHES_EXP_P3));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(CEPHES_EXP_P4));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(CEPHES_EXP_P5));
+    y = _mm_mul_ps(y, z);
+    y = _mm_add_ps(y, x);
+    y = _mm_add_ps(y, _mm_set1_ps(1.f));
+
+    whole = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(127)), 23);
+    _mm_storeu_ps(out + k, _mm_mul_ps(y, _mm_castsi128_ps(whole)));
+  }
+  return k;
+}
+
+TARGET_AVX2 static int
+vector_exp10_avx2(float *out, const float *in, int n)
+{
+  int k;
+  for (k = 0; k + 8 <= n; k += 8)
+  {
+    __m256 x = _mm256_mul_ps(_mm256_loadu_ps(in + k), _mm256_set1_ps(LN_10));
+    __m256 fx, y, z;
+    __m256i whole;
+
+    x = _mm256_min_ps(x, _mm256_set1_ps(CEPHES_EXP_HI));
+    x = _mm256_max_ps(x, _mm256_set1_ps(CEPHES_EXP_LO));
+
+    fx = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(CEPHES_LOG2EF)), _mm256_set1_ps(0.5f));
+    y = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(fx));
+    y = _mm256_sub_ps(y, _mm256_and_ps(_mm256_cmp_ps(y, fx, _CMP_GT_OQ), _mm256_set1_ps(1.f)));
+    fx = y;
+    x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(CEPHES_EXP_C1)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(CEPHES_EXP_C2)));
+
+    z = _mm256_mul_ps(x, x);
+    y = _mm256_set1_ps(CEPHES_EXP_P0);
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(CEPHES_EXP_P1));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(CEPHES_EXP_P2));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(CEPHES_EXP_P3));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(CEPHES_EXP_P4));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(CEPHES_EXP_P5));
+    y = _mm256_mul_ps(y, z);
+    y = _mm256_add_ps(y, x);
+    y = _mm256_add_ps(y, _mm256_set1_ps(1.f));
+
+    whole = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+    _mm256_storeu_ps(out + k, _mm256_mul_ps(y, _mm256_castsi256_ps(whole)));
+  }
+  return k;
+}
+#endif
+
+/**
+* Fast power of 10 of an array, within VECTOR_EXP10_ERROR.
+* \param out the powers
+* \param in the exponents
+* \param n the size of the arrays
+*/
+static void
+vector_exp10(float *out, const float *in, int n)
+{
+  int k = 0;
+
+#ifdef VECTOR_X86
+  if (vector_level >= NREPEL_VECTOR_AVX2)
+    k = vector_exp10_avx2(out, in, n);
+  else if (vector_level >= NREPEL_VECTOR_SSE2)
+    k = vector_exp10_sse2(out, in, n);
+#endif
+  for (; k < n; k++)
+  {
+    out[k] = cephes_expf(in[k] * LN_10);
+  }
+}
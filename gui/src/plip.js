@@ -614,6 +614,8 @@
                 fs.accessSync(tmpJSON);
                 exists = true;
             } catch (ex) {}
+            if (!exists && envelopeWaveform(tmpJSON))
+                exists = true;
             if (!exists) {
                 // Extract the audio
                 await run("Making audio waveform...", formats.ffmpeg, ["-i", tmpMP4, "-map", "0:a", tmpFLAC], {min: 225/stepCt, max: 300/stepCt, count: 3});
@@ -675,6 +677,90 @@
         gebi("process").disabled = false;
     }
 
+    /* Read the finest level of an envelope made by plip-aproc, or null if it
+     * isn't of the audio file as it is now */
+    function readEnvelope(file, audioFile) {
+        let buf, st;
+        try {
+            buf = fs.readFileSync(file);
+            st = fs.statSync(audioFile);
+        } catch (ex) {
+            return null;
+        }
+        if (buf.length < 64 || buf.toString("latin1", 0, 8) !== "PLIPENV2")
+            return null;
+        if (buf.readBigUInt64LE(32) !== BigInt(st.size) ||
+            buf.readBigInt64LE(40) !== BigInt(Math.floor(st.mtimeMs / 1000)))
+            return null;
+        let env = {
+            rate: buf.readUInt32LE(8),
+            channels: buf.readUInt32LE(12),
+            blockSize: Number(buf.readBigUInt64LE(48)),
+            count: Number(buf.readBigUInt64LE(56)),
+            offset: 48 + buf.readUInt32LE(16) * 16,
+            buf
+        };
+        if (env.channels < 1 ||
+            buf.length < env.offset + env.count * env.channels * 12)
+            return null;
+        return env;
+    }
+
+    /* Make the editor's waveform from the envelopes of the processed tracks,
+     * as audiowaveform would from their mix, so that the audio needn't be
+     * decoded again. Returns false if any track has no envelope. */
+    function envelopeWaveform(outFile) {
+        let envs = [];
+        let ok = true;
+        streams.forEach((stream) => {
+            if (stream.type !== "Audio" || !stream.included)
+                return;
+            let audioFile = dirPath + path.sep + stream.title + "-proc." +
+                formats.aiformat;
+            let env = readEnvelope(audioFile + ".envelope", audioFile);
+            if (env)
+                envs.push(env);
+            else
+                ok = false;
+        });
+        if (!ok || !envs.length)
+            return false;
+
+        // Mix them like amix, dividing by the tracks still playing
+        let count = Math.max.apply(Math, envs.map((env) => env.count));
+        let data = new Array(count * 2);
+        for (let bi = 0; bi < count; bi++) {
+            let min = 0, max = 0, live = 0;
+            envs.forEach((env) => {
+                if (bi >= env.count)
+                    return;
+                let off = env.offset + bi * env.channels * 12;
+                for (let ci = 0; ci < env.channels; ci++) {
+                    min += env.buf.readFloatLE(off + ci * 12) / env.channels;
+                    max += env.buf.readFloatLE(off + ci * 12 + 4) / env.channels;
+                }
+                live++;
+            });
+            data[bi*2] = Math.max(-128, Math.round(min / live * 128));
+            data[bi*2+1] = Math.min(127, Math.round(max / live * 128));
+        }
+
+        try {
+            fs.writeFileSync(outFile, JSON.stringify({
+                version: 2,
+                channels: 1,
+                sample_rate: envs[0].rate,
+                samples_per_pixel: envs[0].blockSize,
+                bits: 8,
+                length: count,
+                data
+            }));
+        } catch (ex) {
+            return false;
+        }
+        return true;
+    }
+
     // Perform the final mix
     function mix(mixPath, progress, config) {
         let args = [];
@@ -878,12 +964,18 @@
                 // Clip: Delete the output file (FIXME: multipart)
                 del(base + stream.title + "." + formats.vformat);
 
+                // And the cached keyframes of the input's stream
+                del(base + path.basename(filePath) + "." + stream.idx + ".keyframes");
+
             } else { // Audio
                 // Demux: Delete the raw file
                 del(base + stream.title + "-raw." + formats.aiformat);
+                del(base + stream.title + "-raw." + formats.aiformat + ".loudness");
+                del(base + stream.title + "-raw." + formats.aiformat + ".envelope");
 
                 // Process: Delete the processed file
                 del(base + stream.title + "-proc." + formats.aiformat);
+                del(base + stream.title + "-proc." + formats.aiformat + ".envelope");
 
                 // Clip: Delete the output file (FIXME: multipart)
                 del(base + stream.title + "." + formats.aformat);
@@ -895,6 +987,9 @@
         del(base + "tmp.mp4");
         del(base + "tmp.json");
 
+        // And the cached probe of the input
+        del(base + path.basename(filePath) + ".probe");
+
         // Deletion helper function
         function del(file) {
             try {
@@ -21,272 +21,1064 @@
 #include <math.h>
 #include <pthread.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "arg.h"
+#include "buffer.h"
 #include "cscript.h"
 #include "configfile.h"
+#include "envelope.h"
+#include "noiseprofile.h"
+#include "probe.h"
 
 static CORD ffmpeg = "ffmpeg";
 static CORD iformat = "flac";
 static CORD icodec = "flac";
 
+BUFFER(charp, char *);
+
+// FNV-1a, used to key the loudness cache
+#define FNV_BASIS 0xcbf29ce484222325ULL
+static unsigned long long fnv(unsigned long long hash, const unsigned char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ buf[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+/* Hash a file's size and modification time, like the probe cache, rather than
+ * reading the whole file */
+static unsigned long long fileHash(CORD file)
+{
+    unsigned long long hash = FNV_BASIS;
+    struct stat sbuf;
+    if (stat(CORD_to_char_star(file), &sbuf) == 0) {
+        long long stamp[2] = {(long long) sbuf.st_size, (long long) sbuf.st_mtime};
+        hash = fnv(hash, (unsigned char *) stamp, sizeof(stamp));
+    }
+    return hash;
+}
+
+/* The loudness cache is a sidecar of the measured file, with one line per
+ * measurement, keyed by the hash of the file and of the filter graph. It lives
+ * as long as the file does. */
+static CORD loudnessKey(unsigned long long hash, CORD graph)
+{
+    char *cgraph = CORD_to_char_star(graph);
+    char key[17];
+    hash = fnv(hash, (unsigned char *) cgraph, strlen(cgraph));
+    snprintf(key, sizeof(key), "%016llx", hash);
+    return CORD_from_char_star(key);
+}
+
+// Look up a cached loudness
+static bool cachedLoudness(CORD file, CORD key, double *loudness)
+{
+    CORD cache = csc_readFile(csc_casprintf("%r.loudness", file));
+    if (!cache)
+        return false;
+    CORD *lines = csc_lines(cache);
+    for (size_t li = 0; lines[li]; li++) {
+        CORD *parts = csc_match("^([0-9a-f]*) (.*)$", lines[li]);
+        if (parts && parts[1] && parts[2] && !CORD_cmp(parts[1], key)) {
+            *loudness = atof(CORD_to_char_star(parts[2]));
+            return true;
+        }
+    }
+    return false;
+}
+
+// Remember a loudness
+static void cacheLoudness(CORD file, CORD key, double loudness)
+{
+    CORD sidecar = csc_casprintf("%r.loudness", file);
+    CORD cache = csc_readFile(sidecar);
+    csc_writeFile(sidecar, CORD_cat(cache, csc_casprintf("%r %s\n", key,
+        csc_asprintf("%f", loudness))));
+}
+
+// Read the result of plip-loudness
+static bool readLoudness(CORD result, double *loudness)
+{
+    CORD *parts = csc_match("^(\\S+)", result);
+    if (!parts || !parts[1])
+        return false;
+    *loudness = atof(CORD_to_char_star(parts[1]));
+    return true;
+}
+
+/* Measure the loudness of a file after the given filter graph. One channel is
+ * a dual-mono track, so it's measured as it will sound duplicated. */
+static bool measureLoudness(CORD base, CORD file, CORD graph, CORD label, int channels, double *loudness)
+{
+    CORD result = NULL;
+    char *chans = csc_asprintf("%d", channels);
+    char *duplicate = (channels == 1) ? "-d" : NULL; // must be the last argument
+    if (!graph) {
+        graph = csc_casprintf("[%r]anull[plip0]", label);
+        label = "plip0";
+    }
+    char *map = csc_asprintf("[%r]", label);
+
 #ifdef _WIN32
-#define DEVNULL "NUL"
+    // Windows ffmpeg doesn't pipeline well
+    char *inter = CORD_to_char_star(csc_absolute(csc_casprintf("%r-loudness1.raw", base)));
+    csc_runl(0, NULL,
+        ffmpeg,
+        "-i", file,
+        "-filter_complex", graph, "-map", map,
+        "-f", "f32le", "-ac", chans, "-ar", "48000",
+        "-y", inter, NULL);
+    csc_runl(CSC_STDOUT, &result,
+        "plip-loudness", "-i", inter, chans, duplicate, NULL);
+    unlink(inter);
+
 #else
-#define DEVNULL "/dev/null"
+    int aud1 = csc_runpl(-1, CSC_STDOUT,
+        ffmpeg,
+        "-i", file,
+        "-filter_complex", graph, "-map", map,
+        "-f", "f32le", "-ac", chans, "-ar", "48000",
+        "-", NULL);
+    int aud2 = csc_runpl(aud1, CSC_STDOUT,
+        "plip-loudness", chans, duplicate, NULL);
+    FILE *fh = fdopen(aud2, "rb");
+    if (fh)
+        result = CORD_from_file_eager(fh);
+
 #endif
 
-// Figure out the normalization level for a file
-static double normlevel(CORD file, double target /* def: -18 */)
+    return readLoudness(result, loudness);
+}
+
+/* Figure out the normalization level for a file with the given hash, after the
+ * given filter graph */
+static double normlevel(CORD base, CORD file, unsigned long long hash, CORD graph, CORD label, int channels, double target /* def: -18 */)
 {
-    CORD summary;
     double loudness;
-    csc_runl(CSC_STDERR, &summary,
-        ffmpeg, "-i", file, "-af", "loudnorm=print_format=summary", "-f",
-        "wav", "-y", DEVNULL, NULL);
-
-    CORD *sintigrated = csc_grep("^Input Integrated:", summary);
-    if (!sintigrated || !sintigrated[0])
-        return 0;
-    sintigrated = csc_match(": (.*)$", sintigrated[0]);
-    if (!sintigrated || !sintigrated[1])
-        return 0;
-
-    loudness = atof(CORD_to_char_star(sintigrated[1]));
+    CORD key = loudnessKey(hash, graph);
+    if (!cachedLoudness(file, key, &loudness)) {
+        if (!measureLoudness(base, file, graph, label, channels, &loudness))
+            return 0;
+        cacheLoudness(file, key, loudness);
+    }
+
     if (!isnormal(loudness)) loudness = target;
     return target - loudness;
 }
 
-// Process an audio file
-struct AprocThread {
+// Write the envelope of the audio file source, as stereo f32 audio from a pipe
+static void envelopeFromPipe(int fd, CORD file, CORD source)
+{
+#define FRAMES 4096
+    CSC_Envelope *env = csc_envelopeNew(48000, 2);
+    float *buf = GC_MALLOC_ATOMIC(FRAMES * 2 * sizeof(float));
+    FILE *fh = fdopen(fd, "rb");
+    size_t rd;
+    if (!fh) {
+        csc_envelopeFree(env);
+        return;
+    }
+    while ((rd = fread(buf, 2 * sizeof(float), FRAMES, fh)) > 0)
+        csc_envelopeAdd(env, buf, rd);
+    fclose(fh);
+    csc_envelopeFinish(env);
+    csc_envelopeWrite(env, CORD_to_char_star(file), CORD_to_char_star(source));
+    csc_envelopeFree(env);
+#undef FRAMES
+}
+
+/* Run a filter graph (or no graph, if NULL) from a source file, or from a raw
+ * pipe of the given channels if sourceFd is not -1, encoding the result into
+ * outFile. If envelopeFile isn't NULL, the result's envelope is written there
+ * too, from a second output of the same run. */
+static void runFilters(int sourceFd, char *sourceFormat, char *sourceChannels, CORD source, CORD graph, CORD label, CORD outFile, CORD envelopeFile)
+{
+    char *envelopeMap = NULL;
+    if (envelopeFile && graph) {
+        graph = csc_casprintf("%r;[%r]asplit[plipout][plipenv]", graph, label);
+        label = "plipout";
+        envelopeMap = "[plipenv]";
+    } else if (envelopeFile) {
+        envelopeMap = "0:a";
+    }
+
+    struct Buffer_charp cl;
+    INIT_BUFFER(cl);
+#define W(x) WRITE_ONE_BUFFER(cl, x)
+    W(CORD_to_char_star(ffmpeg));
+    if (sourceFd >= 0) {
+        W("-f");
+        W(sourceFormat);
+        W("-ac");
+        W(sourceChannels);
+        W("-ar");
+        W("48000");
+        W("-i");
+        W("-");
+    } else {
+        W("-i");
+        W(CORD_to_char_star(source));
+    }
+    if (graph) {
+        W("-filter_complex");
+        W(CORD_to_char_star(graph));
+        W("-map");
+        W(csc_asprintf("[%r]", label));
+    } else if (envelopeMap) {
+        W("-map");
+        W("0:a");
+    }
+    W("-c:a");
+    W(CORD_to_char_star(icodec));
+    W("-y");
+    W(CORD_to_char_star(outFile));
+    if (envelopeMap) {
+        W("-map");
+        W(envelopeMap);
+        W("-f");
+        W("f32le");
+        W("-ac");
+        W("2");
+        W("-ar");
+        W("48000");
+        W("-");
+    }
+    W(NULL);
+#undef W
+
+    if (envelopeMap)
+        envelopeFromPipe(csc_runp(sourceFd, CSC_STDOUT, cl.buf), envelopeFile,
+            outFile);
+    else if (sourceFd >= 0)
+        csc_wait(csc_runp(sourceFd, CSC_STDOUT, cl.buf));
+    else
+        csc_run(0, NULL, cl.buf);
+
+    FREE_BUFFER(cl);
+}
+
+// An audio track to process
+struct Track {
     CORD input, base;
     bool deleteAfter; // delete when we're done
-    pthread_barrier_t *start; // wait for this before starting
-    pthread_rwlock_t *wlock; // lock for writing our file
-    CSC_HashTable *threadTable; // all other rwlocks, for dependencies
+    bool done; // already processed
+    bool silent; // demux found nothing in it, so it needn't be processed
+
+    // 1 if demux kept one channel of a dual-mono track, else 2
+    int channels;
+    char *channelArg;
+
+    // The envelope demux made of the input, if any
+    CORD inputEnvelope;
+
+    CORD noiser, noiserTier, noiserFile, noiseFile, scratchFile, outFile;
+    char *noiserProgram, *noiserFormat;
+    bool noiseLearn;
+    bool fuseNoiser; // pipe the denoiser straight into the filters
+
+    /* Noise profiles kept from earlier recordings. If the store has a fresh
+     * profile for this track, we use it instead of learning; otherwise, the
+     * denoiser saves what it learned to profileFile for the store. */
+    bool profileHit;
+    CORD profileFile;
+    unsigned long long profileFingerprint;
+
+    // Processing steps, 1-indexed
+    int lastStep;
+    CORD *filterNames;
+    double *desiredLevels;
+    CORD **filterDeps;
 };
-void *aproc(void *vat)
+
+// Keep intermediate files?
+static bool keep = false;
+
+// Threads each noise-repellent denoiser may use
+static int noiserJobs = 1;
+
+// FFTW wisdom for the noise-repellent and FFTW speex denoisers
+static CORD fftwWisdom;
+
+// The noise profile store, and its lock
+static CORD profileStore;
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Fingerprint what a track's noise profile depends on: the denoiser and its
+ * tier, and the source of the track as best we can tell from its stream */
+static unsigned long long profileFingerprint(struct Track *t)
 {
-    struct AprocThread *at = vat;
+    static const char *keys[] = {
+        "codec_name", "sample_rate", "channels", "channel_layout",
+        "tags.title", "tags.handler_name", NULL
+    };
+    CSC_Probe *probe = csc_probe(t->input);
+    unsigned long long hash = FNV_BASIS;
+    char *noiser = CORD_to_char_star(t->noiser);
+    hash = fnv(hash, (unsigned char *) noiser, strlen(noiser) + 1);
+    char *tier = CORD_to_char_star(t->noiserTier);
+    hash = fnv(hash, (unsigned char *) tier, strlen(tier) + 1);
+    for (int ki = 0; keys[ki]; ki++) {
+        CORD value = (probe->nbStreams > 0) ? csc_probeStream(probe, 0, keys[ki]) : NULL;
+        char *v = CORD_to_char_star(csc_casprintf("%s=%r", keys[ki], value));
+        hash = fnv(hash, (unsigned char *) v, strlen(v) + 1);
+    }
+    return hash;
+}
 
-    CORD input = at->input;
-    CORD base = at->base;
+// Look for a fresh stored noise profile for this track
+static bool findProfile(struct Track *t, int maxAge)
+{
+    CSC_NoiseProfile **profiles, *profile;
+    bool ret = false;
+    int count = csc_noiseProfileRead(CORD_to_char_star(profileStore), &profiles);
+    if (count < 0) {
+        CORD_fprintf(stderr, "^PLIP: Ignoring invalid noise profile store %r\n", profileStore);
+        return false;
+    }
+    profile = csc_noiseProfileFind(profiles, count, CORD_to_char_star(t->base));
+    if (profile && profile->fingerprint == t->profileFingerprint &&
+        profile->channels == t->channels &&
+        time(NULL) - profile->learned < (long long) maxAge * 86400)
+        ret = true;
+    csc_noiseProfileFreeAll(profiles, count);
+    return ret;
+}
 
-    // Get the writer lock
-    pthread_rwlock_wrlock(at->wlock);
+// Add a newly learned noise profile to the store
+static void storeProfile(struct Track *t)
+{
+    CSC_NoiseProfile **profiles;
+    char *file;
+    int count;
 
-    // Wait until we're ready
-    pthread_barrier_wait(at->start);
+    if (!t->profileFile)
+        return;
+    file = CORD_to_char_star(t->profileFile);
+    if (!csc_fileExists(t->profileFile))
+        return;
 
-    // And process
-    input = csc_absolute(input);
+    count = csc_noiseProfileRead(file, &profiles);
+    if (count > 0) {
+        profiles[0]->fingerprint = t->profileFingerprint;
+        pthread_mutex_lock(&profileLock);
+        csc_noiseProfileStore(CORD_to_char_star(profileStore), profiles[0]);
+        pthread_mutex_unlock(&profileLock);
+    }
+    csc_noiseProfileFreeAll(profiles, count);
+    unlink(file);
+}
 
-    CORD noiserFile = csc_absolute(csc_casprintf("%r-noiser.%r", base, iformat));
-    CORD noiseFile = csc_absolute(csc_casprintf("%r-noise.f32", base));
-    CORD outFile = csc_absolute(csc_casprintf("%r-proc.%r", base, iformat));
-    CORD noiser = csc_configRead(csc_configTree, "steps.noiser", base, NULL);
-    bool noiseLearn = csc_configBool(csc_configTree, "steps.noiserlearn", base);
+// Read a track's configuration
+static void prepare(struct Track *t)
+{
+    CORD base = t->base;
+    t->input = csc_absolute(t->input);
 
-    // If we're already done, we're already done!
-    if (csc_fileExists(outFile)) {
-        CORD_fprintf(stderr, "^PLIP: %r already processed, skipping.\n", base);
-        pthread_rwlock_unlock(at->wlock);
-        return NULL;
+    /* Other inputs are processed in stereo, but demux's may be dual mono,
+     * which we process in mono and duplicate at the end */
+    t->channels = 2;
+    if (t->deleteAfter) {
+        CSC_Probe *probe = csc_probe(t->input);
+        if (probe->nbStreams > 0 &&
+            !CORD_cmp(csc_probeStream(probe, 0, "channels"), "1"))
+            t->channels = 1;
+
+        CORD envelope = CORD_cat(t->input, CSC_ENVELOPE_SUFFIX);
+        CSC_Envelope *env = csc_envelopeRead(CORD_to_char_star(envelope),
+            CORD_to_char_star(t->input));
+        if (env)
+            t->inputEnvelope = envelope;
+        csc_envelopeFree(env);
+    }
+    t->channelArg = csc_asprintf("%d", t->channels);
+    t->noiserFile = csc_absolute(csc_casprintf("%r-noiser.%r", base, iformat));
+    t->noiseFile = csc_absolute(csc_casprintf("%r-noise.f32", base));
+    t->outFile = csc_absolute(csc_casprintf("%r-proc.%r", base, iformat));
+    t->noiser = csc_configRead(csc_configTree, "steps.noiser", base, NULL);
+    t->done = csc_fileExists(t->outFile);
+
+    // Silent tracks are simply silenced, with no denoising or filters
+    t->silent = t->deleteAfter &&
+        csc_fileExists(csc_casprintf("%r.silent", t->input));
+    if (t->silent) {
+        t->noiser = NULL;
+        t->lastStep = 0;
+        return;
     }
 
-    // Do noise reduction if asked
-    if (CORD_cmp(noiser, NULL)) {
-        char *program = CORD_to_char_star(csc_casprintf("plip-%rdenoise", noiser));
-        char *format = "s16le";
-        if (!CORD_cmp(noiser, "noiserepellent"))
-            format = "f32le";
+    if (CORD_cmp(t->noiser, NULL)) {
+        t->noiserProgram = CORD_to_char_star(csc_casprintf("plip-%rdenoise", t->noiser));
+        t->noiserFormat = "s16le";
+        if (!CORD_cmp(t->noiser, "noiserepellent")) {
+            t->noiserFormat = "f32le";
+            t->noiserTier = csc_configRead(csc_configTree, "steps.noisertier", base, NULL);
+        } else if (!CORD_cmp(t->noiser, "speexfftw")) {
+            t->noiserFormat = "f32le";
+        }
+
+        // Speex can't learn, so don't bother finding noise for it
+        t->noiseLearn = csc_configBool(csc_configTree, "steps.noiserlearn", base) &&
+            CORD_cmp(t->noiser, "speex") && CORD_cmp(t->noiser, "speexfftw");
+
+        // Maybe we learned this track's noise in an earlier recording
+        int maxAge = csc_configInt(csc_configTree, "steps.noiserprofileage", base);
+        if (t->noiseLearn && maxAge > 0 && !CORD_cmp(t->noiser, "noiserepellent")) {
+            t->profileFingerprint = profileFingerprint(t);
+            t->profileHit = findProfile(t, maxAge);
+            if (t->profileHit)
+                CORD_fprintf(stderr, "^PLIP: %r: Reusing stored noise profile\n", base);
+            else
+                t->profileFile = csc_absolute(csc_casprintf("%r-noise.profile", base));
+        }
+
+        /* If we're learning without an envelope, the input has to be read
+         * twice, so decode it once into a scratch file both can read */
+        if (t->noiseLearn && !t->profileHit && !t->inputEnvelope &&
+            !strcmp(t->noiserFormat, "f32le"))
+            t->scratchFile = csc_absolute(csc_casprintf("%r-pcm.f32", base));
+    }
+
+    // Figure out our processing steps
+    int steps = csc_configInt(csc_configTree, "steps.aproc", base);
+    if (steps < 0)
+        steps = 0;
+    if (csc_verbose)
+        fprintf(stderr, "^PLIP: %r: %d audio processing steps\n", base, steps);
+    t->filterNames = GC_MALLOC((steps + 1) * sizeof(CORD));
+    t->desiredLevels = GC_MALLOC_ATOMIC((steps + 1) * sizeof(double));
+    t->filterDeps = GC_MALLOC((steps + 1) * sizeof(CORD *));
+    t->lastStep = 0;
+    for (int si = 1; si <= steps; si++) {
+        CORD filterName = csc_configRead(csc_configTree, csc_casprintf("filters.aproc%d", si), base, NULL);
+        t->filterNames[si] = filterName;
+        t->desiredLevels[si] = csc_configDouble(csc_configTree, csc_casprintf("filters.alevel%d", si), base);
+        t->filterDeps[si] = csc_lines(csc_configRead(csc_configTree, csc_casprintf("filters.%rdeps", filterName), base, NULL));
+        if (CORD_cmp(filterName, "null"))
+            t->lastStep = si;
+    }
+
+    /* Leveling needs the level of the denoised audio, so unless nothing is
+     * leveled, the denoised audio is the one intermediate file we need */
+    t->fuseNoiser = !keep;
+    for (int si = 1; si <= t->lastStep; si++) {
+        if (CORD_cmp(t->filterNames[si], "null") && t->desiredLevels[si] != 0.0)
+            t->fuseNoiser = false;
+    }
+}
+
+/* Find noise using the input's envelope, so that only the quietest second is
+ * decoded. Returns false if the envelope isn't usable. */
+static bool noiseFromEnvelope(struct Track *t)
+{
+    CORD result = NULL;
+    csc_runl(CSC_STDOUT, &result,
+        "plip-findnoise", "-e", CORD_to_char_star(t->inputEnvelope), NULL);
+    CORD *parts = csc_match("^([0-9\\.]+)", result);
+    if (!parts || !parts[1])
+        return false;
+
+    csc_runl(0, NULL,
+        ffmpeg,
+        "-ss", CORD_to_char_star(parts[1]), "-i", CORD_to_char_star(t->input),
+        "-af", "atrim=end_sample=48000,apad=whole_len=48000",
+        "-f", "f32le", "-ac", t->channelArg, "-ar", "48000",
+        "-y", CORD_to_char_star(t->noiseFile), NULL);
+    return csc_fileExists(t->noiseFile);
+}
+
+// Start the denoiser, returning its output
+static int startDenoiser(struct Track *t, char **inter)
+{
+    int aud1 = -1;
+    char *decoded = NULL;
+
+    // Decode the input, unless it already is
+    if (t->scratchFile && csc_fileExists(t->scratchFile)) {
+        decoded = CORD_to_char_star(t->scratchFile);
 
-        // Find noise if needed
-        if (noiseLearn && !csc_fileExists(noiseFile)) {
+    } else {
 #ifdef _WIN32
-            // Windows ffmpeg doesn't pipeline well
-            char *inter = CORD_to_char_star(csc_absolute(csc_casprintf("%r-noise1.raw", base)));
-            csc_runl(0, NULL,
-                ffmpeg,
-                "-i", input,
-                "-f", "f32le", "-ac", "2", "-ar", "48000",
-                inter, NULL);
-            int aud2 = csc_runpl(-1, CSC_STDOUT,
-                "plip-findnoise",
-                "-i", inter,
-                "-o", CORD_to_char_star(noiseFile),
-                "2", NULL);
+        // Windows ffmpeg doesn't pipeline well
+        *inter = CORD_to_char_star(csc_absolute(csc_casprintf("%r-noiser1.raw", t->base)));
+        csc_runl(0, NULL,
+            ffmpeg,
+            "-i", t->input,
+            "-f", t->noiserFormat, "-ac", t->channelArg, "-ar", "48000",
+            *inter, NULL);
+        decoded = *inter;
 
 #else
-            int aud1 = csc_runpl(-1, CSC_STDOUT,
-                ffmpeg,
-                "-i", input,
-                "-f", "f32le", "-ac", "2", "-ar", "48000",
-                "-", NULL);
-            int aud2 = csc_runpl(aud1, CSC_STDOUT,
-                "plip-findnoise",
-                "-o", CORD_to_char_star(noiseFile),
-                "2", NULL);
+        aud1 = csc_runpl(-1, CSC_STDOUT,
+            ffmpeg,
+            "-i", t->input,
+            "-f", t->noiserFormat, "-ac", t->channelArg, "-ar", "48000",
+            "-", NULL);
 
 #endif
-            csc_wait(aud2);
+    }
 
-#ifdef _WIN32
-            unlink(inter);
-#endif
+    // Then denoise it
+    struct Buffer_charp cl;
+    INIT_BUFFER(cl);
+#define W(x) WRITE_ONE_BUFFER(cl, x)
+    W(t->noiserProgram);
+    if (decoded) {
+        W("-i");
+        W(decoded);
+    }
+    if (t->profileHit) {
+        W("-P");
+        W(CORD_to_char_star(profileStore));
+        W("-t");
+        W(CORD_to_char_star(t->base));
+    } else if (t->noiseLearn) {
+        W("-l");
+        W(CORD_to_char_star(t->noiseFile));
+        if (t->profileFile) {
+            W("-S");
+            W(CORD_to_char_star(t->profileFile));
+            W("-t");
+            W(CORD_to_char_star(t->base));
+        }
+    }
+    if (!CORD_cmp(t->noiser, "noiserepellent")) {
+        if (CORD_cmp(t->noiserTier, NULL)) {
+            W("--tier");
+            W(CORD_to_char_star(t->noiserTier));
         }
+        W("-w");
+        W(CORD_to_char_star(fftwWisdom));
+        if (noiserJobs > 1) {
+            W("-j");
+            W(csc_asprintf("%d", noiserJobs));
+        }
+    } else if (!CORD_cmp(t->noiser, "speexfftw")) {
+        W("-w");
+        W(CORD_to_char_star(fftwWisdom));
+    }
+    W(t->channelArg);
+    W(NULL);
+#undef W
+
+    int noiseRed = csc_runp(aud1, CSC_STDOUT, cl.buf);
+
+    FREE_BUFFER(cl);
+    return noiseRed;
+}
+
+// The first job for a track: noise learning and (usually) noise reduction
+static void denoiseJob(struct Track *t)
+{
+    CORD input = t->input;
+    CORD noiserFile = t->noiserFile;
+    CORD noiseFile = t->noiseFile;
 
-        // Perform noise reduction
-        if (!csc_fileExists(noiserFile)) {
-            int noiseRed;
+    if (t->done || !CORD_cmp(t->noiser, NULL))
+        return;
 
-            // Set up the pipeline
+    // Find noise if needed
+    bool findNoise = t->noiseLearn && !t->profileHit && !csc_fileExists(noiseFile);
+    if (findNoise && t->inputEnvelope && noiseFromEnvelope(t))
+        findNoise = false;
+    if (findNoise && t->scratchFile) {
+        // Decode once, for both finding noise and reducing it
+        char *scratch = CORD_to_char_star(t->scratchFile);
+        csc_runl(0, NULL,
+            ffmpeg,
+            "-i", input,
+            "-f", "f32le", "-ac", t->channelArg, "-ar", "48000",
+            "-y", scratch, NULL);
+        csc_runl(0, NULL,
+            "plip-findnoise",
+            "-i", scratch,
+            "-o", CORD_to_char_star(noiseFile),
+            t->channelArg, NULL);
+
+    } else if (findNoise) {
 #ifdef _WIN32
-            // Windows ffmpeg doesn't pipeline well
-            char *inter = CORD_to_char_star(csc_absolute(csc_casprintf("%r-noiser1.raw", base)));
-            csc_runl(0, NULL,
-                ffmpeg,
-                "-i", input,
-                "-f", format, "-ac", "2", "-ar", "48000",
-                inter, NULL);
-            if (noiseLearn) {
-                noiseRed = csc_runpl(-1, CSC_STDOUT,
-                    program,
-                    "-i", inter,
-                    "-l", noiseFile,
-                    "2", NULL);
-            } else {
-                noiseRed = csc_runpl(-1, CSC_STDOUT,
-                    program,
-                    "-i", inter,
-                    "2", NULL);
-            }
+        // Windows ffmpeg doesn't pipeline well
+        char *inter = CORD_to_char_star(csc_absolute(csc_casprintf("%r-noise1.raw", t->base)));
+        csc_runl(0, NULL,
+            ffmpeg,
+            "-i", input,
+            "-f", "f32le", "-ac", t->channelArg, "-ar", "48000",
+            inter, NULL);
+        int aud2 = csc_runpl(-1, CSC_STDOUT,
+            "plip-findnoise",
+            "-i", inter,
+            "-o", CORD_to_char_star(noiseFile),
+            t->channelArg, NULL);
 
 #else
-            int aud1 = csc_runpl(-1, CSC_STDOUT,
-                ffmpeg,
-                "-i", input,
-                "-f", format, "-ac", "2", "-ar", "48000",
-                "-", NULL);
-            if (noiseLearn) {
-                noiseRed = csc_runpl(aud1, CSC_STDOUT,
-                    program,
-                    "-l", noiseFile,
-                    "2", NULL);
-            } else {
-                noiseRed = csc_runpl(aud1, CSC_STDOUT,
-                    program, "2", NULL);
-            }
-#endif
+        int aud1 = csc_runpl(-1, CSC_STDOUT,
+            ffmpeg,
+            "-i", input,
+            "-f", "f32le", "-ac", t->channelArg, "-ar", "48000",
+            "-", NULL);
+        int aud2 = csc_runpl(aud1, CSC_STDOUT,
+            "plip-findnoise",
+            "-o", CORD_to_char_star(noiseFile),
+            t->channelArg, NULL);
 
-            int aud2 = csc_runpl(noiseRed, CSC_STDOUT,
-                ffmpeg,
-                "-f", format, "-ac", "2", "-ar", "48000", "-i", "-",
-                "-c:a", icodec,
-                CORD_to_char_star(noiserFile), NULL);
-            csc_wait(aud2);
+#endif
+        csc_wait(aud2);
 
 #ifdef _WIN32
-            unlink(inter);
+        unlink(inter);
 #endif
-        }
+    }
 
-        // There's no reason to keep the learning file around
-        if (noiseLearn)
-            unlink(CORD_to_char_star(noiseFile));
+    // If we're feeding the denoiser straight into the filters, that's later
+    if (t->fuseNoiser || csc_fileExists(noiserFile))
+        return;
 
-    } else {
-        unlink(CORD_to_char_star(noiserFile));
-        csc_ln(input, noiserFile);
+    // Perform noise reduction
+    char *inter = NULL;
+    int noiseRed = startDenoiser(t, &inter);
+
+    // Meter the denoised audio on its way through
+    CORD meterFile = csc_casprintf("%r.lufs", noiserFile);
+    int metered = csc_runpl(noiseRed, CSC_STDOUT,
+        "plip-loudness", "-t", "-f", t->noiserFormat,
+        "-o", CORD_to_char_star(meterFile),
+        t->channelArg, (t->channels == 1) ? "-d" : NULL, NULL);
+    int aud2 = csc_runpl(metered, CSC_STDOUT,
+        ffmpeg,
+        "-f", t->noiserFormat, "-ac", t->channelArg, "-ar", "48000", "-i", "-",
+        "-c:a", icodec,
+        CORD_to_char_star(noiserFile), NULL);
+    csc_wait(aud2);
+    storeProfile(t);
 
+    // And cache the measurement for the first leveled step
+    double loudness;
+    if (readLoudness(csc_readFile(meterFile), &loudness)) {
+        cacheLoudness(noiserFile,
+            loudnessKey(fileHash(noiserFile), NULL), loudness);
     }
+    unlink(CORD_to_char_star(meterFile));
 
-    // Then perform all requested processing steps
-    CORD lastFile = noiserFile;
-    int steps = csc_configInt(csc_configTree, "steps.aproc", base);
-    if (csc_verbose)
-        fprintf(stderr, "^PLIP: %r: %d audio processing steps\n", base, steps);
-    for (int si = 1; si <= steps; si++) {
-        CORD filterName = csc_configRead(csc_configTree, csc_casprintf("filters.aproc%d", si), base, NULL);
-        double desiredLevel = csc_configDouble(csc_configTree, csc_casprintf("filters.alevel%d", si), base);
+    if (inter)
+        unlink(inter);
+    if (t->scratchFile && !keep)
+        unlink(CORD_to_char_star(t->scratchFile));
+}
 
-        if (csc_verbose)
-            CORD_fprintf(stderr, "^PLIP: %r: Audio processing step %d: %r\n", base, si, filterName);
+// The second job for a track: all processing steps
+static void filterJob(struct Track *t)
+{
+    CORD input = t->input;
+    CORD base = t->base;
+    CORD noiserFile = t->noiserFile;
 
-        // What's our output?
-        CORD nextFile;
-        if (si == steps)
-            nextFile = outFile;
-        else
-            nextFile = csc_casprintf("%r-aproc%d.%r", base, si, iformat);
+    // If we're already done, we're already done!
+    if (t->done) {
+        CORD_fprintf(stderr, "^PLIP: %r already processed, skipping.\n", base);
+        return;
+    }
 
-        // If this is a null step, skip it
-        if (!CORD_cmp(filterName, "null")) {
-            if (si == steps) {
-                // But still need to convert
-                csc_runl(0, NULL,
-                    ffmpeg, "-i", lastFile, "-c:a", icodec, nextFile, NULL);
-                unlink(CORD_to_char_star(lastFile));
+    // A silent track only needs to be silence of the same length
+    if (t->silent) {
+        CORD_fprintf(stderr, "^PLIP: %r is silent, so not processing it.\n", base);
+        runFilters(-1, NULL, NULL, input,
+            "[0:a]volume=0,pan=stereo|c0=c0|c1=c0[plipsilent]", "plipsilent",
+            t->outFile, CORD_cat(t->outFile, CSC_ENVELOPE_SUFFIX));
+        unlink(CORD_to_char_star(csc_casprintf("%r.silent", input)));
+        unlink(CORD_to_char_star(CORD_cat(input, CSC_ENVELOPE_SUFFIX)));
+        unlink(CORD_to_char_star(input));
+        csc_probeForget(input);
+        CORD_fprintf(stderr, "^PLIP: Audio track %r processed.\n", base);
+        return;
+    }
 
-            } else {
-                // Just rename it
-                rename(CORD_to_char_star(lastFile), CORD_to_char_star(nextFile));
+    // Our source is the input, the denoised file, or the denoiser itself
+    CORD source = input;
+    int sourceFd = -1;
+    char *sourceFormat = NULL;
+    char *inter = NULL;
+    if (CORD_cmp(t->noiser, NULL)) {
+        if (t->fuseNoiser && !csc_fileExists(noiserFile)) {
+            // Feed the denoiser straight into the filters
+            sourceFd = startDenoiser(t, &inter);
+            sourceFormat = t->noiserFormat;
+        } else {
+            source = noiserFile;
+        }
+    }
 
-            }
+    /* Then compile all requested processing steps into a single filter graph.
+     * Each step reads the previous step's output label; we only write
+     * intermediate files if asked to keep them. */
+    CORD graph = NULL;
+    CORD label = "0:a";
+    unsigned long long sourceHash = 0;
+    if (sourceFd < 0)
+        sourceHash = fileHash(source);
+    for (int si = 1; si <= t->lastStep; si++) {
+        CORD filterName = t->filterNames[si];
+        double desiredLevel = t->desiredLevels[si];
 
-            lastFile = nextFile;
+        if (csc_verbose)
+            CORD_fprintf(stderr, "^PLIP: %r: Audio processing step %d: %r\n", base, si, filterName);
+
+        // If this is a null step, skip it
+        if (!CORD_cmp(filterName, "null"))
             continue;
-        }
 
         CSC_HashTable *filterVars = csc_newHashTable();
 
         // Figure out the necessary leveling if requested
         if (desiredLevel != 0.0) {
-            double n = normlevel(lastFile, desiredLevel);
+            double n = normlevel(base, source, sourceHash, graph, label, t->channels, desiredLevel);
             csc_htAdd(filterVars, "level", (void *) csc_casprintf("%f", n));
         }
 
-        // Get any dependencies the filter has
-        CORD *filterDeps = csc_lines(csc_configRead(csc_configTree, csc_casprintf("filters.%rdeps", filterName), base, NULL));
+        // Any dependencies the filter has are already done by now
+        CORD *filterDeps = t->filterDeps[si];
         for (size_t fdi = 0; filterDeps[fdi]; fdi++) {
-            // Wait for it
-            CORD dep = filterDeps[fdi];
-            CORD depOut = csc_casprintf("%r-proc.%r", dep, iformat);
-            pthread_rwlock_t *otherWlock = csc_htGet(at->threadTable, dep);
-            if (otherWlock) {
-                pthread_rwlock_rdlock(otherWlock);
-                pthread_rwlock_unlock(otherWlock);
-            }
+            CORD depOut = csc_casprintf("%r-proc.%r", filterDeps[fdi], iformat);
             csc_htAdd(filterVars, csc_casprintf("dep%d", (int) (fdi+1)), (void *) depOut);
         }
 
         // Get the filter
         CORD filter = csc_configRead(csc_configTree, csc_casprintf("filters.%r", filterName), base, filterVars);
 
-        // And run it
-        csc_runl(0, NULL,
-            ffmpeg, "-i", lastFile,
-            "-filter_complex", csc_casprintf("[0:a]%r[aud]", filter),
-            "-map", "[aud]",
-            "-c:a", icodec,
-            "-y", nextFile, NULL);
+        // And add it to the graph
+        CORD nextLabel = csc_casprintf("plip%d", si);
+        filter = csc_casprintf("[%r]%r[%r]", label, filter, nextLabel);
+        if (graph)
+            graph = csc_casprintf("%r;%r", graph, filter);
+        else
+            graph = filter;
+        label = nextLabel;
+
+        // Keep the intermediate if asked
+        if (keep && si != t->lastStep) {
+            CORD nextFile = csc_casprintf("%r-aproc%d.%r", base, si, iformat);
+            runFilters(-1, NULL, NULL, source, graph, label, nextFile, NULL);
+            source = nextFile;
+            sourceHash = fileHash(source);
+            graph = NULL;
+            label = "0:a";
+        }
+    }
 
-        unlink(CORD_to_char_star(lastFile));
-        lastFile = nextFile;
+    // Dual-mono tracks go back to stereo at the very end
+    if (t->channels == 1) {
+        CORD dup = csc_casprintf("[%r]pan=stereo|c0=c0|c1=c0[plipdup]", label);
+        graph = graph ? csc_casprintf("%r;%r", graph, dup) : dup;
+        label = "plipdup";
     }
 
+    // Run the whole chain
+    if (csc_verbose && graph)
+        CORD_fprintf(stderr, "^PLIP: %r: Audio processing filter: %r\n", base, graph);
+    runFilters(sourceFd, sourceFormat, t->channelArg, source, graph, label,
+        t->outFile, CORD_cat(t->outFile, CSC_ENVELOPE_SUFFIX));
+    storeProfile(t);
+
     // Clean up
-    if (at->deleteAfter)
+    if (inter)
+        unlink(inter);
+    if (t->scratchFile && !keep)
+        unlink(CORD_to_char_star(t->scratchFile));
+    if (t->noiseLearn)
+        unlink(CORD_to_char_star(t->noiseFile));
+    if (!keep) {
+        unlink(CORD_to_char_star(noiserFile));
+        unlink(CORD_to_char_star(csc_casprintf("%r.loudness", noiserFile)));
+    }
+    if (t->deleteAfter) {
         unlink(CORD_to_char_star(input));
+        unlink(CORD_to_char_star(csc_casprintf("%r.loudness", input)));
+        csc_probeForget(input);
+        if (t->inputEnvelope)
+            unlink(CORD_to_char_star(t->inputEnvelope));
+    }
+
+    CORD_fprintf(stderr, "^PLIP: Audio track %r processed.\n", base);
+}
 
-    // And mark ourself as done
-    pthread_rwlock_unlock(at->wlock);
+/* A job in the dependency graph. Each track is a denoise job followed by a
+ * filter job, and filter jobs also follow the filter jobs of the tracks they
+ * depend on. */
+struct Job {
+    struct Track *track;
+    void (*run)(struct Track *);
+    size_t id; // index in the queue
+    double weight, priority;
+    int waiting; // jobs this job is still waiting for
+    bool started, done;
+    size_t nextCt;
+    struct Job **next; // jobs waiting for this job
+};
+
+// A filter job waiting for a track we haven't seen yet
+struct PendingDep {
+    CORD track;
+    struct Job *job;
+};
+
+// The job queue shared by all workers
+struct JobQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct Job **jobs;
+    size_t jobCt, running;
+    bool open; // more tracks may still come
+    CSC_HashTable *trackJobs; // filter job of each track
+    struct PendingDep *pending;
+    size_t pendingCt;
+};
+
+// Make a job follow another, unless the other is already done
+static void jobFollows(struct Job *job, struct Job *prev)
+{
+    if (prev->done)
+        return;
+    prev->next = GC_REALLOC(prev->next, (prev->nextCt + 1) * sizeof(struct Job *));
+    prev->next[prev->nextCt++] = job;
+    job->waiting++;
+}
+
+/* Order the jobs topologically, failing if there's a cycle, and give each job
+ * the priority of its critical path: its own weight plus the longest path of
+ * jobs that follow it */
+static bool planJobs(struct Job **jobs, size_t jobCt)
+{
+    struct Job **order = GC_MALLOC(jobCt * sizeof(struct Job *));
+    int *waiting = GC_MALLOC_ATOMIC(jobCt * sizeof(int));
+    size_t head = 0, tail = 0;
+
+    memset(waiting, 0, jobCt * sizeof(int));
+    for (size_t ji = 0; ji < jobCt; ji++) {
+        for (size_t ni = 0; ni < jobs[ji]->nextCt; ni++)
+            waiting[jobs[ji]->next[ni]->id]++;
+    }
+    for (size_t ji = 0; ji < jobCt; ji++) {
+        if (!waiting[ji])
+            order[tail++] = jobs[ji];
+    }
+    while (head < tail) {
+        struct Job *job = order[head++];
+        for (size_t ni = 0; ni < job->nextCt; ni++) {
+            if (!--waiting[job->next[ni]->id])
+                order[tail++] = job->next[ni];
+        }
+    }
+
+    if (tail < jobCt) {
+        fprintf(stderr, "plip-aproc: Dependency cycle between tracks:");
+        for (size_t ji = 0; ji < jobCt; ji += 2) {
+            if (waiting[ji + 1])
+                CORD_fprintf(stderr, " %r", jobs[ji]->track->base);
+        }
+        fprintf(stderr, "\n");
+        return false;
+    }
+
+    while (tail--) {
+        struct Job *job = order[tail];
+        double longest = 0;
+        for (size_t ni = 0; ni < job->nextCt; ni++) {
+            if (job->next[ni]->priority > longest)
+                longest = job->next[ni]->priority;
+        }
+        job->priority = job->weight + longest;
+    }
+
+    return true;
+}
+
+// Make a new job in the queue
+static struct Job *newJob(struct JobQueue *q, struct Track *t, void (*run)(struct Track *))
+{
+    struct Job *job = GC_NEW(struct Job);
+    job->track = t;
+    job->run = run;
+    job->id = q->jobCt;
+    q->jobs = GC_REALLOC(q->jobs, (q->jobCt + 1) * sizeof(struct Job *));
+    q->jobs[q->jobCt++] = job;
+    return job;
+}
+
+// Make a track from its input file, or NULL if it isn't one
+static struct Track *newTrack(CORD input)
+{
+    bool deleteAfter = true;
+    CORD stripRE = csc_casprintf("^(.*)-raw\\.%r$", iformat);
+    CORD *stripStep = csc_match(stripRE, input);
+    if (!stripStep || !stripStep[1]) {
+        deleteAfter = false;
+        stripStep = csc_match("^(.*)-sync\\.flac$", input);
+        if (!stripStep || !stripStep[1])
+            return NULL;
+    }
+
+    struct Track *t = GC_NEW(struct Track);
+    t->input = input;
+    t->base = stripStep[1];
+    t->deleteAfter = deleteAfter;
+    return t;
+}
+
+/* Add a prepared track's two jobs to the queue. Call with the queue locked. */
+static void addTrack(struct JobQueue *q, struct Track *t)
+{
+    /* Weigh the jobs by the size of their input. Denoising is most of the
+     * work, and each leveling is another pass. */
+    struct stat sbuf;
+    double size = 1;
+    if (!t->silent && stat(CORD_to_char_star(t->input), &sbuf) == 0)
+        size += sbuf.st_size;
+
+    struct Job *dj = newJob(q, t, denoiseJob);
+    dj->weight = CORD_cmp(t->noiser, NULL) ? size * 4 : 0;
+    struct Job *fj = newJob(q, t, filterJob);
+    fj->weight = size;
+    for (int si = 1; si <= t->lastStep; si++) {
+        if (CORD_cmp(t->filterNames[si], "null") && t->desiredLevels[si] != 0.0)
+            fj->weight += size;
+    }
+    if (t->done)
+        dj->weight = fj->weight = 0;
+    jobFollows(fj, dj);
+    csc_htAdd(q->trackJobs, t->base, fj);
+
+    // Filters wait for the tracks they depend on, even ones still to come
+    for (int si = 1; si <= t->lastStep; si++) {
+        if (!CORD_cmp(t->filterNames[si], "null"))
+            continue;
+        CORD *filterDeps = t->filterDeps[si];
+        for (size_t fdi = 0; filterDeps[fdi]; fdi++) {
+            struct Job *dep = csc_htGet(q->trackJobs, filterDeps[fdi]);
+            if (dep) {
+                jobFollows(fj, dep);
+            } else {
+                q->pending = GC_REALLOC(q->pending, (q->pendingCt + 1) * sizeof(struct PendingDep));
+                q->pending[q->pendingCt].track = filterDeps[fdi];
+                q->pending[q->pendingCt++].job = fj;
+                fj->waiting++;
+            }
+        }
+    }
+
+    // And anything that was waiting for this track now follows it
+    for (size_t pi = 0; pi < q->pendingCt; pi++) {
+        if (CORD_cmp(q->pending[pi].track, t->base))
+            continue;
+        q->pending[pi].job->waiting--;
+        jobFollows(q->pending[pi].job, fj);
+        q->pending[pi--] = q->pending[--q->pendingCt];
+    }
+}
+
+/* No more tracks are coming, so release anything still waiting for one. Call
+ * with the queue locked. */
+static void closeTracks(struct JobQueue *q)
+{
+    for (size_t pi = 0; pi < q->pendingCt; pi++)
+        q->pending[pi].job->waiting--;
+    q->pendingCt = 0;
+    q->open = false;
+    pthread_cond_broadcast(&q->cond);
+}
+
+/* A worker runs ready jobs, most critical first, until there are none left
+ * and no more can come */
+static void *worker(void *vq)
+{
+    struct JobQueue *q = vq;
+
+    pthread_mutex_lock(&q->lock);
+    while (true) {
+        // Choose the ready job with the longest critical path
+        struct Job *job = NULL;
+        for (size_t ji = 0; ji < q->jobCt; ji++) {
+            struct Job *cand = q->jobs[ji];
+            if (!cand->started && !cand->waiting &&
+                (!job || cand->priority > job->priority))
+                job = cand;
+        }
+        if (!job) {
+            if (!q->open && !q->running)
+                break;
+            pthread_cond_wait(&q->cond, &q->lock);
+            continue;
+        }
+        job->started = true;
+        q->running++;
+        pthread_mutex_unlock(&q->lock);
+
+        job->run(job->track);
+
+        // Release anything waiting for it
+        pthread_mutex_lock(&q->lock);
+        job->done = true;
+        for (size_t ni = 0; ni < job->nextCt; ni++)
+            job->next[ni]->waiting--;
+        q->running--;
+        pthread_cond_broadcast(&q->cond);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return NULL;
+}
+
+/* Add tracks as they're named on stdin, one per line, as plip-demux finishes
+ * them. Returns false if they make a dependency cycle. */
+static bool followTracks(struct JobQueue *q)
+{
+    char line[1024];
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (!line[0])
+            continue;
+
+        // Only this thread adds tracks, so this needs no lock
+        CORD base = CORD_from_char_star(line);
+        if (csc_htGet(q->trackJobs, base))
+            continue;
+
+        CORD input = csc_casprintf("%r-raw.%r", base, iformat);
+        if (!csc_fileExists(input)) {
+            // Demux skips tracks that are already processed
+            if (csc_fileExists(csc_casprintf("%r-proc.%r", base, iformat)))
+                CORD_fprintf(stderr, "^PLIP: %r already processed, skipping.\n", base);
+            else
+                CORD_fprintf(stderr, "plip-aproc: No input for track %r\n", base);
+            continue;
+        }
+
+        struct Track *t = newTrack(input);
+        prepare(t);
+
+        pthread_mutex_lock(&q->lock);
+        addTrack(q, t);
+        bool ok = planJobs(q->jobs, q->jobCt);
+        if (!ok)
+            closeTracks(q);
+        pthread_cond_broadcast(&q->cond);
+        pthread_mutex_unlock(&q->lock);
+        if (!ok)
+            return false;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    closeTracks(q);
+    pthread_mutex_unlock(&q->lock);
+    return true;
 }
 
 void usage()
 {
-    fprintf(stderr, "Use: plip-aproc [-c|--config <config file>] [-v]\n\n");
+    fprintf(stderr,
+        "Use: plip-aproc [-c|--config <config file>] [-v] [-j|--jobs <count>]\n"
+        "       [-k|--keep-intermediates] [-f|--follow]\n\n"
+        "With --follow, tracks to process are read from stdin, one per line.\n\n");
 }
 
 int main(int argc, char **argv)
@@ -296,6 +1088,8 @@ int main(int argc, char **argv)
     csc_init(argv[0]);
 
     const char *configFile = NULL;
+    int jobLimit = csc_cpuCount();
+    bool follow = false;
     ARG_NEXT();
     while (argType) {
         ARG(h, help) {
@@ -308,24 +1102,41 @@ int main(int argc, char **argv)
                 configFile = NULL;
         } else ARG(v, verbose) {
             csc_verbose = true;
+        } else ARGN(j, jobs) {
+            ARG_GET();
+            jobLimit = atoi(arg);
+        } else ARG(k, keep-intermediates) {
+            keep = true;
+        } else ARG(f, follow) {
+            follow = true;
         } else {
             usage();
             exit(1);
         }
         ARG_NEXT();
     }
+    if (jobLimit < 1)
+        jobLimit = 1;
 
     csc_configInit(configFile);
     ffmpeg = csc_config("programs.ffmpeg");
     iformat = csc_config("formats.aiformat");
     icodec = csc_config("formats.aicodec");
+    profileStore = csc_absolute(CORD_cat(csc_configDir, CSC_DIRSEP "plip-noise-profiles.bin"));
+    fftwWisdom = csc_absolute(CORD_cat(csc_configDir, CSC_DIRSEP "plip-fftw-wisdom"));
 
+    // When following demux, only sync tracks are already here
     size_t rfi;
-    CORD rawGlob = CORD_cat("*-raw.", iformat);
-    CORD *rawFiles = csc_glob(rawGlob);
+    CORD *rawFiles;
     CORD *syncFiles = csc_glob("*-sync.flac");
+    if (follow) {
+        rawFiles = syncFiles;
+    } else {
+        CORD rawGlob = CORD_cat("*-raw.", iformat);
+        rawFiles = csc_glob(rawGlob);
+    }
 
-    if (syncFiles && syncFiles[0]) {
+    if (!follow && syncFiles && syncFiles[0]) {
         // Combine them into one list
         size_t rfCount, sfCount;
         for (rfCount = 0; rawFiles[rfCount]; rfCount++);
@@ -341,52 +1152,58 @@ int main(int argc, char **argv)
         rawFiles = allFiles;
     }
 
-    // Prepare our thread data
-    CSC_HashTable *threadTable = csc_newHashTable();
+    // Prepare our jobs, two per track
+    struct JobQueue q;
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_cond_init(&q.cond, NULL);
+    q.jobs = NULL;
+    q.jobCt = q.running = 0;
+    q.open = true;
+    q.trackJobs = csc_newHashTable();
+    q.pending = NULL;
+    q.pendingCt = 0;
+    for (rfi = 0; rawFiles[rfi]; rfi++) {
+        struct Track *t = newTrack(rawFiles[rfi]);
+        if (!t || csc_htGet(q.trackJobs, t->base))
+            continue;
+        prepare(t);
+        addTrack(&q, t);
+    }
+    if (!follow)
+        closeTracks(&q);
 
-    // Count the threads
-    for (rfi = 0; rawFiles[rfi]; rfi++);
-    pthread_barrier_t start;
-    pthread_barrier_init(&start, NULL, (unsigned) rfi);
-    pthread_t threads[rfi];
+    if (!planJobs(q.jobs, q.jobCt))
+        return 1;
 
-    // Run the aprocs
-    for (rfi = 0; rawFiles[rfi]; rfi++) {
-        // Figure out the names
-        CORD input = rawFiles[rfi];
-        bool deleteAfter = true;
-        CORD stripRE = csc_casprintf("^(.*)-raw\\.%r$", iformat);
-        CORD *stripStep = csc_match(stripRE, input);
-        if (!stripStep || !stripStep[1]) {
-            deleteAfter = false;
-            stripStep = csc_match("^(.*)-sync\\.flac$", input);
-            if (!stripStep || !stripStep[1])
-                continue;
-        }
-        CORD base = stripStep[1];
-        CORD output = csc_casprintf("%r-proc.%r", base, iformat);
-
-        // Initialize the lock
-        pthread_rwlock_t *wlock = GC_NEW(pthread_rwlock_t);
-        pthread_rwlock_init(wlock, NULL);
-        csc_htAdd(threadTable, base, wlock);
-
-        // And make the thread
-        struct AprocThread *at = GC_NEW(struct AprocThread);
-        at->input = input;
-        at->base = base;
-        at->deleteAfter = deleteAfter;
-        at->start = &start;
-        at->wlock = wlock;
-        at->threadTable = threadTable;
-        if (GC_pthread_create(threads + rfi, NULL, aproc, at) != 0)
+    /* Denoising a track can be split up over time, so share the spare threads
+     * between the denoisers. Tracks we follow come in one at a time, so
+     * there's no telling how many denoisers will share them. */
+    int denoiseCt = 0;
+    for (size_t ji = 0; ji < q.jobCt; ji += 2) {
+        if (q.jobs[ji]->weight > 0)
+            denoiseCt++;
+    }
+    if (!follow && denoiseCt > 0 && jobLimit > denoiseCt)
+        noiserJobs = jobLimit / denoiseCt;
+
+    // Run the jobs
+    if (!follow && jobLimit > (int) q.jobCt)
+        jobLimit = q.jobCt;
+    pthread_t threads[jobLimit > 0 ? jobLimit : 1];
+    for (int wi = 0; wi < jobLimit; wi++) {
+        if (GC_pthread_create(threads + wi, NULL, worker, &q) != 0)
             CRASH("pthread_create");
     }
 
-    // And wait for the threads
-    for (rfi = 0; rawFiles[rfi]; rfi++) {
-        pthread_join(threads[rfi], NULL);
+    // Take more tracks as they come
+    bool ok = true;
+    if (follow)
+        ok = followTracks(&q);
+
+    // And wait for the workers
+    for (int wi = 0; wi < jobLimit; wi++) {
+        pthread_join(threads[wi], NULL);
     }
 
-    return 0;
+    return ok ? 0 : 1;
 }
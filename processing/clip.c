@@ -21,34 +21,21 @@
 #include "buffer.h"
 #include "cscript.h"
 #include "configfile.h"
+#include "probe.h"
 
-static const char *quote = "^[^\"]*\"(.*)\"$";
-static const char *equals = "^[^=]*=(.*)$";
 static CORD ffmpeg = "ffmpeg";
-static CORD ffprobe = "ffprobe";
 static CORD aiformat = "flac";
+static CORD aicodec = "flac";
 
 BUFFER(charp, char *);
 
-// Get the stream info from a file
-CORD streams(CORD inputFile)
-{
-    CORD ret = NULL;
-    csc_runl(CSC_STDOUT, &ret,
-        ffprobe, "-print_format", "flat", "-show_streams", inputFile, NULL);
-    return ret;
-}
-
 // Get the FPS of the first stream (FIXME? Only gives 60 or 30)
-double fps(CORD streams)
+double fps(CSC_Probe *probe)
 {
-    CORD *fps = csc_grep("^streams\\.stream\\.[0-9]*\\.r_frame_rate", streams);
-    if (!fps) return 30;
-    for (size_t fi = 0; fps[fi]; fi++) {
-        if (csc_match("0/0", fps[fi])) continue;
-        fps = csc_match(quote, fps[fi]);
-        if (!fps || !fps[1]) break;
-        if (atof(CORD_to_char_star(fps[1])) >= 40)
+    for (int si = 0; si < probe->nbStreams; si++) {
+        CORD fps = csc_probeStream(probe, si, "r_frame_rate");
+        if (!fps || !CORD_cmp(fps, "0/0")) continue;
+        if (atof(CORD_to_char_star(fps)) >= 40)
             return 60;
         else
             return 30;
@@ -57,29 +44,428 @@ double fps(CORD streams)
 }
 
 // Get the video width from its stream info
-int vwidth(CORD streams)
+int vwidth(CSC_Probe *probe)
 {
-    CORD *w = csc_grep("^streams\\.stream\\.[0-9]*\\.width", streams);
-    if (!w || !w[0]) return 0;
-    w = csc_match(equals, w[0]);
-    if (!w || !w[1]) return 0;
-    return atoi(CORD_to_char_star(w[1]));
+    for (int si = 0; si < probe->nbStreams; si++) {
+        CORD w = csc_probeStream(probe, si, "width");
+        if (w) return atoi(CORD_to_char_star(w));
+    }
+    return 0;
 }
 
 // Get the video height from its stream info
-int vheight(CORD streams)
+int vheight(CSC_Probe *probe)
 {
-    CORD *h = csc_grep("^streams\\.stream\\.[0-9]*\\.height", streams);
-    if (!h || !h[0]) return 0;
-    h = csc_match(equals, h[0]);
-    if (!h || !h[1]) return 0;
-    return atoi(CORD_to_char_star(h[1]));
+    for (int si = 0; si < probe->nbStreams; si++) {
+        CORD h = csc_probeStream(probe, si, "height");
+        if (h) return atoi(CORD_to_char_star(h));
+    }
+    return 0;
 }
 
 // Get the video size (wxh) from its stream info
-CORD vsize(CORD streams)
+CORD vsize(CSC_Probe *probe)
+{
+    return csc_casprintf("%dx%d", vwidth(probe), vheight(probe));
+}
+
+// Write the arguments to encode video in the configured codec
+static void videoCodecArgs(struct Buffer_charp *cl, CORD vcodec, CORD vcrf, CORD vbr, CORD vflags)
+{
+#define W(x) WRITE_ONE_BUFFER(*cl, x)
+    if (!CORD_cmp(vflags, NULL)) {
+        // Default: Just use vcrf and/or vbr, assume -threads and -preset for x264
+        W("-c:v");
+        W(CORD_to_char_star(vcodec));
+        W("-threads");
+        W("0");
+        W("-preset");
+        W("ultrafast");
+        if (CORD_cmp(vcrf, NULL)) {
+            W("-crf");
+            W(CORD_to_char_star(vcrf));
+        } else if (CORD_cmp(vbr, NULL)) {
+            W("-b:v");
+            W(CORD_to_char_star(vbr));
+        }
+    } else {
+        // User-supplied args, split them
+        char *abuf = CORD_to_char_star(vflags);
+        char *lasts = NULL, *cur;
+        cur = strtok_r(abuf, " \t\r\n", &lasts);
+        while (cur) {
+            if (strcmp(cur, ""))
+                W(cur);
+            cur = strtok_r(NULL, " \t\r\n", &lasts);
+        }
+    }
+#undef W
+}
+
+// A kept segment of the input, its speed, and the filter for just that segment
+struct Segment {
+    char *start, *end;
+    double speed; // 1, unless it's fast-forwarded
+    CORD filter;
+};
+
+// Read the segments listed by plip-marktofilter --segments
+static struct Segment *readSegments(CORD list, size_t *count)
+{
+    CORD *lines = csc_lines(list);
+    size_t ct = 0;
+    for (ct = 0; lines[ct]; ct++);
+    struct Segment *segs = GC_MALLOC((ct + 1) * sizeof(struct Segment));
+    *count = 0;
+    for (size_t li = 0; lines[li]; li++) {
+        CORD *parts = csc_match("^(\\S+) (\\S+) (\\S+) (.*)$", lines[li]);
+        if (!parts || !parts[1] || !parts[2] || !parts[3] || !parts[4])
+            continue;
+        segs[*count].start = CORD_to_char_star(parts[1]);
+        segs[*count].end = CORD_to_char_star(parts[2]);
+        segs[*count].speed = atof(CORD_to_char_star(parts[3]));
+        segs[*count].filter = parts[4];
+        (*count)++;
+    }
+    return segs;
+}
+
+/* Run plip-marktofilter on the marks of one restart, with the given
+ * NULL-terminated arguments, plus -l for linear filters, returning its
+ * output */
+static CORD markToFilter(const char *configFile, const char *marksFile,
+    CORD resetNumStr, bool linear, const char *const *args)
+{
+    struct Buffer_charp cl;
+    INIT_BUFFER(cl);
+#define W(x) WRITE_ONE_BUFFER(cl, (char *) (x))
+    W("plip-marktofilter");
+    W("-c");
+    W(configFile);
+    W("-i");
+    W(marksFile);
+    W("-r");
+    W(CORD_to_char_star(resetNumStr));
+    for (size_t ai = 0; args[ai]; ai++)
+        W(args[ai]);
+    if (linear)
+        W("-l");
+    W(NULL);
+#undef W
+
+    CORD out;
+    if (csc_run(CSC_STDOUT, &out, cl.buf) < 0)
+        CRASH("marktofilter");
+    FREE_BUFFER(cl);
+    return out;
+}
+
+/* Join clipped segments with the concat demuxer, with the given codec
+ * arguments, and delete them */
+static void concatSegments(CORD *segFiles, size_t segCt, struct Buffer_charp *codecArgs, CORD out)
+{
+    CORD listFile = csc_casprintf("%r.segments", out);
+    CORD list = NULL;
+    for (size_t si = 0; si < segCt; si++)
+        list = CORD_cat(list, csc_casprintf("file '%r'\n", csc_absolute(segFiles[si])));
+    csc_writeFile(listFile, list);
+
+    struct Buffer_charp cl;
+    INIT_BUFFER(cl);
+#define W(x) WRITE_ONE_BUFFER(cl, x)
+    W(CORD_to_char_star(ffmpeg));
+    W("-nostdin");
+    W("-f");
+    W("concat");
+    W("-safe");
+    W("0");
+    W("-i");
+    W(CORD_to_char_star(listFile));
+    for (size_t ai = 0; ai < codecArgs->bufused; ai++)
+        W(codecArgs->buf[ai]);
+    W(CORD_to_char_star(out));
+    W(NULL);
+#undef W
+    csc_run(0, NULL, cl.buf);
+    FREE_BUFFER(cl);
+
+    for (size_t si = 0; si < segCt; si++)
+        unlink(CORD_to_char_star(segFiles[si]));
+    unlink(CORD_to_char_star(listFile));
+}
+
+/* Clip a track by seeking to each kept segment and encoding just that, so
+ * that nothing between the segments is decoded. Each segment's filter, then
+ * filterSuffix, is run on the mapFrom stream; encodeArgs says how to encode
+ * each segment, and concatArgs how to encode the joined result. */
+static void clipSegments(CORD input, struct Segment *segs, size_t segCt,
+    CORD mapFrom, CORD filterSuffix, struct Buffer_charp *encodeArgs,
+    CORD segFormat, struct Buffer_charp *concatArgs, CORD out)
+{
+    CORD *segFiles = GC_MALLOC(segCt * sizeof(CORD));
+    for (size_t si = 0; si < segCt; si++) {
+        segFiles[si] = csc_casprintf("%r-seg%d.%r", out, (int) si, segFormat);
+
+        struct Buffer_charp cl;
+        INIT_BUFFER(cl);
+#define W(x) WRITE_ONE_BUFFER(cl, x)
+        W(CORD_to_char_star(ffmpeg));
+        W("-nostdin");
+        // Mark times are timestamps, as -copyts keeps them, not offsets from start_time
+        W("-seek_timestamp");
+        W("1");
+        W("-ss");
+        W(segs[si].start);
+        W("-to");
+        W(segs[si].end);
+        W("-i");
+        W(CORD_to_char_star(input));
+        W("-filter_complex");
+        W(CORD_to_char_star(csc_casprintf("[%r]%r%r[seg]", mapFrom,
+            segs[si].filter, filterSuffix)));
+        W("-map");
+        W("[seg]");
+        for (size_t ai = 0; ai < encodeArgs->bufused; ai++)
+            W(encodeArgs->buf[ai]);
+        W("-y");
+        W(CORD_to_char_star(segFiles[si]));
+        W(NULL);
+#undef W
+        csc_run(0, NULL, cl.buf);
+        FREE_BUFFER(cl);
+    }
+
+    concatSegments(segFiles, segCt, concatArgs, out);
+}
+
+// The encoder to re-encode part of a stream of the given codec with, if any
+static const char *smartEncoder(CORD codec)
+{
+    if (!CORD_cmp(codec, "h264"))
+        return "libx264";
+    else if (!CORD_cmp(codec, "hevc"))
+        return "libx265";
+    return NULL;
+}
+
+// The video encoder named in encoding arguments, if any
+static const char *argsEncoder(struct Buffer_charp *args)
+{
+    const char *encoder = NULL;
+    for (size_t ai = 0; ai + 1 < args->bufused; ai++) {
+        if (!strcmp(args->buf[ai], "-c:v") || !strcmp(args->buf[ai], "-vcodec") ||
+            !strcmp(args->buf[ai], "-codec:v"))
+            encoder = args->buf[ai + 1];
+    }
+    return encoder;
+}
+
+// Whether a stream smartEncoder supports can be copied into the given format
+static bool smartContainer(CORD format)
+{
+    static const char *formats[] = {
+        "mkv", "mp4", "mov", "m4v", "ts", "m2ts", "mts", NULL
+    };
+    for (int fi = 0; formats[fi]; fi++) {
+        if (!CORD_cmp(format, formats[fi]))
+            return true;
+    }
+    return false;
+}
+
+/* The encoder's name for a stream's profile, as ffprobe names it, or NULL if
+ * the encoder can't make it */
+static char *smartProfile(CORD profile)
+{
+    static const char *profiles[][2] = {
+        // h264
+        {"Constrained Baseline", "baseline"},
+        {"Baseline", "baseline"},
+        {"Main", "main"},
+        {"High", "high"},
+        {"High 10", "high10"},
+        {"High 4:2:2", "high422"},
+        {"High 4:4:4 Predictive", "high444"},
+        // hevc
+        {"Main 10", "main10"},
+        {"Main Still Picture", "mainstillpicture"},
+        {NULL, NULL}
+    };
+    for (int pi = 0; profiles[pi][0]; pi++) {
+        if (!CORD_cmp(profile, profiles[pi][0]))
+            return (char *) profiles[pi][1];
+    }
+    return NULL;
+}
+
+/* Add the source's profile and level to the encoding arguments, so that the
+ * re-encoded pieces are decodable with the copied ones' parameters. Returns
+ * false if they can't be matched. */
+static bool smartProfileArgs(struct Buffer_charp *args, const char *encoder,
+    CSC_Probe *probe, int trackNum)
+{
+    char *profile = smartProfile(csc_probeStream(probe, trackNum, "profile"));
+    CORD levelStr = csc_probeStream(probe, trackNum, "level");
+    int level = levelStr ? atoi(CORD_to_char_star(levelStr)) : 0;
+    if (!profile || level <= 0)
+        return false;
+    WRITE_ONE_BUFFER(*args, "-profile:v");
+    WRITE_ONE_BUFFER(*args, profile);
+
+    if (!strcmp(encoder, "libx264")) {
+        // ffprobe gives h264 levels as ten times the level
+        WRITE_ONE_BUFFER(*args, "-level:v");
+        WRITE_ONE_BUFFER(*args, csc_asprintf("%d.%d", level / 10, level % 10));
+        return true;
+    }
+
+    // ...and hevc levels as thirty times, which x265 only takes in its own params
+    char *levelParam = csc_asprintf("level-idc=%d.%d", level / 30, (level % 30) / 3);
+    for (size_t ai = 0; ai + 1 < args->bufused; ai++) {
+        if (!strcmp(args->buf[ai], "-x265-params")) {
+            args->buf[ai + 1] = csc_asprintf("%s:%s", levelParam, args->buf[ai + 1]);
+            return true;
+        }
+    }
+    WRITE_ONE_BUFFER(*args, "-x265-params");
+    WRITE_ONE_BUFFER(*args, levelParam);
+    return true;
+}
+
+// Clip one piece of a smart-rendered stream, with the given codec arguments
+static CORD smartPiece(CORD input, CORD trackMap, double start, double end,
+    struct Buffer_charp *codecArgs, CORD out, int pieceNum)
+{
+    CORD piece = csc_casprintf("%r-smart%d.ts", out, pieceNum);
+
+    struct Buffer_charp cl;
+    INIT_BUFFER(cl);
+#define W(x) WRITE_ONE_BUFFER(cl, x)
+    W(CORD_to_char_star(ffmpeg));
+    W("-nostdin");
+    // Marks and keyframes are both timestamps, not offsets from start_time
+    W("-seek_timestamp");
+    W("1");
+    W("-ss");
+    W(csc_asprintf("%f", start));
+    W("-to");
+    W(csc_asprintf("%f", end));
+    W("-i");
+    W(CORD_to_char_star(input));
+    W("-map");
+    W(CORD_to_char_star(trackMap));
+    for (size_t ai = 0; ai < codecArgs->bufused; ai++)
+        W(codecArgs->buf[ai]);
+    W("-y");
+    W(CORD_to_char_star(piece));
+    W(NULL);
+#undef W
+    csc_run(0, NULL, cl.buf);
+    FREE_BUFFER(cl);
+
+    return piece;
+}
+
+/* Smart-render a video stream: of each kept segment, only the partial GOPs at
+ * its ends are re-encoded, and the whole GOPs between are copied unchanged.
+ * The pieces are MPEG-TS, so that each carries its own codec parameters, and
+ * are then joined into the output. The ends are encoded as configured, so the
+ * source must already be in the configured codec, and they match the source's
+ * profile and level, so that a decoder set up by the output's first parameters
+ * can decode them all. Returns false, having done nothing, if the stream can't
+ * be smart-rendered, in which case it must be fully encoded. */
+static bool smartRender(CORD trackBase, CORD input, CSC_Probe *probe, int trackNum,
+    struct Segment *segs, size_t segCt, CORD vcodec, CORD vcrf, CORD vbr, CORD vflags,
+    CORD vformat, CORD out)
 {
-    return csc_casprintf("%dx%d", vwidth(streams), vheight(streams));
+    // We can only re-encode the ends in the same codec as the rest
+    const char *encoder = smartEncoder(csc_probeStream(probe, trackNum, "codec_name"));
+    if (!encoder || !segCt || !smartContainer(vformat))
+        return false;
+
+    // Fast-forwards are entirely re-encoded
+    for (size_t si = 0; si < segCt; si++) {
+        if (segs[si].speed != 1)
+            return false;
+    }
+
+    // And that codec must be the one we're configured to make
+    struct Buffer_charp encodeArgs, copyArgs;
+    INIT_BUFFER(encodeArgs);
+    videoCodecArgs(&encodeArgs, vcodec, vcrf, vbr, vflags);
+    const char *configured = argsEncoder(&encodeArgs);
+    if (!configured || strcmp(configured, encoder) ||
+        !smartProfileArgs(&encodeArgs, encoder, probe, trackNum)) {
+        FREE_BUFFER(encodeArgs);
+        return false;
+    }
+
+    size_t kfCt;
+    double *keyframes = csc_probeKeyframes(input, trackNum, &kfCt);
+    if (!kfCt) {
+        FREE_BUFFER(encodeArgs);
+        return false;
+    }
+
+    CORD_fprintf(stderr, "^PLIP: Clipping video track %r (%r) by smart rendering.\n", trackBase, out);
+    CORD trackMap = csc_casprintf("0:%d", trackNum);
+
+    // Re-encode like the source, so that the pieces can be joined
+    CORD pixFmt = csc_probeStream(probe, trackNum, "pix_fmt");
+    if (pixFmt) {
+        WRITE_ONE_BUFFER(encodeArgs, "-pix_fmt");
+        WRITE_ONE_BUFFER(encodeArgs, CORD_to_char_star(pixFmt));
+    }
+    INIT_BUFFER(copyArgs);
+    WRITE_ONE_BUFFER(copyArgs, "-c");
+    WRITE_ONE_BUFFER(copyArgs, "copy");
+
+    /* Times are only as precise as ffprobe and ffmpeg print them, so stay
+     * this far clear of the keyframes when cutting to them */
+    const double margin = 0.0005;
+
+    // Each segment makes at most three pieces
+    CORD *pieces = GC_MALLOC(segCt * 3 * sizeof(CORD));
+    size_t pieceCt = 0, ki = 0;
+    for (size_t si = 0; si < segCt; si++) {
+        double start = atof(segs[si].start), end = atof(segs[si].end);
+
+        // Find the first keyframe in the segment, and the last
+        while (ki < kfCt && keyframes[ki] < start - margin)
+            ki++;
+        size_t first = ki, last = ki;
+        while (last + 1 < kfCt && keyframes[last + 1] <= end)
+            last++;
+
+        if (first < kfCt && last > first) {
+            if (keyframes[first] - start > margin) {
+                pieces[pieceCt] = smartPiece(input, trackMap, start, keyframes[first] - margin,
+                    &encodeArgs, out, pieceCt);
+                pieceCt++;
+            }
+            pieces[pieceCt] = smartPiece(input, trackMap, keyframes[first] + margin, keyframes[last] - margin,
+                &copyArgs, out, pieceCt);
+            pieceCt++;
+            if (end - keyframes[last] > margin) {
+                pieces[pieceCt] = smartPiece(input, trackMap, keyframes[last], end,
+                    &encodeArgs, out, pieceCt);
+                pieceCt++;
+            }
+
+        } else {
+            // No whole GOP to copy
+            pieces[pieceCt] = smartPiece(input, trackMap, start, end,
+                &encodeArgs, out, pieceCt);
+            pieceCt++;
+
+        }
+    }
+
+    concatSegments(pieces, pieceCt, &copyArgs, out);
+
+    FREE_BUFFER(encodeArgs);
+    FREE_BUFFER(copyArgs);
+    return true;
 }
 
 void usage()
@@ -88,13 +474,18 @@ void usage()
         "Use: plip-clip [-v] [-c] [-C|--config <config file>] [-i] <input file> [[-m] <marks file>]\n"
         "Options:\n"
         "\t-v|--verbose: Verbose mode\n"
-        "\t-c|--cleanup: Clean up clipped files instead of clipping.\n\n");
+        "\t-c|--cleanup: Clean up clipped files instead of clipping.\n"
+        "\t--video-only: Only clip video tracks.\n"
+        "\t--audio-only: Only clip audio tracks.\n"
+        "\t--track <track>: Only clip the named track.\n\n");
 }
 
 int main(int argc, char **argv)
 {
     ARG_VARS;
     bool cleanup = false;
+    bool doVideo = true, doAudio = true;
+    CORD onlyTrack = NULL;
 
     csc_init(argv[0]);
 
@@ -108,6 +499,13 @@ int main(int argc, char **argv)
             csc_verbose = true;
         } else ARG(c, cleanup) {
             cleanup = true;
+        } else ARG(V, video-only) {
+            doAudio = false;
+        } else ARG(A, audio-only) {
+            doVideo = false;
+        } else ARGN(t, track) {
+            ARG_GET();
+            onlyTrack = arg;
         } else ARGN(i, input-file) {
             ARG_GET();
             inputFile = arg;
@@ -138,8 +536,11 @@ int main(int argc, char **argv)
     csc_configInit(configFile);
     if (!configFile) configFile = "-";
     ffmpeg = csc_config("programs.ffmpeg");
-    ffprobe = csc_config("programs.ffprobe");
     aiformat = csc_config("formats.aiformat");
+    aicodec = csc_config("formats.aicodec");
+    bool seekMode = !CORD_cmp(csc_config("steps.clipmode"), "seek");
+    bool smartMode = !CORD_cmp(csc_config("steps.clipmode"), "smart");
+    bool linear = !CORD_cmp(csc_config("steps.clipmode"), "select");
 
     if (inputFile && !marksFile) {
         // Try modifying the input file name into a marks file name
@@ -165,48 +566,63 @@ int main(int argc, char **argv)
         CRASH("marktofilter");
     int resetCount = atoi(CORD_to_char_star(resetCountStr));
 
+    // Only probe the input if we actually have video to clip
+    CSC_Probe *probe = NULL;
+
     for (int resetNum = 0; resetNum <= resetCount; resetNum++) {
         CORD resetSuffix = NULL;
         CORD resetNumStr = csc_casprintf("%d", resetNum + 1);
         if (resetCount > 0)
             resetSuffix = resetNumStr;
 
-        // Make our human-readable marks file
-        CORD marksOut = csc_casprintf("marks%r.txt", resetSuffix);
-        csc_runl(0, NULL,
-            "plip-marktofilter", "-c", configFile, "-i", marksFile, "-r", resetNumStr, "-o", marksOut, NULL);
+        /* Make our human-readable marks file (audio-only runs are part of a
+         * larger run, so leave that to the video) */
+        if (doVideo) {
+            CORD marksOut = csc_casprintf("marks%r.txt", resetSuffix);
+            csc_runl(0, NULL,
+                "plip-marktofilter", "-c", configFile, "-i", marksFile, "-r", resetNumStr, "-o", marksOut, NULL);
+        }
 
         // And our not-so-human-readable mark filters
-        CORD video30Marks;
-        if (csc_runl(CSC_STDOUT, &video30Marks,
-            "plip-marktofilter", "-c", configFile, "-i", marksFile, "-r", resetNumStr, "-v", "vid", NULL) < 0)
-            CRASH("marktofilter");
-        CORD video60Marks;
-        if (csc_runl(CSC_STDOUT, &video60Marks,
-            "plip-marktofilter", "-c", configFile, "-i", marksFile, "-r", resetNumStr, "--fps", "60", "-v", "vid", NULL) < 0)
-            CRASH("marktofilter");
-        CORD audioMarks;
-        if (csc_runl(CSC_STDOUT, &audioMarks,
-            "plip-marktofilter", "-c", configFile, "-i", marksFile, "-r", resetNumStr, "-a", "0:a", NULL) < 0)
-            CRASH("marktofilter");
-        CORD voiceMarks;
-        if (csc_runl(CSC_STDOUT, &voiceMarks,
-            "plip-marktofilter", "-c", configFile, "-i", marksFile, "-r", resetNumStr, "-a", "0:a", "-k", NULL) < 0)
-            CRASH("marktofilter");
-        CORD discardMarks;
-        if (csc_runl(CSC_STDOUT, &discardMarks,
-            "plip-marktofilter", "-c", configFile, "-i", marksFile, "-r", resetNumStr, "-a", "0:a", "--audio-discard", NULL) < 0)
-            CRASH("marktofilter");
+        CORD video30Marks = markToFilter(configFile, marksFile, resetNumStr, linear,
+            (const char *[]) {"-v", "vid", NULL});
+        CORD video60Marks = markToFilter(configFile, marksFile, resetNumStr, linear,
+            (const char *[]) {"--fps", "60", "-v", "vid", NULL});
+        CORD audioMarks = markToFilter(configFile, marksFile, resetNumStr, linear,
+            (const char *[]) {"-a", "0:a", NULL});
+        CORD voiceMarks = markToFilter(configFile, marksFile, resetNumStr, linear,
+            (const char *[]) {"-a", "0:a", "-k", NULL});
+        CORD discardMarks = markToFilter(configFile, marksFile, resetNumStr, linear,
+            (const char *[]) {"-a", "0:a", "--audio-discard", NULL});
+
+        // In seek and smart mode, the same as lists of segments
+        size_t video30SegCt = 0, video60SegCt = 0, audioSegCt = 0, voiceSegCt = 0, discardSegCt = 0;
+        struct Segment *video30Segs = NULL, *video60Segs = NULL, *audioSegs = NULL, *voiceSegs = NULL, *discardSegs = NULL;
+        if (seekMode || smartMode) {
+            video30Segs = readSegments(markToFilter(configFile, marksFile, resetNumStr, false,
+                (const char *[]) {"-s", "-v", "vid", NULL}), &video30SegCt);
+            video60Segs = readSegments(markToFilter(configFile, marksFile, resetNumStr, false,
+                (const char *[]) {"--fps", "60", "-s", "-v", "vid", NULL}), &video60SegCt);
+        }
+        if (seekMode) {
+            audioSegs = readSegments(markToFilter(configFile, marksFile, resetNumStr, false,
+                (const char *[]) {"-s", "-a", "0:a", NULL}), &audioSegCt);
+            voiceSegs = readSegments(markToFilter(configFile, marksFile, resetNumStr, false,
+                (const char *[]) {"-s", "-a", "0:a", "-k", NULL}), &voiceSegCt);
+            discardSegs = readSegments(markToFilter(configFile, marksFile, resetNumStr, false,
+                (const char *[]) {"-s", "-a", "0:a", "--audio-discard", NULL}), &discardSegCt);
+        }
 
         // Process the video tracks
-        CORD *vidTracks = csc_glob("*.track");
-        for (size_t vi = 0; vidTracks[vi]; vi++) {
+        CORD *vidTracks = doVideo ? csc_glob("*.track") : NULL;
+        for (size_t vi = 0; vidTracks && vidTracks[vi]; vi++) {
             CORD vidTrack = vidTracks[vi];
 
             // Get the base
             CORD *trackParts = csc_match("^(.*)\\.track$", vidTrack);
             if (!trackParts || !trackParts[1]) continue;
             CORD trackBase = trackParts[1];
+            if (onlyTrack && CORD_cmp(trackBase, onlyTrack)) continue;
 
             // Choose our contextual format info
             CORD vformat = csc_configRead(csc_configTree, "formats.vformat", vidTrack, NULL);
@@ -234,14 +650,18 @@ int main(int argc, char **argv)
             }
 
             // Figure out the FPS (FIXME: Multiple video streams)
-            CORD vStreams = streams(inputFile);
-            int vFps = fps(vStreams);
+            if (!probe)
+                probe = csc_probe(inputFile);
+            int vFps = fps(probe);
 
             // If we need to, deinterlace
             CORD iFilters = "null";
             if (csc_match("iv$", trackBase))
                 iFilters = "yadif=mode=send_field_nospatial:parity=tff,mcdeint=parity=tff";
 
+            // And get any extra filters
+            CORD exFilters = csc_configRead(csc_configTree, "filters.video", trackBase, NULL);
+
             // If we're bypassing normal video processing, call a script
             CORD videoBypass = csc_configRead(csc_configTree, "steps.videobypass", trackBase, NULL);
             if (videoBypass) {
@@ -252,10 +672,32 @@ int main(int argc, char **argv)
                     trackOut,
                     NULL);
 
-            } else {
-                // And get any extra filters
-                CORD exFilters = csc_configRead(csc_configTree, "filters.video", trackBase, NULL);
+            } else if (smartMode && !CORD_cmp(iFilters, "null") && !CORD_cmp(exFilters, "null") &&
+                smartRender(trackBase, inputFile, probe, trackNum,
+                    (vFps==60)?video60Segs:video30Segs, (vFps==60)?video60SegCt:video30SegCt,
+                    vcodec, vcrf, vbr, vflags, vformat, trackOut)) {
+                // Smart rendered, nothing more to do
+
+            } else if (seekMode && ((vFps==60)?video60SegCt:video30SegCt)) {
+                /* Encode each segment as we would the whole, so that they can
+                 * simply be joined */
+                struct Buffer_charp encodeArgs, concatArgs;
+                INIT_BUFFER(encodeArgs);
+                videoCodecArgs(&encodeArgs, vcodec, vcrf, vbr, vflags);
+                INIT_BUFFER(concatArgs);
+                WRITE_ONE_BUFFER(concatArgs, "-c");
+                WRITE_ONE_BUFFER(concatArgs, "copy");
+
+                CORD_fprintf(stderr, "^PLIP: Clipping video track %r (%r) by segments.\n", trackBase, trackOut);
+                clipSegments(inputFile,
+                    (vFps==60)?video60Segs:video30Segs, (vFps==60)?video60SegCt:video30SegCt,
+                    trackMap, csc_casprintf(",%r,%r", iFilters, exFilters),
+                    &encodeArgs, vformat, &concatArgs, trackOut);
+
+                FREE_BUFFER(encodeArgs);
+                FREE_BUFFER(concatArgs);
 
+            } else {
                 // Make the command line
                 struct Buffer_charp cl;
                 INIT_BUFFER(cl);
@@ -271,32 +713,7 @@ int main(int argc, char **argv)
                 ));
                 W("-map");
                 W("[vid]");
-                if (!CORD_cmp(vflags, NULL)) {
-                    // Default: Just use vcrf and/or vbr, assume -threads and -preset for x264
-                    W("-c:v");
-                    W(CORD_to_char_star(vcodec));
-                    W("-threads");
-                    W("0");
-                    W("-preset");
-                    W("ultrafast");
-                    if (CORD_cmp(vcrf, NULL)) {
-                        W("-crf");
-                        W(CORD_to_char_star(vcrf));
-                    } else if (CORD_cmp(vbr, NULL)) {
-                        W("-b:v");
-                        W(CORD_to_char_star(vbr));
-                    }
-                } else {
-                    // User-supplied args, split them
-                    char *abuf = CORD_to_char_star(vflags);
-                    char *lasts = NULL, *cur;
-                    cur = strtok_r(abuf, " \t\r\n", &lasts);
-                    while (cur) {
-                        if (strcmp(cur, ""))
-                            W(cur);
-                        cur = strtok_r(NULL, " \t\r\n", &lasts);
-                    }
-                }
+                videoCodecArgs(&cl, vcodec, vcrf, vbr, vflags);
                 W(CORD_to_char_star(trackOut));
                 W(NULL);
 #undef W
@@ -311,8 +728,8 @@ int main(int argc, char **argv)
 
         // Clip all the audio files
         CORD audioGlob = csc_casprintf("*-proc.%r", aiformat);
-        CORD *audioFiles = csc_glob(audioGlob);
-        for (size_t ai = 0; audioFiles[ai]; ai++) {
+        CORD *audioFiles = doAudio ? csc_glob(audioGlob) : NULL;
+        for (size_t ai = 0; audioFiles && audioFiles[ai]; ai++) {
             CORD audioFile = audioFiles[ai];
 
             // Skip our noise files
@@ -323,14 +740,22 @@ int main(int argc, char **argv)
             CORD *audioParts = csc_match(audioRE, audioFile);
             if (!audioParts || !audioParts[1]) continue;
             CORD audioBase = audioParts[1];
+            if (onlyTrack && CORD_cmp(audioBase, onlyTrack)) continue;
 
             // Figure out which marks to use
             CORD marks = audioMarks;
+            struct Segment *segs = audioSegs;
+            size_t segCt = audioSegCt;
             CORD markSet = csc_configRead(csc_configTree, "filters.ffclip", audioBase, NULL);
-            if (!CORD_cmp(markSet, "keep"))
+            if (!CORD_cmp(markSet, "keep")) {
                 marks = voiceMarks;
-            else if (!CORD_cmp(markSet, "discard"))
+                segs = voiceSegs;
+                segCt = voiceSegCt;
+            } else if (!CORD_cmp(markSet, "discard")) {
                 marks = discardMarks;
+                segs = discardSegs;
+                segCt = discardSegCt;
+            }
 
             // Figure out the audio format and codec to use
             CORD aformat = csc_configRead(csc_configTree, "formats.aformat", audioBase, NULL);
@@ -353,6 +778,29 @@ int main(int argc, char **argv)
                 continue;
             }
 
+            // In seek mode, clip losslessly by segments, then encode the whole
+            if (seekMode && segCt) {
+                struct Buffer_charp encodeArgs, concatArgs;
+                INIT_BUFFER(encodeArgs);
+                WRITE_ONE_BUFFER(encodeArgs, "-c:a");
+                WRITE_ONE_BUFFER(encodeArgs, CORD_to_char_star(aicodec));
+                INIT_BUFFER(concatArgs);
+                WRITE_ONE_BUFFER(concatArgs, "-c:a");
+                WRITE_ONE_BUFFER(concatArgs, CORD_to_char_star(acodec));
+                if (CORD_cmp(abr, NULL)) {
+                    WRITE_ONE_BUFFER(concatArgs, "-b:a");
+                    WRITE_ONE_BUFFER(concatArgs, CORD_to_char_star(abr));
+                }
+
+                CORD_fprintf(stderr, "^PLIP: Clipping audio track %r (%r) by segments.\n", audioBase, audioOut);
+                clipSegments(audioFile, segs, segCt, "0:a", NULL,
+                    &encodeArgs, aiformat, &concatArgs, audioOut);
+
+                FREE_BUFFER(encodeArgs);
+                FREE_BUFFER(concatArgs);
+                continue;
+            }
+
             // Make the arguments
             struct Buffer_charp args;
             INIT_BUFFER(args);
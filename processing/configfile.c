@@ -47,6 +47,9 @@ static bool isid(char c)
 // Our main configuration
 CSC_Config *csc_configTree;
 
+// And the directory it's (mostly) from
+CORD csc_configDir = ".";
+
 // Extend a config with a specified file
 void csc_extendConfig(CSC_Config *config, CORD file)
 {
@@ -228,8 +231,22 @@ void csc_configInit(const char *configFile)
         csc_configTree = csc_newHashTable();
         csc_extendConfig(csc_configTree, NULL);
         csc_extendConfig(csc_configTree, configFile);
+        csc_configDir = csc_dirname(configFile);
+        if (!CORD_cmp(csc_configDir, configFile))
+            csc_configDir = "."; // No directory part
     } else {
         csc_configTree = csc_loadConfig(".", "plip.ini", true);
+
+        // Find the outermost directory with a configuration file
+        for (size_t ri = 1; ri < MAX_CONFIG_DEPTH; ri++) {
+            CORD cur = ".";
+            for (size_t rpi = ri+1; rpi < MAX_CONFIG_DEPTH; rpi++)
+                cur = CORD_cat(cur, CORD_cat(CSC_DIRSEP, ".."));
+            if (csc_fileExists(CORD_cat(cur, CORD_cat(CSC_DIRSEP, "plip.ini")))) {
+                csc_configDir = cur;
+                break;
+            }
+        }
     }
 }
 
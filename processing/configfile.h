@@ -26,6 +26,10 @@ typedef CSC_HashTable CSC_Config;
 // The main configuration
 extern struct CSC_HashTable_ *csc_configTree;
 
+/* The directory of the outermost configuration file loaded, for anything kept
+ * alongside the configuration */
+extern CORD csc_configDir;
+
 // Load main configuration
 void csc_configInit(const char *configFile);
 
@@ -56,13 +56,23 @@ static const char defConfig[] =
 
 // steps to perform in processing
 "\n[steps]\n"
+"demux=single\n"
+"dualmono=y\n"
+"skipsilent=y\n"
+"silentlevel=-70\n" // dBFS RMS of a track's loudest 100ms
 "noiser=noiserepellent\n"
 "noiserlearn=y\n"
+"noiserprofileage=7\n" // days to reuse a learned noise profile
+"noisertier=best\n"
 "aproc=2\n"
 
 // Don't bypass normal video processing
 "videobypass=\n"
 
+// Clip by filtering the whole input (filter or select), by seeking to each
+// kept segment (seek), or by copying video between keyframes (smart)
+"clipmode=filter\n"
+
 // Track info, currently only which are included
 "\n[tracks]\n"
 "include=y\n" // include all tracks by default
@@ -17,38 +17,25 @@
 #define GC_THREADS 1
 #define _POSIX_SOURCE 1
 
+#include <math.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "arg.h"
+#include "buffer.h"
 #include "cscript.h"
 #include "configfile.h"
+#include "envelope.h"
+#include "probe.h"
 
-static const CORD quote = "^[^\"]*\"(.*)\"$";
-static const CORD equals = "^[^=]*=(.*)$";
 static CORD ffmpeg = "ffmpeg";
-static CORD ffprobe = "ffprobe";
 static CORD iformat = "flac";
 static CORD icodec = "flac";
 
-// Get the codec type of a file
-CORD codecType(CORD streams, int idx)
-{
-    CORD *codec_type = csc_grep(csc_casprintf("^streams\\.stream\\.%d\\.codec_type", idx), streams);
-    if (!codec_type || !codec_type[0]) return CORD_EMPTY;
-    codec_type = csc_match(quote, codec_type[0]);
-    if (!codec_type || !codec_type[1]) return CORD_EMPTY;
-    return codec_type[1];
-}
-
-CORD title(CORD streams, int idx)
-{
-    CORD *title = csc_grep(csc_casprintf("^streams\\.stream\\.%d\\.tags\\.title", idx), streams);
-    if (!title || !title[0]) return CORD_EMPTY;
-    title = csc_match(quote, title[0]);
-    if (!title || !title[1]) return CORD_EMPTY;
-    return title[1];
-}
+BUFFER(charp, char *);
 
 // Fix an audio track's title
 void fixTitle(int *others, CORD *title)
@@ -59,19 +46,180 @@ void fixTitle(int *others, CORD *title)
     }
 }
 
-// Extract an audio track
-void audio(const char *inputFile, int trackno, CORD title)
+// Does this audio track still need to be extracted?
+bool audioNeeded(CORD title)
 {
-    CORD rawFlac, outName, procName;
-    CORD_sprintf(&rawFlac, "%r-raw.flac", title); // Will need to use a different iformat than flac for this to be useful
+    CORD outName, procName;
     CORD_sprintf(&outName, "%r-raw.%r", title, iformat);
     CORD_sprintf(&procName, "%r-proc.%r", title, iformat);
 
     if (csc_fileExists(outName) || csc_fileExists(procName)) {
         // Already exists!
         CORD_fprintf(stderr, "^PLIP: %r already demuxed and/or processed.\n", title);
+        return false;
+    }
+
+    return true;
+}
+
+// What a scan of an extracted track found
+struct TrackScan {
+    bool dualMono; // both channels are the same
+    bool active; // some block is louder than the silence threshold
+    double loudest; // RMS of the loudest block read, in dBFS
+    CSC_Envelope *env; // of the track, if it could be read
+};
+
+/* Scan an extracted stereo track for identical channels and for activity, in
+ * 100ms blocks, and make its envelope, so that later steps needn't decode it
+ * again just to find its levels */
+static struct TrackScan scanTrack(CORD file, bool checkDualMono, double threshold)
+{
+#define BLOCK 4800
+    struct TrackScan scan = {checkDualMono, threshold <= -INFINITY, -INFINITY, NULL};
+
+    int fd = csc_runpl(-1, CSC_STDOUT,
+        ffmpeg, "-nostdin", "-i", CORD_to_char_star(file),
+        "-f", "f32le", "-ac", "2", "-ar", "48000", "-", NULL);
+    if (fd < 0) {
+        scan.dualMono = false;
+        scan.active = true;
+        return scan;
+    }
+
+    // Threshold on the mean square, to avoid a log per block
+    double limit = pow(10, threshold / 10);
+    float *buf = GC_MALLOC_ATOMIC(BLOCK * 2 * sizeof(float));
+    size_t used = 0, frames = 0;
+    double loudest = 0;
+    ssize_t rd;
+    CSC_Envelope *env = csc_envelopeNew(48000, 2);
+    while ((rd = read(fd, (char *) buf + used, BLOCK * 2 * sizeof(float) - used)) > 0) {
+        used += rd;
+        if (used < BLOCK * 2 * sizeof(float))
+            continue;
+        csc_envelopeAdd(env, buf, BLOCK);
+        // Compare bit for bit, a frame (two samples) at a time
+        uint32_t *ibuf = (uint32_t *) buf;
+        for (size_t fi = 0; scan.dualMono && fi < BLOCK; fi++) {
+            if (ibuf[fi*2] != ibuf[fi*2+1])
+                scan.dualMono = false;
+        }
+        double sum = 0;
+        for (size_t si = 0; si < BLOCK * 2; si++)
+            sum += (double) buf[si] * buf[si];
+        sum /= BLOCK * 2;
+        if (sum > loudest)
+            loudest = sum;
+        if (loudest >= limit)
+            scan.active = true;
+        frames += BLOCK;
+        used = 0;
+    }
+    close(fd);
+
+    // The last, partial block
+    size_t ct = used / (2 * sizeof(float));
+    if (ct) {
+        double sum = 0;
+        csc_envelopeAdd(env, buf, ct);
+        for (size_t fi = 0; fi < ct; fi++) {
+            if (((uint32_t *) buf)[fi*2] != ((uint32_t *) buf)[fi*2+1])
+                scan.dualMono = false;
+            sum += (double) buf[fi*2] * buf[fi*2] + (double) buf[fi*2+1] * buf[fi*2+1];
+        }
+        sum /= ct * 2;
+        if (sum > loudest)
+            loudest = sum;
+        if (loudest >= limit)
+            scan.active = true;
+        frames += ct;
+    }
+
+    if (!frames)
+        scan.dualMono = false;
+    scan.loudest = 10 * log10(loudest);
+
+    csc_envelopeFinish(env);
+    scan.env = env;
+    return scan;
+#undef BLOCK
+}
+
+/* Write an extracted track's envelope, once the track won't change, since the
+ * envelope records its size and modification time */
+static void writeEnvelope(CORD rawName, struct TrackScan *scan)
+{
+    if (!scan->env)
+        return;
+    csc_envelopeWrite(scan->env,
+        CORD_to_char_star(CORD_cat(rawName, CSC_ENVELOPE_SUFFIX)),
+        CORD_to_char_star(rawName));
+    csc_envelopeFree(scan->env);
+    scan->env = NULL;
+}
+
+/* Check an extracted track. If it's silent, flag it with a .silent sidecar, so
+ * that plip-aproc doesn't bother processing it. If it's dual mono, replace it
+ * with one channel, so that processing does half the work. plip-aproc
+ * duplicates it back to stereo. */
+static void checkTrack(CORD title)
+{
+    CORD rawName = csc_casprintf("%r-raw.%r", title, iformat);
+    CORD monoName = csc_casprintf("%r-mono.%r", title, iformat);
+    double threshold = -INFINITY;
+    if (csc_configBool(csc_configTree, "steps.skipsilent", title))
+        threshold = csc_configDouble(csc_configTree, "steps.silentlevel", title);
+
+    struct TrackScan scan = scanTrack(rawName,
+        csc_configBool(csc_configTree, "steps.dualmono", title), threshold);
+
+    if (!scan.active) {
+        CORD_fprintf(stderr, "^PLIP: %r is silent (loudest %s dBFS), skipping its processing.\n",
+            title, csc_asprintf("%.1f", scan.loudest));
+        csc_writeFile(csc_casprintf("%r.silent", rawName),
+            csc_casprintf("%s\n", csc_asprintf("%f", scan.loudest)));
+        writeEnvelope(rawName, &scan);
+        return;
+    }
+
+    if (!scan.dualMono) {
+        writeEnvelope(rawName, &scan);
+        return;
+    }
+
+    CORD_fprintf(stderr, "^PLIP: %r is dual mono, keeping one channel.\n", title);
+    if (csc_runl(0, NULL,
+            ffmpeg, "-nostdin", "-i", CORD_to_char_star(rawName),
+            "-af", "pan=mono|c0=c0", "-c:a", CORD_to_char_star(icodec),
+            "-y", CORD_to_char_star(monoName), NULL) != 0 ||
+        !csc_fileExists(monoName)) {
+        unlink(CORD_to_char_star(monoName));
+        writeEnvelope(rawName, &scan);
         return;
     }
+#ifdef _WIN32
+    unlink(CORD_to_char_star(rawName));
+#endif
+    rename(CORD_to_char_star(monoName), CORD_to_char_star(rawName));
+
+    // Its channels were the same, so the stereo envelope still describes it
+    writeEnvelope(rawName, &scan);
+}
+
+/* Say that an audio track is ready to process, as plip's pipelined mode waits
+ * for. The whole line is written at once, since tracks finish in threads. */
+static void trackDemuxed(CORD title)
+{
+    fprintf(stderr, "^PLIP: Audio track %s demuxed\n", CORD_to_char_star(title));
+}
+
+// Extract an audio track
+void audio(const char *inputFile, int trackno, CORD title)
+{
+    CORD rawFlac, outName;
+    CORD_sprintf(&rawFlac, "%r-raw.flac", title); // Will need to use a different iformat than flac for this to be useful
+    CORD_sprintf(&outName, "%r-raw.%r", title, iformat);
 
     if (csc_fileExists(rawFlac)) {
         CORD_fprintf(stderr, "^PLIP: Extracting %r from %r.\n", outName, rawFlac);
@@ -91,6 +239,51 @@ void audio(const char *inputFile, int trackno, CORD title)
             "-ar", "48000", "-ac", "2", CORD_to_char_star(outName), NULL);
 
     }
+
+    checkTrack(title);
+    trackDemuxed(title);
+}
+
+// An audio track to be extracted in a single pass
+struct AudioTrack {
+    int trackNo;
+    CORD title;
+};
+
+// Extract several audio tracks with a single read of the input
+void audioAll(const char *inputFile, struct AudioTrack *tracks, size_t trackCt)
+{
+    struct Buffer_charp cl;
+    INIT_BUFFER(cl);
+#define W(x) WRITE_ONE_BUFFER(cl, x)
+    W(CORD_to_char_star(ffmpeg));
+    W("-nostdin");
+    W("-copyts");
+    W("-i");
+    W((char *) inputFile);
+
+    // One output per track
+    for (size_t ti = 0; ti < trackCt; ti++) {
+        CORD outName = csc_casprintf("%r-raw.%r", tracks[ti].title, iformat);
+        CORD_fprintf(stderr, "^PLIP: Extracting %r from %r.\n", outName, inputFile);
+        W("-map");
+        W(csc_asprintf("0:%d", tracks[ti].trackNo));
+        W("-af");
+        W(CORD_to_char_star(csc_config("filters.resample")));
+        W("-c:a");
+        W(CORD_to_char_star(icodec));
+        W("-ar");
+        W("48000");
+        W("-ac");
+        W("2");
+        W(CORD_to_char_star(outName));
+    }
+    W(NULL);
+#undef W
+
+    csc_run(0, NULL, cl.buf);
+
+    FREE_BUFFER(cl);
 }
 
 // audio in a thread
@@ -106,6 +299,15 @@ void *audioThread(void *vat)
     return NULL;
 }
 
+// checkTrack in a thread, for tracks extracted together
+void *checkTrackThread(void *vat)
+{
+    struct AudioThread *at = vat;
+    checkTrack(at->title);
+    trackDemuxed(at->title);
+    return NULL;
+}
+
 void usage()
 {
     fprintf(stderr,
@@ -150,40 +352,18 @@ int main(int argc, char **argv)
 
     csc_configInit(configFile);
     ffmpeg = csc_config("programs.ffmpeg");
-    ffprobe = csc_config("programs.ffprobe");
     iformat = csc_config("formats.aiformat");
     icodec = csc_config("formats.aicodec");
 
-    // ffprobe output for format info
-    CORD format = CORD_EMPTY;
-
-    // ffprobe output for stream info
-    CORD streams = CORD_EMPTY;
-
-    // get the format info
-    csc_runl(CSC_STDOUT, &format,
-        ffprobe, "-print_format", "flat", "-show_format",
-        inputFile, NULL);
-
-    // and the stream info
-    csc_runl(CSC_STDOUT, &streams,
-        ffprobe, "-print_format", "flat", "-show_streams",
-        inputFile, NULL);
-
-    // get the number of streams
-    int nbStreams = 0;
-    CORD *streamInfo = csc_grep("^format\\.nb_streams", format);
-    if (streamInfo && streamInfo[0]) {
-        streamInfo = csc_match(equals, streamInfo[0]);
-        if (streamInfo && streamInfo[1])
-            nbStreams = atoi(CORD_to_char_star(streamInfo[1]));
-    }
+    // Probe the input (or reuse an earlier probe)
+    CSC_Probe *probe = csc_probe(inputFile);
+    int nbStreams = probe->nbStreams;
     fprintf(stderr, "^PLIP: %d streams\n", nbStreams);
 
     // Look for video tracks
     for (int si = 0; si < nbStreams; si++) {
-        CORD stype = codecType(streams, si);
-        CORD stitle = title(streams, si);
+        CORD stype = csc_probeStream(probe, si, "codec_type");
+        CORD stitle = csc_probeStream(probe, si, "tags.title");
 
         if (!CORD_cmp(stype, "video")) {
             if (!CORD_cmp(stitle, NULL)) {
@@ -207,13 +387,20 @@ int main(int argc, char **argv)
         }
     }
 
+    // Video tracks are now ready to clip (plip's pipelined mode waits for this)
+    if (!dryRun)
+        fprintf(stderr, "^PLIP: Video tracks demuxed\n");
+
     // Look for audio tracks
     int others = 0;
+    bool singlePass = CORD_cmp(csc_config("steps.demux"), "parallel");
     bool usedThreads[nbStreams];
     pthread_t threads[nbStreams];
+    struct AudioTrack singleTracks[nbStreams];
+    size_t singleCt = 0;
     for (int si = 0; si < nbStreams; si++) {
-        CORD stype = codecType(streams, si);
-        CORD stitle = title(streams, si);
+        CORD stype = csc_probeStream(probe, si, "codec_type");
+        CORD stitle = csc_probeStream(probe, si, "tags.title");
         usedThreads[si] = false;
 
         if (!CORD_cmp(stype, "audio")) {
@@ -229,6 +416,19 @@ int main(int argc, char **argv)
             CORD_fprintf(stderr, "^PLIP: Audio track %r (%d) included\n", stitle, si);
             if (dryRun)
                 continue;
+            if (!audioNeeded(stitle)) {
+                trackDemuxed(stitle);
+                continue;
+            }
+
+            // Tracks from the input file can all be extracted together
+            if (singlePass && !csc_fileExists(csc_casprintf("%r-raw.flac", stitle))) {
+                singleTracks[singleCt].trackNo = si;
+                singleTracks[singleCt].title = stitle;
+                singleCt++;
+                continue;
+            }
+
             struct AudioThread *at = GC_NEW(struct AudioThread);
             at->inputFile = inputFile;
             at->trackNo = si;
@@ -239,6 +439,19 @@ int main(int argc, char **argv)
         }
     }
 
+    // Extract everything we can in one pass, then check each track
+    if (singleCt) {
+        audioAll(inputFile, singleTracks, singleCt);
+        for (size_t ti = 0; ti < singleCt; ti++) {
+            int si = singleTracks[ti].trackNo;
+            struct AudioThread *at = GC_NEW(struct AudioThread);
+            at->title = singleTracks[ti].title;
+            if (GC_pthread_create(threads + si, NULL, checkTrackThread, at) != 0)
+                CRASH("pthread_create");
+            usedThreads[si] = true;
+        }
+    }
+
     // Now wait for them
     for (int si = 0; si < nbStreams; si++) {
         if (usedThreads[si])
@@ -0,0 +1,507 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Benchmark the DSP tools in-process: synthesize speech over noise at several
+ * lengths and channel counts, run plip-findnoise, each speex backend and each
+ * tier of plip-noiserepellentdenoise over it, serially and in parallel chunks,
+ * and report each run as a line of JSON. Each run is in its own child process,
+ * so that its peak RSS is its own. The real-time factor is the time taken over
+ * the length of the audio, so lower is faster. Denoisers also report how much
+ * quieter they made the synthetic audio's pauses, and runs that have something
+ * to be compared to report their speedup over it and how far their output
+ * differs from its. Exits nonzero if parallel chunks left audible seams. */
+
+#define _XOPEN_SOURCE 600 // for clock_gettime
+#define _DEFAULT_SOURCE // for wait4
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arg.h"
+#include "synth.h"
+
+#include "nrepel.h"
+
+// The tools' own mains, renamed
+int findnoise_main(int argc, char **argv);
+int speexdenoise_main(int argc, char **argv);
+int noiserepellentdenoise_main(int argc, char **argv);
+
+// Scratch files, in the current directory
+#define IN_F32 "plip-dspbench-in.f32"
+#define IN_S16 "plip-dspbench-in.s16"
+#define NOISE "plip-dspbench.noise"
+#define OUT "plip-dspbench-out%d.raw"
+#define WISDOM "plip-dspbench-wisdom"
+
+// Must match plip-noiserepellentdenoise's crossfade between chunks
+#define FADE (4*NREPEL_HOP)
+
+// Seams whose error is this far below the signal are inaudible
+#define INAUDIBLE_DB -60
+
+struct Case {
+    const char *tool, *variant;
+    int (*run)(int argc, char **argv); // or NULL to run the tool's own program
+    bool s16; // reads and writes s16le rather than f32le
+    bool plans; // plans FFTW's transforms, so is run untimed first
+    bool kernels; // report noise-repellent's kernel times
+    bool parallel; // denoise in chunks, in parallel
+    struct Case *like; // case to compare to, if any
+    double took; // time of the last run, for comparison
+};
+
+static struct Case cases[] = {
+    {"findnoise", "", findnoise_main, false, false, false, false, NULL},
+    {"speexdenoise", "", speexdenoise_main, true, false, false, false, NULL},
+
+    // Linked with a float, FFTW build of speexdsp, so can't share our process
+    {"speexfftwdenoise", "", NULL, false, true, false, false, &cases[1]},
+
+    {"noiserepellentdenoise", "best", noiserepellentdenoise_main, false, true, true, false, NULL},
+    {"noiserepellentdenoise", "balanced", noiserepellentdenoise_main, false, true, true, false, &cases[3]},
+    {"noiserepellentdenoise", "fast", noiserepellentdenoise_main, false, true, true, false, &cases[3]},
+    {"noiserepellentdenoise", "parallel", noiserepellentdenoise_main, false, true, true, true, &cases[3]},
+    {NULL}
+};
+
+void usage()
+{
+    fprintf(stderr,
+        "Use: plip-dspbench [-s|--seconds <lengths>] [-c|--channels <counts>]\n"
+        "       [-t|--tool <tool>] [-j|--jobs <count>] [--chunk <seconds>]\n"
+        "       [-v|--verbose]\n\n"
+        "Lengths and counts are comma-separated lists. Default 10,60 seconds of 1\n"
+        "and 2 channels. The parallel case uses every core and 30-second chunks\n"
+        "by default.\n\n");
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double toDB(double power)
+{
+    return 10 * log10(power + 1e-30);
+}
+
+// Parse a comma-separated list of positive numbers, returning how many
+static int parseList(const char *str, double *list, int max)
+{
+    int ct = 0;
+    char *end;
+    while (ct < max) {
+        list[ct] = strtod(str, &end);
+        if (end == str || list[ct] <= 0)
+            return 0;
+        ct++;
+        if (*end != ',')
+            break;
+        str = end + 1;
+    }
+    return *end ? 0 : ct;
+}
+
+// Convert the f32le input to s16le, as ffmpeg would for plip-speexdenoise
+static void toS16(const char *inFile, const char *outFile)
+{
+    FILE *in = fopen(inFile, "rb"), *out = fopen(outFile, "wb");
+    float buf[4096];
+    short sbuf[4096];
+    size_t rd, i;
+    if (!in || !out) {
+        perror(in ? outFile : inFile);
+        exit(1);
+    }
+    while ((rd = fread(buf, sizeof(float), 4096, in)) > 0) {
+        for (i = 0; i < rd; i++) {
+            float s = buf[i] * 32768.0f;
+            if (s > 32767.0f) s = 32767.0f;
+            else if (s < -32768.0f) s = -32768.0f;
+            sbuf[i] = (short) (s < 0 ? s - 0.5f : s + 0.5f);
+        }
+        fwrite(sbuf, sizeof(short), rd, out);
+    }
+    fclose(in);
+    fclose(out);
+}
+
+// Read a whole f32le or s16le file as floats
+static float *readSamples(const char *file, bool s16, size_t *count)
+{
+    size_t width = s16 ? sizeof(short) : sizeof(float);
+    FILE *fh = fopen(file, "rb");
+    if (!fh) {
+        perror(file);
+        exit(1);
+    }
+    fseek(fh, 0, SEEK_END);
+    long sz = ftell(fh);
+    fseek(fh, 0, SEEK_SET);
+    float *ret = malloc((sz / width + 1) * sizeof(float));
+    if (!ret) {
+        perror("malloc");
+        exit(1);
+    }
+    *count = fread(ret, 1, sz, fh) / width;
+    fclose(fh);
+
+    // Widen in place, from the end so as not to overwrite what's unread
+    if (s16) {
+        short *raw = (short *) ret;
+        for (size_t i = *count; i > 0; i--)
+            ret[i-1] = raw[i-1] / 32768.0f;
+    }
+    return ret;
+}
+
+// Power of the synthetic audio's pauses, where there's only noise
+static double pausePower(const float *samples, size_t count, int channels)
+{
+    double power = 0;
+    size_t n = 0;
+    size_t frames = count / channels;
+    for (size_t p = 0; (p + CSC_SYNTH_PAUSE_END) * 48000 <= frames;
+            p += CSC_SYNTH_PAUSE_PERIOD) {
+        size_t from = (p + CSC_SYNTH_PAUSE_START) * 48000;
+        size_t to = (p + CSC_SYNTH_PAUSE_END) * 48000;
+        for (size_t i = from * channels; i < to * channels; i++)
+            power += (double) samples[i] * samples[i];
+        n += (to - from) * channels;
+    }
+    return n ? power / n : 0;
+}
+
+// Error between two runs' output over a range of samples, relative to the first
+static double difference(const float *a, const float *b, size_t from, size_t to)
+{
+    double err = 0, sig = 0;
+    for (size_t i = from; i < to; i++) {
+        double d = a[i] - b[i];
+        err += d * d;
+        sig += (double) a[i] * a[i];
+    }
+    return toDB(err) - toDB(sig);
+}
+
+/* Check the seams between parallel chunks against serial output. The chunks
+ * are cut at whole hops. Check the crossfade around each cut, and the
+ * neighborhood on either side. Returns the number of seams, and the worst's
+ * error relative to the signal in *worst. */
+static size_t checkSeams(const float *serial, const float *parallel,
+    size_t count, int channels, double chunk, double *worst)
+{
+    size_t frames = count / channels;
+    size_t chunkFrames = chunk * 48000;
+    size_t seams = 0;
+    chunkFrames = (chunkFrames + NREPEL_HOP - 1) / NREPEL_HOP * NREPEL_HOP;
+    *worst = -INFINITY;
+    for (size_t seam = chunkFrames; seam < frames; seam += chunkFrames) {
+        size_t from = seam > 2*FADE ? seam - 2*FADE : 0;
+        size_t to = seam + FADE < frames ? seam + FADE : frames;
+        double rel = difference(serial, parallel, from * channels,
+            to * channels);
+        if (rel > *worst)
+            *worst = rel;
+        seams++;
+    }
+    return seams;
+}
+
+/* Run a case in a child process, in-process if it can be, returning how long
+ * it took and its peak RSS in *rss. Also returns noise-repellent's kernel
+ * times in kernels, if the case reports them. */
+static double runCase(const struct Case *c, const char *binDir, int channels,
+    int jobs, double chunk, bool verbose, long *rss, double *kernels)
+{
+    char channelsStr[16], jobsStr[16], chunkStr[32], out[64], prog[4096];
+    char *argv[24];
+    int argc = 0;
+    int timing[2];
+
+    snprintf(channelsStr, sizeof(channelsStr), "%d", channels);
+    snprintf(jobsStr, sizeof(jobsStr), "%d", jobs);
+    snprintf(chunkStr, sizeof(chunkStr), "%g", chunk);
+    snprintf(out, sizeof(out), OUT, (int) (c - cases));
+    snprintf(prog, sizeof(prog), "%splip-%s", binDir, c->tool);
+    argv[argc++] = prog;
+    argv[argc++] = "-i";
+    argv[argc++] = c->s16 ? IN_S16 : IN_F32;
+    argv[argc++] = "-o";
+    argv[argc++] = c->run == findnoise_main ? NOISE : out;
+    if (c->plans) {
+        argv[argc++] = "-w";
+        argv[argc++] = WISDOM;
+    }
+    if (c->run == noiserepellentdenoise_main) {
+        argv[argc++] = "-l";
+        argv[argc++] = NOISE;
+        argv[argc++] = "--tier";
+        argv[argc++] = c->parallel ? "best" : (char *) c->variant;
+    }
+    if (c->parallel) {
+        argv[argc++] = "-j";
+        argv[argc++] = jobsStr;
+        argv[argc++] = "--chunk";
+        argv[argc++] = chunkStr;
+    }
+    argv[argc++] = channelsStr;
+    argv[argc] = NULL;
+
+    // In-process runs time themselves, without the fork
+    if (pipe(timing) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+
+    fflush(stdout);
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        close(timing[0]);
+
+        // The tools are chatty
+        if (!verbose) {
+            int devNull = open("/dev/null", O_WRONLY);
+            if (devNull >= 0)
+                dup2(devNull, 2);
+        }
+
+        if (!c->run) {
+            execvp(prog, argv);
+            perror(prog);
+            _exit(1);
+        }
+
+        double times[4];
+        if (c->kernels)
+            nrepel_kernel_timing(1);
+        times[0] = now();
+        int ret = c->run(argc, argv);
+        times[0] = now() - times[0];
+        if (ret != 0)
+            _exit(ret);
+        if (c->kernels)
+            nrepel_kernel_times(&times[1], &times[2], &times[3]);
+        if (write(timing[1], times, sizeof(times)) != sizeof(times))
+            _exit(1);
+        _exit(0);
+    }
+
+    close(timing[1]);
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s %s failed\n", c->tool, c->variant);
+        exit(1);
+    }
+    double took = now() - start;
+
+    double times[4] = {0};
+    if (read(timing[0], times, sizeof(times)) == sizeof(times))
+        took = times[0];
+    close(timing[0]);
+    for (int ki = 0; ki < 3; ki++)
+        kernels[ki] = times[ki+1];
+    *rss = ru.ru_maxrss;
+    return took;
+}
+
+// Run a case and report it as a line of JSON, returning false if it failed
+static bool reportCase(struct Case *c, const char *binDir, int channels,
+    double seconds, int jobs, double chunk, bool verbose)
+{
+    long rss;
+    double kernels[3];
+    double samples = seconds * 48000 * channels;
+    bool ok = true;
+
+    c->took = runCase(c, binDir, channels, jobs, chunk, verbose, &rss,
+        kernels);
+    printf("{\"tool\":\"%s\",\"variant\":\"%s\",\"channels\":%d,"
+        "\"seconds\":%g,\"samples\":%.0f,\"wall_s\":%.6f,"
+        "\"samples_per_s\":%.0f,\"rtf\":%.6f,\"peak_rss_kb\":%ld",
+        c->tool, c->variant, channels, seconds, samples, c->took,
+        samples / c->took, c->took / seconds, rss);
+    if (c->kernels)
+        printf(",\"stft_s\":%.6f,\"masking_s\":%.6f,\"gain_s\":%.6f",
+            kernels[0], kernels[1], kernels[2]);
+
+    if (c->run != findnoise_main) {
+        char out[64], likeOut[64];
+        size_t inCt, outCt, likeCt;
+        snprintf(out, sizeof(out), OUT, (int) (c - cases));
+        float *in = readSamples(IN_F32, false, &inCt);
+        float *output = readSamples(out, c->s16, &outCt);
+        printf(",\"pause_reduction_db\":%.2f",
+            toDB(pausePower(in, inCt, channels)) -
+            toDB(pausePower(output, outCt, channels)));
+        free(in);
+
+        // Compare to the case it's like, if it ran
+        if (c->like && c->like->took > 0) {
+            snprintf(likeOut, sizeof(likeOut), OUT, (int) (c->like - cases));
+            float *like = readSamples(likeOut, c->like->s16, &likeCt);
+            printf(",\"speedup\":%.3f", c->like->took / c->took);
+            if (likeCt == outCt)
+                printf(",\"difference_db\":%.2f",
+                    difference(like, output, 0, outCt));
+            else
+                ok = !c->parallel;
+
+            if (c->parallel) {
+                double worst;
+                size_t seams = 0;
+                if (likeCt == outCt)
+                    seams = checkSeams(like, output, outCt, channels, chunk,
+                        &worst);
+                printf(",\"jobs\":%d,\"seams\":%zu", jobs, seams);
+                if (seams) {
+                    printf(",\"worst_seam_db\":%.2f", worst);
+                    ok = ok && worst <= INAUDIBLE_DB;
+                }
+                printf(",\"seams_inaudible\":%s", ok ? "true" : "false");
+            }
+            free(like);
+        }
+        free(output);
+    }
+
+    printf("}\n");
+    fflush(stdout);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    double lengths[16], counts[16];
+    int lengthCt = 2, countCt = 2;
+    const char *only = NULL;
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    double chunk = 30;
+    bool verbose = false, ok = true;
+    char binDir[4096] = "";
+
+    ARG_VARS;
+
+    lengths[0] = 10;
+    lengths[1] = 60;
+    counts[0] = 1;
+    counts[1] = 2;
+
+    // Programs we can't run in-process are next to us
+    const char *slash = strrchr(argv[0], '/');
+    if (slash && slash - argv[0] + 1 < (long) sizeof(binDir))
+        memcpy(binDir, argv[0], slash - argv[0] + 1);
+
+    ARG_NEXT();
+    while (argType) {
+        ARG(h, help) {
+            usage();
+            return 0;
+        } else ARGN(s, seconds) {
+            ARG_GET();
+            lengthCt = parseList(arg, lengths, 16);
+        } else ARGN(c, channels) {
+            ARG_GET();
+            countCt = parseList(arg, counts, 16);
+        } else ARGN(t, tool) {
+            ARG_GET();
+            only = arg;
+        } else ARGN(j, jobs) {
+            ARG_GET();
+            jobs = atoi(arg);
+        } else ARGLN(chunk) {
+            ARG_GET();
+            chunk = atof(arg);
+        } else ARG(v, verbose) {
+            verbose = true;
+        } else {
+            usage();
+            return 1;
+        }
+        ARG_NEXT();
+    }
+    if (!lengthCt || !countCt || jobs < 1 || chunk <= 0) {
+        usage();
+        return 1;
+    }
+
+    unlink(WISDOM);
+    for (int ci = 0; ci < countCt; ci++) {
+        int channels = counts[ci];
+        for (int li = 0; li < lengthCt; li++) {
+            double seconds = lengths[li];
+            fprintf(stderr, "Synthesizing %g seconds of %d-channel audio...\n",
+                seconds, channels);
+            csc_synthesize(IN_F32, channels, seconds);
+            toS16(IN_F32, IN_S16);
+
+            // The denoisers need noise, even if findnoise isn't benchmarked
+            long rss;
+            double kernels[3];
+            if (only && strcmp(only, "findnoise"))
+                runCase(&cases[0], binDir, channels, jobs, chunk, verbose,
+                    &rss, kernels);
+
+            for (struct Case *c = cases; c->tool; c++) {
+                c->took = 0;
+                if (only && strcmp(only, c->tool))
+                    continue;
+                fprintf(stderr, "Running %s %s...\n", c->tool, c->variant);
+
+                // Plan FFTW's transforms before timing them
+                if (c->plans && li == 0)
+                    runCase(c, binDir, channels, jobs, chunk, verbose, &rss,
+                        kernels);
+
+                ok = reportCase(c, binDir, channels, seconds, jobs, chunk,
+                    verbose) && ok;
+            }
+
+            for (struct Case *c = cases; c->tool; c++) {
+                char out[64];
+                snprintf(out, sizeof(out), OUT, (int) (c - cases));
+                unlink(out);
+            }
+        }
+    }
+
+    unlink(IN_F32);
+    unlink(IN_S16);
+    unlink(NOISE);
+    unlink(WISDOM);
+    return ok ? 0 : 1;
+}
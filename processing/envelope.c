@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "atomicfile.h"
+#include "helpers.h"
+#include "envelope.h"
+
+/* Envelope files start with this, then the rate, channels, level count and
+ * frame count, then the size and modification time of the audio file they
+ * describe, then each level's block size and count, then each level's blocks */
+#define MAGIC "PLIPENV2"
+#define MAGIC_SZ 8
+
+struct Header {
+    char magic[MAGIC_SZ];
+    uint32_t rate, channels, levels, reserved;
+    uint64_t frames;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+};
+
+struct LevelHeader {
+    uint64_t blockSize, count;
+};
+
+// Sanity limit for reading
+#define MAX_CHANNELS 64
+
+
+// Start building an envelope
+CSC_Envelope *csc_envelopeNew(int rate, int channels)
+{
+    CSC_Envelope *env;
+    SF(env, calloc, NULL, (1, sizeof(CSC_Envelope)));
+    env->rate = rate;
+    env->channels = channels;
+    SF(env->sumSq, calloc, NULL, (1, channels * sizeof(double)));
+    SF(env->min, calloc, NULL, (1, channels * sizeof(float)));
+    SF(env->max, calloc, NULL, (1, channels * sizeof(float)));
+    for (int li = 0, bs = CSC_ENVELOPE_BLOCK; li < CSC_ENVELOPE_LEVELS; li++, bs *= CSC_ENVELOPE_FACTOR)
+        env->levels[li].blockSize = bs;
+    return env;
+}
+
+// Finish the block being built at the finest level
+static void endBlock(CSC_Envelope *env)
+{
+    CSC_EnvelopeLevel *level = &env->levels[0];
+    int channels = env->channels;
+
+    if (level->count == env->buildingSz) {
+        env->buildingSz = env->buildingSz ? env->buildingSz * 2 : 1024;
+        env->building[0] = realloc(env->building[0],
+            env->buildingSz * channels * sizeof(CSC_EnvelopeBlock));
+        if (!env->building[0]) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    CSC_EnvelopeBlock *block = env->building[0] + level->count * channels;
+    for (int ci = 0; ci < channels; ci++) {
+        block[ci].min = env->min[ci];
+        block[ci].max = env->max[ci];
+        block[ci].rms = sqrt(env->sumSq[ci] / env->partial);
+        env->min[ci] = env->max[ci] = 0;
+        env->sumSq[ci] = 0;
+    }
+    level->count++;
+    level->blocks = env->building[0];
+    env->partial = 0;
+}
+
+// Add audio to an envelope
+void csc_envelopeAdd(CSC_Envelope *env, const float *samples, size_t frames)
+{
+    int channels = env->channels;
+
+    while (frames) {
+        size_t ct = CSC_ENVELOPE_BLOCK - env->partial;
+        if (ct > frames)
+            ct = frames;
+
+        for (int ci = 0; ci < channels; ci++) {
+            const float *s = samples + ci;
+            float min = env->min[ci], max = env->max[ci];
+            double sumSq = 0;
+            if (!env->partial)
+                min = max = s[0];
+            for (size_t fi = 0; fi < ct; fi++) {
+                float v = s[fi * channels];
+                min = (v < min) ? v : min;
+                max = (v > max) ? v : max;
+                sumSq += v * v;
+            }
+            env->min[ci] = min;
+            env->max[ci] = max;
+            env->sumSq[ci] += sumSq;
+        }
+
+        env->partial += ct;
+        env->frames += ct;
+        samples += ct * channels;
+        frames -= ct;
+        if (env->partial == CSC_ENVELOPE_BLOCK)
+            endBlock(env);
+    }
+}
+
+// Finish building an envelope
+void csc_envelopeFinish(CSC_Envelope *env)
+{
+    int channels = env->channels;
+
+    if (env->partial)
+        endBlock(env);
+
+    // Summarize each level from the one before
+    for (int li = 1; li < CSC_ENVELOPE_LEVELS; li++) {
+        CSC_EnvelopeLevel *prev = &env->levels[li - 1];
+        CSC_EnvelopeLevel *level = &env->levels[li];
+        level->count = (prev->count + CSC_ENVELOPE_FACTOR - 1) / CSC_ENVELOPE_FACTOR;
+        SF(env->building[li], calloc, NULL, (1, (level->count * channels + 1) * sizeof(CSC_EnvelopeBlock)));
+
+        for (size_t bi = 0; bi < level->count; bi++) {
+            size_t from = bi * CSC_ENVELOPE_FACTOR;
+            size_t to = from + CSC_ENVELOPE_FACTOR;
+            if (to > prev->count)
+                to = prev->count;
+
+            for (int ci = 0; ci < channels; ci++) {
+                CSC_EnvelopeBlock *block = env->building[li] + bi * channels + ci;
+                double sumSq = 0, weights = 0;
+                *block = prev->blocks[from * channels + ci];
+                for (size_t pi = from; pi < to; pi++) {
+                    const CSC_EnvelopeBlock *p = prev->blocks + pi * channels + ci;
+                    // Only the last block may be short
+                    double weight = prev->blockSize;
+                    if (pi == prev->count - 1)
+                        weight = env->frames - (unsigned long long) pi * prev->blockSize;
+                    if (p->min < block->min)
+                        block->min = p->min;
+                    if (p->max > block->max)
+                        block->max = p->max;
+                    sumSq += (double) p->rms * p->rms * weight;
+                    weights += weight;
+                }
+                block->rms = sqrt(sumSq / weights);
+            }
+        }
+        level->blocks = env->building[li];
+    }
+}
+
+// Get the size and modification time of an audio file, as an envelope records them
+static void sourceStamp(const char *source, uint64_t *size, int64_t *time)
+{
+    struct stat sbuf;
+    *size = 0;
+    *time = 0;
+    if (source && stat(source, &sbuf) == 0) {
+        *size = sbuf.st_size;
+        *time = sbuf.st_mtime;
+    }
+}
+
+// Write an envelope
+int csc_envelopeWrite(const CSC_Envelope *env, const char *file, const char *source)
+{
+    struct Header header;
+    int li, ret = 0;
+    CSC_AtomicFile *af = csc_atomicOpen(file);
+    if (!af)
+        return -1;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, MAGIC_SZ);
+    header.rate = env->rate;
+    header.channels = env->channels;
+    header.levels = CSC_ENVELOPE_LEVELS;
+    header.frames = env->frames;
+    sourceStamp(source, &header.sourceSize, &header.sourceTime);
+    if (fwrite(&header, sizeof(header), 1, af->fh) != 1)
+        ret = -1;
+    for (li = 0; li < CSC_ENVELOPE_LEVELS && ret == 0; li++) {
+        struct LevelHeader lh = {env->levels[li].blockSize, env->levels[li].count};
+        if (fwrite(&lh, sizeof(lh), 1, af->fh) != 1)
+            ret = -1;
+    }
+    for (li = 0; li < CSC_ENVELOPE_LEVELS && ret == 0; li++) {
+        const CSC_EnvelopeLevel *level = &env->levels[li];
+        if (fwrite(level->blocks, sizeof(CSC_EnvelopeBlock) * env->channels,
+                level->count, af->fh) != level->count)
+            ret = -1;
+    }
+
+    // Replace any old envelope
+    return csc_atomicClose(af, ret == 0);
+}
+
+// Read an envelope
+CSC_Envelope *csc_envelopeRead(const char *file, const char *source)
+{
+    struct stat sbuf;
+    CSC_Envelope *env;
+    char *data = NULL;
+    size_t sz;
+    int fd;
+
+    fd = open(file, O_RDONLY
+#ifdef _WIN32
+        |O_BINARY
+#endif
+        );
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &sbuf) != 0 || !S_ISREG(sbuf.st_mode) ||
+        (uintmax_t) sbuf.st_size < sizeof(struct Header) ||
+        (uintmax_t) sbuf.st_size > (uintmax_t) SIZE_MAX) {
+        close(fd);
+        return NULL;
+    }
+    sz = sbuf.st_size;
+
+    SF(env, calloc, NULL, (1, sizeof(CSC_Envelope)));
+#ifndef _WIN32
+    {
+        void *map = mmap(NULL, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            env->map = map;
+            env->mapSz = sz;
+            data = map;
+        }
+    }
+#endif
+    if (!data) {
+        // Just read it
+        size_t rd = 0;
+        ssize_t r;
+        SF(data, calloc, NULL, (1, sz));
+        env->building[0] = (CSC_EnvelopeBlock *) data;
+        while (rd < sz && (r = read(fd, data + rd, sz - rd)) > 0)
+            rd += r;
+        if (rd < sz) {
+            close(fd);
+            csc_envelopeFree(env);
+            return NULL;
+        }
+    }
+    close(fd);
+
+    // Check the header
+    const struct Header *header = (const struct Header *) data;
+    size_t off = sizeof(struct Header) + CSC_ENVELOPE_LEVELS * sizeof(struct LevelHeader);
+    if (memcmp(header->magic, MAGIC, MAGIC_SZ) ||
+        header->channels < 1 || header->channels > MAX_CHANNELS ||
+        header->levels != CSC_ENVELOPE_LEVELS || sz < off) {
+        csc_envelopeFree(env);
+        return NULL;
+    }
+
+    // Check that it's of the audio as it is now
+    if (source) {
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        sourceStamp(source, &sourceSize, &sourceTime);
+        if (!sourceSize || sourceSize != header->sourceSize ||
+            sourceTime != header->sourceTime) {
+            csc_envelopeFree(env);
+            return NULL;
+        }
+    }
+    env->rate = header->rate;
+    env->channels = header->channels;
+    env->frames = header->frames;
+
+    // And find the levels
+    const struct LevelHeader *lh = (const struct LevelHeader *) (header + 1);
+    for (int li = 0; li < CSC_ENVELOPE_LEVELS; li++) {
+        size_t blockSz = sizeof(CSC_EnvelopeBlock) * env->channels;
+        if (lh[li].count > (sz - off) / blockSz) {
+            csc_envelopeFree(env);
+            return NULL;
+        }
+        env->levels[li].blockSize = lh[li].blockSize;
+        env->levels[li].count = lh[li].count;
+        env->levels[li].blocks = (const CSC_EnvelopeBlock *) (data + off);
+        off += lh[li].count * blockSz;
+    }
+
+    return env;
+}
+
+void csc_envelopeFree(CSC_Envelope *env)
+{
+    if (!env)
+        return;
+#ifndef _WIN32
+    if (env->map)
+        munmap(env->map, env->mapSz);
+#endif
+    for (int li = 0; li < CSC_ENVELOPE_LEVELS; li++)
+        free(env->building[li]);
+    free(env->sumSq);
+    free(env->min);
+    free(env->max);
+    free(env);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ENVELOPE_H
+#define ENVELOPE_H 1
+
+#include <stddef.h>
+
+/* Frames per block at the finest level of an envelope. At 48kHz, that's 64
+ * blocks per second, the resolution of the editor's waveform. */
+#define CSC_ENVELOPE_BLOCK 750
+
+/* Levels in an envelope. Each level's blocks summarize four of the previous
+ * level's. */
+#define CSC_ENVELOPE_LEVELS 4
+#define CSC_ENVELOPE_FACTOR 4
+
+/* An envelope is usually kept as a sidecar to the audio file it describes,
+ * named as the file with this suffix */
+#define CSC_ENVELOPE_SUFFIX ".envelope"
+
+/* The summary of one channel of one block */
+typedef struct CSC_EnvelopeBlock_ {
+    float min, max, rms;
+} CSC_EnvelopeBlock;
+
+/* One level of an envelope. Blocks are stored with their channels together:
+ * channel c of block b is blocks[b*channels+c]. The last block may be short. */
+typedef struct CSC_EnvelopeLevel_ {
+    size_t blockSize; // frames
+    size_t count; // blocks
+    const CSC_EnvelopeBlock *blocks;
+} CSC_EnvelopeLevel;
+
+/* An envelope pyramid of a track: the minimum, maximum and RMS of each block,
+ * at several block sizes. Envelope files are in native byte order, and are
+ * mapped into memory where possible. */
+typedef struct CSC_Envelope_ {
+    int rate, channels;
+    unsigned long long frames;
+    CSC_EnvelopeLevel levels[CSC_ENVELOPE_LEVELS];
+
+    // Private
+    void *map;
+    size_t mapSz;
+    CSC_EnvelopeBlock *building[CSC_ENVELOPE_LEVELS];
+    size_t buildingSz;
+    double *sumSq;
+    float *min, *max;
+    size_t partial;
+} CSC_Envelope;
+
+/* Start building an envelope */
+CSC_Envelope *csc_envelopeNew(int rate, int channels);
+
+/* Add interleaved f32 audio to an envelope being built */
+void csc_envelopeAdd(CSC_Envelope *env, const float *samples, size_t frames);
+
+/* Finish building an envelope, summarizing the coarser levels */
+void csc_envelopeFinish(CSC_Envelope *env);
+
+/* Write a finished envelope of the audio file source, replacing the file
+ * atomically. The source's size and modification time are recorded, so write
+ * it once the source is complete. Returns 0 or -1 on error. */
+int csc_envelopeWrite(const CSC_Envelope *env, const char *file, const char *source);
+
+/* Read an envelope, or return NULL if it's missing or invalid. If source isn't
+ * NULL, also return NULL if the envelope isn't of that audio file as it is
+ * now, by its size and modification time. */
+CSC_Envelope *csc_envelopeRead(const char *file, const char *source);
+
+void csc_envelopeFree(CSC_Envelope *env);
+
+#endif
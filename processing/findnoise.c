@@ -15,6 +15,7 @@
  */
 
 #include <fcntl.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -27,16 +28,27 @@
 #endif
 
 #include "arg.h"
+#include "envelope.h"
+#include "pcmio.h"
 
 #define FRAME_SIZE 48000
 
+// Frames to read at a time (must be no more than FRAME_SIZE)
+#define BLOCK_SIZE 32768
+
+/* We keep two frames of history per channel, so that the quietest frame found
+ * so far stays intact in the history for a full frame after it's found, and
+ * only needs to be copied out if it's about to be overwritten */
+#define HISTORY_SIZE (FRAME_SIZE*2)
+
 void usage()
 {
-    fprintf(stderr, "Use: plip-findnoise [-i|--input <input file>] [-o|--output <output file>] [channels]\n\n");
+    fprintf(stderr, "Use: plip-findnoise [-i|--input <input file>] [-o|--output <output file>] [channels]\n"
+                    "   or: plip-findnoise -e|--envelope <envelope file>\n\n");
 }
 
 // Sample-based fabs
-float sabs(float s)
+static inline float sabs(float s)
 {
     if (s < 0) {
         return -s;
@@ -85,19 +97,80 @@ void freeFloatArr2(float **arr, size_t sz)
     free(arr);
 }
 
+/* Copy the frame ending at sample idx out of the history. The frame is output
+ * starting from its newest sample, then oldest to second-newest. */
+static void snapshot(float *sel, const float *history, int64_t idx)
+{
+    size_t i;
+    sel[0] = history[idx % HISTORY_SIZE];
+    for (i = 1; i < FRAME_SIZE; i++)
+        sel[i] = history[(idx - FRAME_SIZE + i + HISTORY_SIZE) % HISTORY_SIZE];
+}
+
+/* With an envelope, there's no need to read the audio: find the quietest
+ * frame from the envelope's finest blocks, and print when it starts, in
+ * seconds. As above, digital silence doesn't count as quiet. */
+static int findInEnvelope(const char *file)
+{
+    CSC_Envelope *env = csc_envelopeRead(file, NULL);
+    if (!env) {
+        fprintf(stderr, "%s: Invalid envelope\n", file);
+        return 1;
+    }
+
+    const CSC_EnvelopeLevel *level = &env->levels[0];
+    int channels = env->channels;
+    size_t window = FRAME_SIZE / level->blockSize;
+    size_t best = 0;
+    double bestPower = INFINITY, power = 0;
+    size_t digital = 0; // digitally silent blocks in the window
+
+    for (size_t bi = 0; bi < level->count; bi++) {
+        // Add this block to the window
+        const CSC_EnvelopeBlock *block = level->blocks + bi * channels;
+        for (int ci = 0; ci < channels; ci++) {
+            power += (double) block[ci].rms * block[ci].rms;
+            if (block[ci].min == 0 && block[ci].max == 0)
+                digital++;
+        }
+
+        // And remove the one that's left it
+        if (bi >= window) {
+            block = level->blocks + (bi - window) * channels;
+            for (int ci = 0; ci < channels; ci++) {
+                power -= (double) block[ci].rms * block[ci].rms;
+                if (block[ci].min == 0 && block[ci].max == 0)
+                    digital--;
+            }
+        }
+
+        if (bi + 1 >= window && !digital && power < bestPower) {
+            bestPower = power;
+            best = bi + 1 - window;
+        }
+    }
+
+    printf("%f\n", (double) best * level->blockSize / env->rate);
+    csc_envelopeFree(env);
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
-    float **curFrame;
+    float **history;
     float **selFrame;
-    float *curVolume;
-    float *selVolume;
-    int *curOffset;
-    int *selOffset;
-    int i, ci;
+    float **chanBufs, *delta;
+    const float *inBuf;
+    CSC_PcmIn *in;
+    double *curVolume, *selVolume;
+    int64_t *selIdx;
+    char *selPending;
+    int64_t pos = 0;
+    size_t i, frames;
+    int ci;
     int channels = 1;
-    ssize_t rd, total;
-    float s, sa;
-    char *inFile = NULL, *outFile = NULL;
+    size_t rd;
+    char *inFile = NULL, *outFile = NULL, *envFile = NULL;
     int inFd = 0, outFd = 1;
 
     ARG_VARS;
@@ -118,6 +191,9 @@ int main(int argc, char **argv)
         } else ARGN(o, output) {
             ARG_GET();
             outFile = arg;
+        } else ARGN(e, envelope) {
+            ARG_GET();
+            envFile = arg;
         } else ARGN(c, channels) {
             ARG_GET();
             channels = atoi(arg);
@@ -129,6 +205,12 @@ int main(int argc, char **argv)
         }
         ARG_NEXT();
     }
+    if (channels < 1) {
+        usage();
+        return 1;
+    }
+    if (envFile)
+        return findInEnvelope(envFile);
 
     // Set up I/O
     if (inFile) {
@@ -143,7 +225,7 @@ int main(int argc, char **argv)
         }
     }
     if (outFile) {
-        outFd = open(outFile, O_WRONLY|O_CREAT
+        outFd = open(outFile, O_WRONLY|O_CREAT|O_TRUNC
 #ifdef _WIN32
             |O_BINARY
 #endif
@@ -154,75 +236,100 @@ int main(int argc, char **argv)
         }
     }
 
-    // Allocate our frames
-    curFrame = allocFloatArr2(channels, FRAME_SIZE, 1);
+    /* Allocate our buffers. Before the input starts, the history is full of
+     * 1s, as if the recording were preceded by a loud frame. */
+    history = allocFloatArr2(channels, HISTORY_SIZE, 1);
     selFrame = allocFloatArr2(channels, FRAME_SIZE, 0);
-    curVolume = allocFloatArr(channels, FRAME_SIZE);
-    selVolume = allocFloatArr(channels, FRAME_SIZE);
-    curOffset = calloc(channels, sizeof(int));
-    if (curOffset == NULL) {
-        perror("calloc");
+    chanBufs = allocFloatArr2(channels, BLOCK_SIZE, 0);
+    delta = allocFloatArr(BLOCK_SIZE, 0);
+    curVolume = malloc(channels * sizeof(double));
+    selVolume = malloc(channels * sizeof(double));
+    selIdx = malloc(channels * sizeof(int64_t));
+    selPending = calloc(channels, 1);
+    if (!curVolume || !selVolume || !selIdx || !selPending) {
+        perror("malloc");
         return 1;
     }
-    selOffset = calloc(channels, sizeof(int));
-    if (selOffset == NULL) {
-        perror("calloc");
-        return 1;
+    for (ci = 0; ci < channels; ci++) {
+        curVolume[ci] = selVolume[ci] = FRAME_SIZE;
+        selIdx[ci] = -1;
     }
 
+    in = csc_pcmOpenIn(inFd);
     while (1) {
+        // Read in a block
+        inBuf = csc_pcmRead(in, BLOCK_SIZE * channels * sizeof(float), &rd);
+        frames = rd / (channels * sizeof(float));
+        if (frames == 0)
+            break;
+
+        // Split it into channels
+        csc_pcmDeinterleave((void *const *) chanBufs, inBuf, channels,
+            sizeof(float), frames);
+
         for (ci = 0; ci < channels; ci++) {
-            // Remove the current sample
-            s = curFrame[ci][curOffset[ci]];
-            sa = sabs(s);
-            curVolume[ci] -= sa;
-
-            // Read in a sample
-            total = 0;
-            while (total < sizeof(float)) {
-                rd = read(inFd, ((char *) &s) + total, sizeof(float) - total);
-                if (rd <= 0)
-                    break;
-                total += rd;
+            float *hist = history[ci];
+            const float *chanBuf = chanBufs[ci];
+            double vol = curVolume[ci];
+
+            /* If the selected frame would be overwritten during this block,
+             * snapshot it now */
+            if (selPending[ci] && selIdx[ci] + FRAME_SIZE < pos + (int64_t) frames) {
+                snapshot(selFrame[ci], hist, selIdx[ci]);
+                selPending[ci] = 0;
+            }
+
+            // Compute how each sample changes the volume
+            for (i = 0; i < frames; i++) {
+                size_t hi = (pos + i + HISTORY_SIZE - FRAME_SIZE) % HISTORY_SIZE;
+                delta[i] = sabs(chanBuf[i]) - sabs(hist[hi]);
             }
-            if (total < sizeof(float))
-                break;
-            curFrame[ci][curOffset[ci]] = s;
-            sa = sabs(s);
-            curVolume[ci] += sa;
-
-            // Maybe select it
-            if (curVolume[ci] < selVolume[ci]) {
-                memcpy(selFrame[ci], curFrame[ci], FRAME_SIZE * sizeof(float));
-                selOffset[ci] = curOffset[ci];
-                selVolume[ci] = curVolume[ci];
+
+            // Then slide the window
+            for (i = 0; i < frames; i++) {
+                hist[(pos + i) % HISTORY_SIZE] = chanBuf[i];
+                vol += delta[i];
+
+                // Maybe select it
+                if (vol < selVolume[ci]) {
+                    selVolume[ci] = vol;
+                    selIdx[ci] = pos + i;
+                    selPending[ci] = 1;
+                }
             }
 
-            // And advance
-            curOffset[ci]++;
-            if (curOffset[ci] >= FRAME_SIZE)
-                curOffset[ci] = 0;
+            curVolume[ci] = vol;
         }
 
-        if (ci < channels)
+        pos += frames;
+        if (frames < BLOCK_SIZE)
             break;
     }
+    csc_pcmCloseIn(in);
 
-    // Write out whatever we selected
-    for (i = 0; i < FRAME_SIZE; i++) {
-        for (ci = 0; ci < channels; ci++) {
-            s = selFrame[ci][(i+selOffset[ci])%FRAME_SIZE];
-            write(outFd, &s, sizeof(float));
-        }
+    // Take any remaining snapshots
+    for (ci = 0; ci < channels; ci++) {
+        if (selPending[ci])
+            snapshot(selFrame[ci], history[ci], selIdx[ci]);
     }
 
+    // Write out whatever we selected
+    float *outBuf = allocFloatArr(FRAME_SIZE * channels, 0);
+    csc_pcmInterleave(outBuf, (const void *const *) selFrame, channels,
+        sizeof(float), FRAME_SIZE);
+    if (csc_pcmWrite(outFd, outBuf, FRAME_SIZE * channels * sizeof(float)) < 0)
+        perror("write");
+
     // Clean up
-    freeFloatArr2(curFrame, channels);
+    freeFloatArr2(history, channels);
     freeFloatArr2(selFrame, channels);
-    free(curOffset);
-    free(selOffset);
+    freeFloatArr2(chanBufs, channels);
+    free(delta);
+    free(outBuf);
     free(curVolume);
     free(selVolume);
+    free(selIdx);
+    free(selPending);
 
     if (inFd != 0)
         close(inFd);
@@ -14,20 +14,27 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#define GC_THREADS 1
+#define _POSIX_C_SOURCE 200112L // for fdopen
+
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "arg.h"
+#include "buffer.h"
 #include "cscript.h"
 
 void usage()
 {
     fprintf(stderr,
-        "Use: plip [-c|--config <config file>] [-v] [-i] <input file>\n"
+        "Use: plip [-c|--config <config file>] [-v] [-p] [-i] <input file>\n"
         "Options:\n"
-        "\t-v|--verbose: Verbose mode\n\n");
+        "\t-v|--verbose: Verbose mode\n"
+        "\t-p|--pipeline: Overlap demuxing, audio processing and clipping\n\n");
 }
 
 void slowexit(int val)
@@ -37,6 +44,217 @@ void slowexit(int val)
     exit(val);
 }
 
+// Say if a stage failed
+static bool succeeded(const char *name, int status)
+{
+    if (status == 0)
+        return true;
+    fprintf(stderr, "\n%s failed (%d).\n", name, status);
+    return false;
+}
+
+/* Echo a running stage's output, calling the given function for each line
+ * (with the newline stripped), then return the stage's exit code */
+static int follow(int fd, CSC_Proc proc, void (*onLine)(void *, char *), void *arg)
+{
+    FILE *fh = fdopen(fd, "r");
+    if (!fh) {
+        close(fd);
+        return csc_waitProc(proc);
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), fh)) {
+        fputs(line, stderr);
+        char *nl = strchr(line, '\n');
+        if (nl) {
+            *nl = 0;
+            if (nl > line && nl[-1] == '\r')
+                nl[-1] = 0;
+        }
+        onLine(arg, line);
+    }
+    fclose(fh);
+    return csc_waitProc(proc);
+}
+
+// Run a stage, following its output, and return its exit code
+static int stage(void (*onLine)(void *, char *), void *arg, char *const argv[])
+{
+    CSC_Proc proc;
+    int fd = csc_runpProc(-1, CSC_STDERR, argv, &proc);
+    if (fd < 0)
+        return -1;
+    return follow(fd, proc, onLine, arg);
+}
+
+// A clip running alongside the other stages
+struct Clip {
+    int fd;
+    CSC_Proc proc;
+};
+BUFFER(Clip, struct Clip);
+
+// Start a clip
+static bool startClip(struct Clip *c, char *const argv[])
+{
+    c->fd = csc_runpProc(-1, CSC_STDOUT, argv, &c->proc);
+    return c->fd >= 0;
+}
+
+// Wait for a clip, returning its exit code
+static int waitClip(struct Clip *c)
+{
+    csc_wait(c->fd);
+    return csc_waitProc(c->proc);
+}
+
+// State of a pipelined run
+struct Pipeline {
+    const char *configFile, *inputFile;
+
+    /* Audio clips are started by the thread following audio processing, and
+     * nothing new is started once anything has failed */
+    pthread_mutex_t lock;
+    bool failed;
+
+    int tracks; // audio processing's input: the tracks demux has finished
+    bool videoStarted;
+    struct Clip videoClip;
+    struct Buffer_Clip audioClips; // running audio clips
+
+    // Audio processing, followed in its own thread
+    int aprocFd;
+    CSC_Proc aproc;
+    int aprocStatus;
+};
+
+// Start clipping video, if we haven't yet
+static void startVideo(struct Pipeline *p)
+{
+    if (p->videoStarted)
+        return;
+    char *const argv[] = {
+        "plip-clip", "-C", (char *) p->configFile, "--video-only",
+        (char *) p->inputFile, NULL
+    };
+    p->videoStarted = startClip(&p->videoClip, argv);
+}
+
+/* During demux, start clipping video as soon as all the video tracks are
+ * written, and hand each audio track to audio processing as soon as it's
+ * written, which demux says explicitly */
+static void demuxLine(void *vp, char *line)
+{
+    struct Pipeline *p = vp;
+    if (!strcmp(line, "^PLIP: Video tracks demuxed")) {
+        startVideo(p);
+        return;
+    }
+
+    CORD *track = csc_match("^\\^PLIP: Audio track (.*) demuxed$", line);
+    if (!track || !track[1])
+        return;
+    char *name = CORD_to_char_star(csc_casprintf("%r\n", track[1]));
+    if (write(p->tracks, name, strlen(name)) < 0)
+        fprintf(stderr, "plip: Audio processing is no longer taking tracks\n");
+}
+
+// During audio processing, clip each track as soon as it's processed
+static void aprocLine(void *vp, char *line)
+{
+    struct Pipeline *p = vp;
+    CORD *track = csc_match("^\\^PLIP: Audio track (.*) processed\\.$", line);
+    if (!track || !track[1])
+        track = csc_match("^\\^PLIP: (.*) already processed, skipping\\.$", line);
+    if (!track || !track[1])
+        return;
+
+    char *const argv[] = {
+        "plip-clip", "-C", (char *) p->configFile, "--audio-only",
+        "--track", CORD_to_char_star(track[1]), (char *) p->inputFile, NULL
+    };
+    pthread_mutex_lock(&p->lock);
+    struct Clip c;
+    if (!p->failed && startClip(&c, argv))
+        WRITE_ONE_BUFFER(p->audioClips, c);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Follow audio processing
+static void *aprocThread(void *vp)
+{
+    struct Pipeline *p = vp;
+    p->aprocStatus = follow(p->aprocFd, p->aproc, aprocLine, p);
+    return NULL;
+}
+
+/* Run all the steps, overlapping what we can: video clipping only needs the
+ * demuxed video tracks, each audio track can be processed as soon as it's
+ * demuxed, and clipped as soon as it's processed. Returns false if any step
+ * failed. */
+static bool pipeline(const char *configFile, const char *inputFile)
+{
+    struct Pipeline p;
+    p.configFile = configFile;
+    p.inputFile = inputFile;
+    pthread_mutex_init(&p.lock, NULL);
+    p.failed = false;
+    p.videoStarted = false;
+    INIT_BUFFER(p.audioClips);
+
+#ifndef _WIN32
+    // If audio processing dies, we'll hear about it from its exit code
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    // Audio processing starts first, waiting for tracks
+    int tracks[2];
+    if (!csc_pipe(tracks))
+        CRASH("pipe");
+    char *const aproc[] = {
+        "plip-aproc", "-c", (char *) configFile, "--follow", NULL
+    };
+    p.tracks = tracks[1];
+    p.aprocFd = csc_runpProc(tracks[0], CSC_STDERR, aproc, &p.aproc);
+    if (p.aprocFd < 0) {
+        close(tracks[1]);
+        return succeeded("plip-aproc", -1);
+    }
+    pthread_t aprocTh;
+    if (GC_pthread_create(&aprocTh, NULL, aprocThread, &p) != 0)
+        CRASH("pthread_create");
+
+    // Then demux feeds it
+    char *const demux[] = {
+        "plip-demux", "-c", (char *) configFile, (char *) inputFile, NULL
+    };
+    bool ok = succeeded("plip-demux", stage(demuxLine, &p, demux));
+    close(p.tracks);
+    if (ok) {
+        startVideo(&p);
+    } else {
+        pthread_mutex_lock(&p.lock);
+        p.failed = true;
+        pthread_mutex_unlock(&p.lock);
+    }
+
+    pthread_join(aprocTh, NULL);
+    if (!succeeded("plip-aproc", p.aprocStatus))
+        ok = false;
+
+    // Wait for all the clipping
+    for (size_t ai = 0; ai < p.audioClips.bufused; ai++) {
+        if (!succeeded("plip-clip", waitClip(&p.audioClips.buf[ai])))
+            ok = false;
+    }
+    if (p.videoStarted && !succeeded("plip-clip", waitClip(&p.videoClip)))
+        ok = false;
+
+    FREE_BUFFER(p.audioClips);
+    return ok;
+}
+
 int main(int argc, char **argv)
 {
     ARG_VARS;
@@ -45,12 +263,15 @@ int main(int argc, char **argv)
 
     ARG_NEXT();
     char *inputFile = NULL, *configFile = "-";
+    bool pipelined = false;
     while (argType) {
         ARG(h, help) {
             usage();
             exit(0);
         } else ARG(v, verbose) {
             csc_verbose = true;
+        } else ARG(p, pipeline) {
+            pipelined = true;
         } else ARGN(i, input-file) {
             ARG_GET();
             inputFile = arg;
@@ -76,9 +297,21 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    csc_runl(0, NULL, "plip-demux", "-c", configFile, inputFile, NULL);
-    csc_runl(0, NULL, "plip-aproc", "-c", configFile, NULL);
-    csc_runl(0, NULL, "plip-clip", "-C", configFile, inputFile, NULL);
+    bool ok;
+    if (pipelined) {
+        ok = pipeline(configFile, inputFile);
+    } else {
+        ok = succeeded("plip-demux",
+                csc_runl(0, NULL, "plip-demux", "-c", configFile, inputFile, NULL)) &&
+            succeeded("plip-aproc",
+                csc_runl(0, NULL, "plip-aproc", "-c", configFile, NULL)) &&
+            succeeded("plip-clip",
+                csc_runl(0, NULL, "plip-clip", "-C", configFile, inputFile, NULL));
+    }
+    if (!ok) {
+        printf("\nFailed.\n");
+        slowexit(1);
+    }
     printf("\nComplete.\n");
     slowexit(0);
     return 0;
@@ -1,7 +1,7 @@
 #ifndef LICENSES_H
 #define LICENSES_H 1
 
-const char speexdsp_license[] =
+static const char speexdsp_license[] =
 "Copyright 2002-2008     Xiph.org Foundation\n"
 "Copyright 2002-2008     Jean-Marc Valin\n"
 "Copyright 2005-2007     Analog Devices Inc.\n"
@@ -38,7 +38,7 @@ const char speexdsp_license[] =
 "NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS\n"
 "SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.\n";
 
-const char fftw_license[] =
+static const char fftw_license[] =
 "Copyright (c) 2003, 2007-14 Matteo Frigo\n"
 "Copyright (c) 2003, 2007-14 Massachusetts Institute of Technology\n"
 "\n"
@@ -56,7 +56,7 @@ const char fftw_license[] =
 "along with this program; if not, write to the Free Software\n"
 "Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA\n";
 
-const char nrepel_license[] =
+static const char nrepel_license[] =
 "Copyright 2016 Luciano Dato <lucianodato@gmail.com>\n"
 "\n"
 "This program is free software: you can redistribute it and/or modify\n"
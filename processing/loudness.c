@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Integrated loudness meter, as specified by ITU-R BS.1770-4 and EBU R 128:
+ * K-weighting, 400ms blocks with 75% overlap, an absolute gate at -70 LUFS and
+ * a relative gate 10 LU below the absolutely gated loudness. Only 48kHz audio
+ * is supported, since that's all plip ever produces.
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+#include "arg.h"
+
+// 100ms steps, four of which make a 400ms gating block
+#define STEP_SIZE 4800
+#define STEPS_PER_BLOCK 4
+
+// K-weighting at 48kHz, first the high shelf, then the high pass
+static const double shelfB[3] = {1.53512485958697, -2.69169618940638, 1.19839281085285};
+static const double shelfA[3] = {1.0, -1.69065929318241, 0.73248077421585};
+static const double passB[3] = {1.0, -2.0, 1.0};
+static const double passA[3] = {1.0, -1.99004745483398, 0.99007225036621};
+
+// Direct form II biquad state
+struct Biquad {
+    double z1, z2;
+};
+
+static double biquad(struct Biquad *bq, const double *b, const double *a, double x)
+{
+    double w = x - a[1] * bq->z1 - a[2] * bq->z2;
+    double y = b[0] * w + b[1] * bq->z1 + b[2] * bq->z2;
+    bq->z2 = bq->z1;
+    bq->z1 = w;
+    return y;
+}
+
+void usage()
+{
+    fprintf(stderr,
+        "Use: plip-loudness [-i|--input <input file>] [-o|--output <output file>]\n"
+        "       [-t|--tee] [-f|--format <f32le|s16le>] [-d|--duplicate] [channels]\n"
+        "Options:\n"
+        "\t-t|--tee: Copy the input to stdout (requires -o)\n"
+        "\t-f|--format: Input sample format (default f32le)\n"
+        "\t-d|--duplicate: Measure each channel as if it were duplicated, as a\n"
+        "\t\tdual-mono track is once it's played in stereo\n\n");
+}
+
+// Write all of a buffer
+static int writeAll(int fd, const char *buf, size_t len)
+{
+    while (len) {
+        ssize_t wr = write(fd, buf, len);
+        if (wr <= 0)
+            return -1;
+        buf += wr;
+        len -= wr;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int channels = 1;
+    int tee = 0, s16 = 0, duplicate = 0;
+    char *inFile = NULL, *outFile = NULL;
+    int inFd = 0;
+    FILE *outF = stdout;
+
+    ARG_VARS;
+
+#ifdef _WIN32
+    setmode(0, O_BINARY);
+    setmode(1, O_BINARY);
+#endif
+
+    ARG_NEXT();
+    while (argType) {
+        ARG(h, help) {
+            usage();
+            return 0;
+        } else ARGN(i, input) {
+            ARG_GET();
+            inFile = arg;
+        } else ARGN(o, output) {
+            ARG_GET();
+            outFile = arg;
+        } else ARG(t, tee) {
+            tee = 1;
+        } else ARG(d, duplicate) {
+            duplicate = 1;
+        } else ARGN(f, format) {
+            ARG_GET();
+            if (!strcmp(arg, "s16le")) {
+                s16 = 1;
+            } else if (!strcmp(arg, "f32le")) {
+                s16 = 0;
+            } else {
+                usage();
+                return 1;
+            }
+        } else ARGN(c, channels) {
+            ARG_GET();
+            channels = atoi(arg);
+        } else if (argType == ARG_VAL) {
+            channels = atoi(arg);
+        } else {
+            usage();
+            return 1;
+        }
+        ARG_NEXT();
+    }
+    if (channels < 1 || (tee && !outFile)) {
+        usage();
+        return 1;
+    }
+
+    // Set up I/O
+    if (inFile) {
+        inFd = open(inFile, O_RDONLY
+#ifdef _WIN32
+            |O_BINARY
+#endif
+            );
+        if (inFd < 0) {
+            perror(inFile);
+            return 1;
+        }
+    }
+
+    // Our filter state and the energy of the current 100ms step
+    struct Biquad *shelf = calloc(channels, sizeof(struct Biquad));
+    struct Biquad *pass = calloc(channels, sizeof(struct Biquad));
+    size_t sampleSize = s16 ? sizeof(int16_t) : sizeof(float);
+    size_t frameSize = sampleSize * channels;
+    char *buf = malloc(STEP_SIZE * frameSize);
+    if (!shelf || !pass || !buf) {
+        perror("malloc");
+        return 1;
+    }
+    double stepEnergy[STEPS_PER_BLOCK] = {0};
+    size_t stepCt = 0, stepFill = 0;
+
+    // The mean square of every gating block
+    size_t blockCt = 0, blockSz = 1024;
+    double *blocks = malloc(blockSz * sizeof(double));
+    if (!blocks) {
+        perror("malloc");
+        return 1;
+    }
+
+    size_t bufUsed = 0;
+    while (1) {
+        ssize_t rd = read(inFd, buf + bufUsed, STEP_SIZE * frameSize - bufUsed);
+        if (rd <= 0)
+            break;
+        if (tee && writeAll(1, buf + bufUsed, rd) < 0) {
+            perror("write");
+            return 1;
+        }
+        bufUsed += rd;
+
+        // Filter every complete frame
+        size_t frames = bufUsed / frameSize;
+        for (size_t fi = 0; fi < frames; fi++) {
+            double energy = 0;
+            for (int ci = 0; ci < channels; ci++) {
+                double s;
+                if (s16) {
+                    int16_t v;
+                    memcpy(&v, buf + fi * frameSize + ci * sampleSize, sizeof(v));
+                    s = v / 32768.0;
+                } else {
+                    float v;
+                    memcpy(&v, buf + fi * frameSize + ci * sampleSize, sizeof(v));
+                    s = v;
+                }
+                s = biquad(&shelf[ci], shelfB, shelfA, s);
+                s = biquad(&pass[ci], passB, passA, s);
+                energy += s * s;
+            }
+            if (duplicate)
+                energy *= 2;
+            stepEnergy[stepCt % STEPS_PER_BLOCK] += energy;
+
+            if (++stepFill < STEP_SIZE)
+                continue;
+
+            // Finished a step, so maybe a block
+            stepFill = 0;
+            stepCt++;
+            if (stepCt >= STEPS_PER_BLOCK) {
+                double blockEnergy = 0;
+                for (int si = 0; si < STEPS_PER_BLOCK; si++)
+                    blockEnergy += stepEnergy[si];
+                if (blockCt >= blockSz) {
+                    blockSz *= 2;
+                    blocks = realloc(blocks, blockSz * sizeof(double));
+                    if (!blocks) {
+                        perror("realloc");
+                        return 1;
+                    }
+                }
+                blocks[blockCt++] = blockEnergy / (STEP_SIZE * STEPS_PER_BLOCK);
+            }
+            stepEnergy[stepCt % STEPS_PER_BLOCK] = 0;
+        }
+
+        // Keep any partial frame
+        memmove(buf, buf + frames * frameSize, bufUsed - frames * frameSize);
+        bufUsed -= frames * frameSize;
+    }
+
+    // Absolute gate at -70 LUFS
+    double absGate = pow(10, (-70 + 0.691) / 10);
+    double sum = 0;
+    size_t ct = 0;
+    for (size_t bi = 0; bi < blockCt; bi++) {
+        if (blocks[bi] > absGate) {
+            sum += blocks[bi];
+            ct++;
+        }
+    }
+
+    // Relative gate 10 LU below that
+    double loudness = -INFINITY;
+    if (ct) {
+        double relGate = sum / ct * pow(10, -10.0 / 10);
+        if (relGate < absGate)
+            relGate = absGate;
+        sum = 0;
+        ct = 0;
+        for (size_t bi = 0; bi < blockCt; bi++) {
+            if (blocks[bi] > relGate) {
+                sum += blocks[bi];
+                ct++;
+            }
+        }
+        if (ct)
+            loudness = -0.691 + 10 * log10(sum / ct);
+    }
+
+    // Write out the result
+    if (outFile) {
+        outF = fopen(outFile, "w");
+        if (!outF) {
+            perror(outFile);
+            return 1;
+        }
+    }
+    fprintf(outF, "%f\n", loudness);
+
+    // Clean up
+    free(shelf);
+    free(pass);
+    free(buf);
+    free(blocks);
+    if (outF != stdout)
+        fclose(outF);
+    if (inFd != 0)
+        close(inFd);
+
+    return 0;
+}
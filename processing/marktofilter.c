@@ -21,12 +21,26 @@
 #include <sys/types.h>
 
 #include "arg.h"
+#include "buffer.h"
 #include "configfile.h"
 #include "cscript.h"
 
 #define BUFSZ 4096
 
+/* A kept part of the input, for the linear graph */
+struct Selection {
+    double start, end, speed;
+    int discard;
+};
+
+BUFFER(selection, struct Selection);
+
 char *getMarkLine(char *buf, int bufsz, FILE *stream);
+static void addSelection(struct Buffer_selection *sels, double start,
+    double end, double speed, int discard);
+static void linearSelect(FILE *outFile, struct Buffer_selection *sels,
+    int discarded);
+static void linearPTS(FILE *outFile, struct Buffer_selection *sels);
 
 int main(int argc, char **argv)
 {
@@ -52,6 +66,10 @@ int main(int argc, char **argv)
     int arate = 48000;
     int akeep = 0;
     int adiscard = 0;
+    int segments = 0;
+    int linear = 0;
+    int graph;
+    struct Buffer_selection aSels, vSels;
     double ffLen = 8;
     double minFFSpeed = 4;
     double maxFFPitch = INFINITY;
@@ -72,6 +90,8 @@ int main(int argc, char **argv)
         ARGNV(v, video, video)
         ARGV(k, audio-keep, akeep)
         ARGLV(audio-discard, adiscard)
+        ARGV(s, segments, segments)
+        ARGV(l, linear, linear)
         ARGN(c, config) {
             ARG_GET();
             configFile = arg;
@@ -114,10 +134,40 @@ int main(int argc, char **argv)
         outFile = stdout;
     }
 
+    /* in segment mode, instead of a filter graph, we list the segments to
+     * keep, one per line: the start and end to seek to, the speed it's played
+     * at (1 unless it's fast-forwarded), and the filter for just that
+     * segment, for either the audio or the video */
+    if (segments && audio)
+        video = NULL;
+
+    /* in linear mode, we select every kept part out of a single stream, then
+     * move them all together, so the graph doesn't grow with the number of
+     * selections. That can't speed up audio or filter fast-forwarded video,
+     * so if we'd need to, fall back to a full graph. */
+    if (segments)
+        linear = 0;
+    if (linear && inFile &&
+        ((audio && !akeep && !adiscard) || (video && strcmp(ffFilter, "null")))) {
+        int restart = chosenRestart;
+        while (getMarkLine(buf, BUFSZ, inFile)) {
+            if (buf[0] == 'r') {
+                restart--;
+            } else if (buf[0] == 'n' && restart == 0) {
+                linear = 0;
+                break;
+            }
+        }
+        rewind(inFile);
+    }
+    graph = !segments && !linear;
+    INIT_BUFFER(aSels);
+    INIT_BUFFER(vSels);
+
     /* start with the audio ready */
-    if (audio)
+    if (audio && graph)
         fprintf(outFile, "[%s]anull[aut];\n", audio);
-    if (video)
+    if (video && graph)
         fprintf(outFile, "[%s]null[vit];\n", video);
 
     /* go step by step */
@@ -143,12 +193,21 @@ int main(int argc, char **argv)
                     /* ffmpeg complains if you trim to length 0 */
                     if (val <= lastIn)
                         val = lastIn + 0.001;
-                    if (audio) {
+                    if (linear) {
+                        if (audio) addSelection(&aSels, lastIn, val, 1, 0);
+                        if (video) addSelection(&vSels, lastIn, val, 1, 0);
+                    } else if (segments && audio) {
+                        fprintf(outFile, "%f %f 1 asetpts=PTS-STARTPTS\n",
+                                          lastIn, val);
+                    } else if (segments && video) {
+                        fprintf(outFile, "%f %f 1 setpts=PTS-STARTPTS,fps=%d:start_time=0\n",
+                                          lastIn, val,                    fps);
+                    } else if (audio) {
                         fprintf(outFile, "[aut]asplit[auu][aut];\n"
                                "[auu]atrim=%f:%f,asetpts=PTS-STARTPTS[au%d];\n",
                                            lastIn, val, selections);
                     }
-                    if (video) {
+                    if (video && graph) {
                         fprintf(outFile, "[vit]split[viu][vit];\n"
                                "[viu]trim=%f:%f,setpts=PTS-STARTPTS[vi%d];\n",
                                            lastIn, val, selections);
@@ -187,7 +246,30 @@ int main(int argc, char **argv)
                     }
 
                     /* now make the commands */
-                    if (audio) {
+                    if (linear) {
+                        /* audio is only kept or discarded here */
+                        if (audio) addSelection(&aSels, lastIn, lastIn + outLen, 1, adiscard);
+                        if (video) addSelection(&vSels, lastIn, val, vspeedup, 0);
+                    } else if (audio && segments) {
+                        if (adiscard) {
+                            fprintf(outFile, "%f %f 1 volume=0\n",
+                                              lastIn, lastIn + outLen);
+                        } else if (akeep) {
+                            fprintf(outFile, "%f %f 1 asetpts=PTS-STARTPTS\n",
+                                              lastIn, lastIn + outLen);
+                        } else {
+                            fprintf(outFile, "%f %f %f asetpts=PTS-STARTPTS,aresample=%d,asetrate=%f,aresample=%d",
+                                              lastIn, val+len, vspeedup,           arate, arate*aspeedup, arate);
+                            while (tempoup > 2) {
+                                fprintf(outFile, ",atempo=2");
+                                tempoup /= 2;
+                            }
+                            if (tempoup != 1) fprintf(outFile, ",atempo=%f", tempoup);
+                            fprintf(outFile, ",aresample=%d,atrim=0:%f\n",
+                                               arate, outLen);
+                        }
+
+                    } else if (audio) {
                         if (!adiscard) fprintf(outFile, "[aut]asplit[auu][aut];\n");
                         if (adiscard) {
                             /* actually don't want anything here! */
@@ -211,7 +293,11 @@ int main(int argc, char **argv)
                         }
                     }
 
-                    if (video) {
+                    if (video && segments) {
+                        fprintf(outFile, "%f %f %f setpts=(PTS-STARTPTS)/%f,fps=%d:start_time=0,trim=0:%f,%s\n",
+                                          lastIn, val+len, vspeedup, vspeedup, fps,                outLen, ffFilter);
+
+                    } else if (video && graph) {
                         fprintf(outFile, "[vit]split[viu][vit];\n"
                                "[viu]trim=%f:%f,setpts=(PTS-STARTPTS)/%f,\n"
                                "     fps=%d:start_time=0,trim=0:%f,%s[vi%d];\n",
@@ -254,7 +340,7 @@ int main(int argc, char **argv)
         fprintf(outFile, "%d\n", restartCount);
 
     /* now bring together all our audio */
-    if (audio) {
+    if (audio && graph) {
         fprintf(outFile, "[aut]atrim=0:0[aut];\n[aut]");
         for (i = 0; i < selections; i++)
             fprintf(outFile, "[au%d]", i);
@@ -262,13 +348,44 @@ int main(int argc, char **argv)
     }
 
     /* and all our video */
-    if (video) {
+    if (video && graph) {
         fprintf(outFile, "[vit]trim=0:0[vit];\n[vit]");
         for (i = 0; i < selections; i++)
             fprintf(outFile, "[vi%d]", i);
         fprintf(outFile, "concat=n=%d:v=1:a=0,fps=%d:start_time=0[vid]\n", selections + 1, fps);
     }
 
+    /* or select all our audio at once. aselect only selects whole frames, so
+     * cut the audio into 10ms frames first. Each frame is placed by the same
+     * expression as video, rather than by counting samples, so that the
+     * audio can't drift from the video over many cuts, and aresample fills
+     * or trims any gap that leaves. */
+    if (audio && linear) {
+        fprintf(outFile, "[%s]asetnsamples=n=%d:p=0,aselect='", audio, arate / 100);
+        linearSelect(outFile, &aSels, 0);
+        fprintf(outFile, "'");
+        if (adiscard) {
+            fprintf(outFile, ",volume='1-(");
+            linearSelect(outFile, &aSels, 1);
+            fprintf(outFile, ")':eval=frame");
+        }
+        fprintf(outFile, ",asetpts='");
+        linearPTS(outFile, &aSels);
+        fprintf(outFile, "',aresample=async=1[aud]%s\n", video ? ";" : "");
+    }
+
+    /* and all our video */
+    if (video && linear) {
+        fprintf(outFile, "[%s]select='", video);
+        linearSelect(outFile, &vSels, 0);
+        fprintf(outFile, "',setpts='");
+        linearPTS(outFile, &vSels);
+        fprintf(outFile, "',fps=%d:start_time=0[vid]\n", fps);
+    }
+
+    FREE_BUFFER(aSels);
+    FREE_BUFFER(vSels);
+
     if (inFile) fclose(inFile);
     if (outFile != stdout) fclose(outFile);
 
@@ -298,3 +415,55 @@ char *getMarkLine(char *buf, int bufsz, FILE *stream)
 
     return buf;
 }
+
+/* Add a kept part for the linear graph */
+static void addSelection(struct Buffer_selection *sels, double start,
+    double end, double speed, int discard)
+{
+    struct Selection sel = {start, end, speed, discard};
+    WRITE_ONE_BUFFER(*sels, sel);
+}
+
+/* Write an expression that's true for frames (at time t) in a kept part, or
+ * only in the discarded ones */
+static void linearSelect(FILE *outFile, struct Buffer_selection *sels,
+    int discarded)
+{
+    int any = 0;
+    for (size_t si = 0; si < sels->bufused; si++) {
+        struct Selection *sel = &sels->buf[si];
+        if (discarded && !sel->discard)
+            continue;
+        fprintf(outFile, "%sgte(t,%f)*lt(t,%f)", any ? "+" : "",
+                                sel->start,  sel->end);
+        any = 1;
+    }
+    if (!any)
+        fprintf(outFile, "0");
+}
+
+/* Write an expression for the output timestamp of a selected frame (at time
+ * T). Each part starts where the last ended, and runs at its own speed, so the
+ * output time is a line in T within each part. Starting each part just adjusts
+ * the line, which keeps the expression linear in the number of parts. */
+static void linearPTS(FILE *outFile, struct Buffer_selection *sels)
+{
+    double out = 0, lastC = 0, lastM = 0;
+    fprintf(outFile, "(0");
+    for (size_t si = 0; si < sels->bufused; si++) {
+        struct Selection *sel = &sels->buf[si];
+        double m = 1 / sel->speed;
+        double c = out - sel->start * m;
+        if (m == lastM) {
+            fprintf(outFile, "+gte(T,%f)*(%f)",
+                                sel->start, c - lastC);
+        } else {
+            fprintf(outFile, "+gte(T,%f)*(%f+T*%f)",
+                                sel->start, c - lastC, m - lastM);
+        }
+        out += (sel->end - sel->start) * m;
+        lastC = c;
+        lastM = m;
+    }
+    fprintf(outFile, ")/TB");
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "atomicfile.h"
+#include "helpers.h"
+#include "noiseprofile.h"
+
+// Store files start with this
+#define MAGIC "PLIPNP1\n"
+#define MAGIC_SZ 8
+
+// Sanity limits for reading
+#define MAX_TRACK_NAME 4096
+#define MAX_CHANNELS 64
+
+/* The smallest a stored profile can be: an empty name, and one channel. Used
+ * to bound the profile count by the file size. */
+#define MIN_PROFILE_SZ (sizeof(uint32_t) + sizeof(uint64_t) + sizeof(int64_t) + \
+    2 * sizeof(uint32_t) + (2 + CSC_NOISE_PROFILE_BINS) * sizeof(float))
+
+
+// Allocate an empty profile
+CSC_NoiseProfile *csc_noiseProfileNew(const char *track, int channels)
+{
+    CSC_NoiseProfile *ret;
+    SF(ret, calloc, NULL, (1, sizeof(CSC_NoiseProfile)));
+    size_t len = strlen(track);
+    SF(ret->track, calloc, NULL, (1, len + 1));
+    memcpy(ret->track, track, len);
+    ret->channels = channels;
+    SF(ret->amounts, calloc, NULL, (1, channels * sizeof(float)));
+    SF(ret->windowCounts, calloc, NULL, (1, channels * sizeof(float)));
+    SF(ret->bins, calloc, NULL, (1, channels * CSC_NOISE_PROFILE_BINS * sizeof(float)));
+    return ret;
+}
+
+// Read one profile
+static CSC_NoiseProfile *readProfile(FILE *fh)
+{
+    uint32_t nameLen, channels, bins;
+    CSC_NoiseProfile *ret;
+    char *name;
+
+    if (fread(&nameLen, sizeof(nameLen), 1, fh) != 1 || nameLen > MAX_TRACK_NAME)
+        return NULL;
+    SF(name, calloc, NULL, (1, nameLen + 1));
+    if (fread(name, 1, nameLen, fh) != nameLen) {
+        free(name);
+        return NULL;
+    }
+    uint64_t fingerprint;
+    int64_t learned;
+    if (fread(&fingerprint, sizeof(fingerprint), 1, fh) != 1 ||
+        fread(&learned, sizeof(learned), 1, fh) != 1 ||
+        fread(&channels, sizeof(channels), 1, fh) != 1 ||
+        fread(&bins, sizeof(bins), 1, fh) != 1 ||
+        channels < 1 || channels > MAX_CHANNELS ||
+        bins != CSC_NOISE_PROFILE_BINS) {
+        free(name);
+        return NULL;
+    }
+
+    ret = csc_noiseProfileNew(name, channels);
+    free(name);
+    ret->fingerprint = fingerprint;
+    ret->learned = learned;
+    if (fread(ret->amounts, sizeof(float), channels, fh) != channels ||
+        fread(ret->windowCounts, sizeof(float), channels, fh) != channels ||
+        fread(ret->bins, sizeof(float) * bins, channels, fh) != channels) {
+        csc_noiseProfileFree(ret);
+        return NULL;
+    }
+    return ret;
+}
+
+// Read every profile in a store
+int csc_noiseProfileRead(const char *file, CSC_NoiseProfile ***profiles)
+{
+    char magic[MAGIC_SZ];
+    uint32_t count, pi;
+    long pos, sz;
+    FILE *fh = fopen(file, "rb");
+
+    *profiles = NULL;
+    if (!fh)
+        return (access(file, F_OK) == 0) ? -1 : 0;
+
+    if (fread(magic, 1, MAGIC_SZ, fh) != MAGIC_SZ ||
+        memcmp(magic, MAGIC, MAGIC_SZ) ||
+        fread(&count, sizeof(count), 1, fh) != 1) {
+        fclose(fh);
+        return -1;
+    }
+
+    // Don't trust the count further than the file could hold
+    if ((pos = ftell(fh)) < 0 ||
+        fseek(fh, 0, SEEK_END) != 0 ||
+        (sz = ftell(fh)) < pos ||
+        fseek(fh, pos, SEEK_SET) != 0 ||
+        count > (unsigned long) (sz - pos) / MIN_PROFILE_SZ) {
+        fclose(fh);
+        return -1;
+    }
+
+    SF(*profiles, calloc, NULL, (1, (count + 1) * sizeof(CSC_NoiseProfile *)));
+    for (pi = 0; pi < count; pi++) {
+        (*profiles)[pi] = readProfile(fh);
+        if (!(*profiles)[pi]) {
+            csc_noiseProfileFreeAll(*profiles, pi);
+            *profiles = NULL;
+            fclose(fh);
+            return -1;
+        }
+    }
+
+    fclose(fh);
+    return count;
+}
+
+// Write one profile
+static int writeProfile(FILE *fh, const CSC_NoiseProfile *p)
+{
+    uint32_t nameLen = strlen(p->track);
+    uint64_t fingerprint = p->fingerprint;
+    int64_t learned = p->learned;
+    uint32_t channels = p->channels, bins = CSC_NOISE_PROFILE_BINS;
+    if (fwrite(&nameLen, sizeof(nameLen), 1, fh) != 1 ||
+        fwrite(p->track, 1, nameLen, fh) != nameLen ||
+        fwrite(&fingerprint, sizeof(fingerprint), 1, fh) != 1 ||
+        fwrite(&learned, sizeof(learned), 1, fh) != 1 ||
+        fwrite(&channels, sizeof(channels), 1, fh) != 1 ||
+        fwrite(&bins, sizeof(bins), 1, fh) != 1 ||
+        fwrite(p->amounts, sizeof(float), channels, fh) != channels ||
+        fwrite(p->windowCounts, sizeof(float), channels, fh) != channels ||
+        fwrite(p->bins, sizeof(float) * bins, channels, fh) != channels)
+        return -1;
+    return 0;
+}
+
+// Write a store
+int csc_noiseProfileWrite(const char *file, CSC_NoiseProfile **profiles, int count)
+{
+    uint32_t count32 = count;
+    int pi, ret = 0;
+    CSC_AtomicFile *af = csc_atomicOpen(file);
+    if (!af)
+        return -1;
+
+    if (fwrite(MAGIC, 1, MAGIC_SZ, af->fh) != MAGIC_SZ ||
+        fwrite(&count32, sizeof(count32), 1, af->fh) != 1)
+        ret = -1;
+    for (pi = 0; pi < count && ret == 0; pi++)
+        ret = writeProfile(af->fh, profiles[pi]);
+
+    // Replace the old store
+    return csc_atomicClose(af, ret == 0);
+}
+
+// Add a profile to a store
+int csc_noiseProfileStore(const char *file, const CSC_NoiseProfile *profile)
+{
+    CSC_NoiseProfile **profiles;
+    int count, pi, ret;
+
+    count = csc_noiseProfileRead(file, &profiles);
+    if (count < 0) {
+        // Unreadable, so start over
+        count = 0;
+    }
+    if (!profiles)
+        SF(profiles, calloc, NULL, (1, sizeof(CSC_NoiseProfile *)));
+
+    // Replace the track's profile, or add it
+    for (pi = 0; pi < count; pi++) {
+        if (!strcmp(profiles[pi]->track, profile->track))
+            break;
+    }
+    if (pi == count) {
+        CSC_NoiseProfile **np = realloc(profiles, (count + 1) * sizeof(CSC_NoiseProfile *));
+        if (!np) {
+            perror("realloc");
+            exit(1);
+        }
+        profiles = np;
+        count++;
+    } else {
+        csc_noiseProfileFree(profiles[pi]);
+    }
+    profiles[pi] = (CSC_NoiseProfile *) profile;
+
+    ret = csc_noiseProfileWrite(file, profiles, count);
+
+    // The caller's profile isn't ours to free
+    profiles[pi] = NULL;
+    csc_noiseProfileFreeAll(profiles, count);
+    return ret;
+}
+
+// Find a track's profile
+CSC_NoiseProfile *csc_noiseProfileFind(CSC_NoiseProfile **profiles, int count,
+    const char *track)
+{
+    for (int pi = 0; pi < count; pi++) {
+        if (!strcmp(profiles[pi]->track, track))
+            return profiles[pi];
+    }
+    return NULL;
+}
+
+void csc_noiseProfileFree(CSC_NoiseProfile *profile)
+{
+    if (!profile)
+        return;
+    free(profile->track);
+    free(profile->amounts);
+    free(profile->windowCounts);
+    free(profile->bins);
+    free(profile);
+}
+
+void csc_noiseProfileFreeAll(CSC_NoiseProfile **profiles, int count)
+{
+    if (!profiles)
+        return;
+    for (int pi = 0; pi < count; pi++)
+        csc_noiseProfileFree(profiles[pi]);
+    free(profiles);
+}
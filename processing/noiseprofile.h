@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NOISEPROFILE_H
+#define NOISEPROFILE_H 1
+
+/* Bins in a noise-repellent noise profile (NREPEL_PROFILE_SIZE) */
+#define CSC_NOISE_PROFILE_BINS 1025
+
+/* A learned noise profile for one track. Profiles are kept in a store file,
+ * which holds any number of them, in native byte order. */
+typedef struct CSC_NoiseProfile_ {
+    char *track;
+    unsigned long long fingerprint; // of whatever the profile depends on
+    long long learned; // time learned, in seconds since the epoch
+    int channels;
+    float *amounts; // reduction amount, per channel
+    float *windowCounts; // windows learned from, per channel
+    float *bins; // CSC_NOISE_PROFILE_BINS per channel
+} CSC_NoiseProfile;
+
+/* Allocate an empty profile for the given number of channels */
+CSC_NoiseProfile *csc_noiseProfileNew(const char *track, int channels);
+
+/* Read every profile in a store. Returns the number of profiles and sets
+ * *profiles to an array of them, or returns -1 if the store can't be read. A
+ * missing store is empty. */
+int csc_noiseProfileRead(const char *file, CSC_NoiseProfile ***profiles);
+
+/* Write a store, replacing it atomically. Returns 0 or -1 on error. */
+int csc_noiseProfileWrite(const char *file, CSC_NoiseProfile **profiles, int count);
+
+/* Add a profile to a store, replacing any profile for the same track. Not safe
+ * against concurrent updates. Returns 0 or -1 on error. */
+int csc_noiseProfileStore(const char *file, const CSC_NoiseProfile *profile);
+
+/* Find a track's profile in a list, or NULL */
+CSC_NoiseProfile *csc_noiseProfileFind(CSC_NoiseProfile **profiles, int count,
+    const char *track);
+
+void csc_noiseProfileFree(CSC_NoiseProfile *profile);
+void csc_noiseProfileFreeAll(CSC_NoiseProfile **profiles, int count);
+
+#endif
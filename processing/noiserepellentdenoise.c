@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef _WIN32
@@ -28,6 +29,11 @@
 #endif
 
 #include "arg.h"
+#include "chanpipe.h"
+#include "chunkpipe.h"
+#include "pcmio.h"
+
+#include "noiseprofile.h"
 
 #include "nrepel.h"
 
@@ -35,21 +41,135 @@
 
 #define FRAME_SIZE 960
 
+// Defaults for chunked processing, in seconds
+#define CHUNK_SECONDS 30
+#define WARMUP_SECONDS 5
+
+// Crossfade between chunks, in STFT hops
+#define FADE_HOPS 4
+
+// Passes over the one-second noise sample when learning
+#define LEARN_REPEATS 128
+
+// Track name for saved profiles, if not given
+#define DEFAULT_TRACK "noise"
+
 void usage()
 {
-    fprintf(stderr, "Use: plip-noiserepellentdenoise [-i|--input <input file>] [-o|--output <output file>] [channels]\n\n");
+    fprintf(stderr,
+        "Use: plip-noiserepellentdenoise [-i|--input <input file>] [-o|--output <output file>]\n"
+        "       [-l|--learn <noise file>] [-j|--jobs <count>]\n"
+        "       [-P|--load-profile <profile file>] [-S|--save-profile <profile file>]\n"
+        "       [-t|--track <profile name>] [-w|--wisdom <FFTW wisdom file>]\n"
+        "       [--tier best|balanced|fast]\n"
+        "       [--chunk <seconds>] [--warmup <seconds>] [channels]\n\n");
+}
+
+// Speed and quality tiers, indexed by NrepelTier
+static const char *tiers[] = {"best", "balanced", "fast", NULL};
+
+// Per-channel denoiser state
+struct Denoiser {
+    int tier;
+    void **sts;
+    float **outFrames;
+
+    // For chunked processing, what each channel's instances start with
+    float *amounts;
+    float **profiles;
+    float *windowCounts;
+};
+
+// Denoise one frame of one channel
+static void denoise(void *vd, int channel, void *frame, size_t frames)
+{
+    struct Denoiser *d = vd;
+    nrepel_connect_port(d->sts[channel], NREPEL_INPUT, frame);
+    nrepel_run(d->sts[channel], frames);
+    memcpy(frame, d->outFrames[channel], frames * sizeof(float));
+}
+
+// Round seconds up to whole STFT hops
+static size_t hops(double seconds)
+{
+    size_t frames = seconds * 48000;
+    return (frames + NREPEL_HOP - 1) / NREPEL_HOP * NREPEL_HOP;
+}
+
+/* Ease an instance out of soft bypass, which it does a step at a time each run,
+ * as if it had been learning run by run */
+static void easeIn(void *st)
+{
+    for (int i = 0; i < LEARN_REPEATS; i++)
+        nrepel_run(st, 0);
+}
+
+// Make a new instance for a channel, in the state learning left it in
+static void *instantiate(struct Denoiser *d, int channel)
+{
+    float v;
+    void *st = nrepel_instantiate_tier(48000, d->tier);
+    v = 25;
+    nrepel_connect_port(st, NREPEL_WHITENING, &v);
+    nrepel_connect_port(st, NREPEL_AMOUNT, &d->amounts[channel]);
+    if (d->profiles[channel]) {
+        nrepel_set_profile(st, d->profiles[channel], d->windowCounts[channel]);
+        easeIn(st);
+    } else {
+        v = 1;
+        nrepel_connect_port(st, NREPEL_N_ADAPTIVE, &v);
+    }
+    return st;
+}
+
+/* Denoise a chunk of every channel with fresh instances, batched to transform
+ * all the channels together */
+static void denoiseChunk(void *vd, float *const *chans, size_t warmup, size_t frames)
+{
+    struct Denoiser *d = vd;
+    int channels, ci;
+    void *batch;
+
+    for (channels = 0; d->sts[channels]; channels++);
+    void *sts[channels];
+    for (ci = 0; ci < channels; ci++)
+        sts[ci] = instantiate(d, ci);
+    // Batching fails if the instances aren't in step, so then run them alone
+    batch = nrepel_batch(sts, channels);
+
+    // In frames, since soft bypass eases in per run
+    for (size_t off = 0; off < frames; off += FRAME_SIZE) {
+        size_t len = frames - off < FRAME_SIZE ? frames - off : FRAME_SIZE;
+        for (ci = 0; ci < channels; ci++) {
+            nrepel_connect_port(sts[ci], NREPEL_INPUT, chans[ci] + off);
+            nrepel_connect_port(sts[ci], NREPEL_OUTPUT, chans[ci] + off);
+        }
+        if (batch) {
+            nrepel_batch_run(batch, len);
+        } else {
+            for (ci = 0; ci < channels; ci++)
+                nrepel_run(sts[ci], len);
+        }
+    }
+
+    if (batch)
+        nrepel_batch_cleanup(batch);
+    for (ci = 0; ci < channels; ci++)
+        nrepel_cleanup(sts[ci]);
 }
 
 int main(int argc, char **argv)
 {
-    size_t frameCt, frameSz;
-    float *rawFrame;
-    float *inFrame, *outFrame, latency;
+    float **outFrames, latency;
     int i, oi, ci;
-    int channels = 1;
-    ssize_t rd, total;
+    int channels = 1, jobs = 1;
+    double chunkSeconds = CHUNK_SECONDS, warmupSeconds = WARMUP_SECONDS;
     void **sts;
+    struct Denoiser denoiser;
     char *inFile = NULL, *outFile = NULL, *learnFile = NULL;
+    char *loadFile = NULL, *saveFile = NULL, *track = DEFAULT_TRACK;
+    char *wisdomFile = NULL;
+    int tier = NREPEL_TIER_BEST;
     int inFd = 0, outFd = 1, learnFd;
 
     ARG_VARS;
@@ -79,6 +199,34 @@ int main(int argc, char **argv)
         } else ARGN(l, learn) {
             ARG_GET();
             learnFile = arg;
+        } else ARGN(P, load-profile) {
+            ARG_GET();
+            loadFile = arg;
+        } else ARGN(S, save-profile) {
+            ARG_GET();
+            saveFile = arg;
+        } else ARGN(t, track) {
+            ARG_GET();
+            track = arg;
+        } else ARGN(w, wisdom) {
+            ARG_GET();
+            wisdomFile = arg;
+        } else ARGLN(tier) {
+            ARG_GET();
+            for (tier = 0; tiers[tier] && strcmp(tiers[tier], arg); tier++);
+            if (!tiers[tier]) {
+                usage();
+                return 1;
+            }
+        } else ARGN(j, jobs) {
+            ARG_GET();
+            jobs = atoi(arg);
+        } else ARGLN(chunk) {
+            ARG_GET();
+            chunkSeconds = atof(arg);
+        } else ARGLN(warmup) {
+            ARG_GET();
+            warmupSeconds = atof(arg);
         } else if (argType == ARG_VAL) {
             channels = atoi(arg);
         } else {
@@ -123,76 +271,89 @@ int main(int argc, char **argv)
         }
     }
 
-    // Allocate our frames
-    frameCt = FRAME_SIZE * channels;
-    frameSz = frameCt * sizeof(float);
-    rawFrame = malloc(frameSz);
-    if (!rawFrame) {
-        perror("malloc");
-        return 1;
-    }
-    inFrame = malloc(FRAME_SIZE * sizeof(float));
-    if (!inFrame) {
-        perror("malloc");
-        return 1;
-    }
-    outFrame = malloc(FRAME_SIZE * sizeof(float));
-    if (!outFrame) {
-        perror("malloc");
-        return 1;
-    }
+    // Measure FFT plans once per machine
+    if (wisdomFile)
+        nrepel_wisdom(wisdomFile);
 
     // And our denoiser state
-    sts = malloc(channels * sizeof(void *));
-    if (!sts) {
+    sts = calloc(channels + 1, sizeof(void *));
+    denoiser.tier = tier;
+    denoiser.amounts = malloc(channels * sizeof(float));
+    denoiser.profiles = calloc(channels, sizeof(float *));
+    denoiser.windowCounts = calloc(channels, sizeof(float));
+    if (!sts || !denoiser.amounts || !denoiser.profiles || !denoiser.windowCounts) {
         perror("malloc");
         return 1;
     }
     for (ci = 0; ci < channels; ci++) {
         float v;
-        sts[ci] = nrepel_instantiate(48000);
+        sts[ci] = nrepel_instantiate_tier(48000, tier);
         nrepel_connect_port(sts[ci], NREPEL_LATENCY, &latency);
         v = 1;
-        if (learnFile)
-            nrepel_connect_port(sts[ci], NREPEL_N_LEARN, &v);
-        else
+        if (!learnFile && !loadFile)
             nrepel_connect_port(sts[ci], NREPEL_N_ADAPTIVE, &v);
         v = 25;
         nrepel_connect_port(sts[ci], NREPEL_WHITENING, &v);
     }
 
-    // If we're learning, learn!
-    if (learnFile) {
-        float *learnBuf, *learnIn, *learnOut;
-        size_t learnRd, learnSz;
-        ssize_t rd;
-        learnSz = 48000*channels;
-        learnBuf = malloc(learnSz * sizeof(float));
-        if (learnBuf == NULL) {
-            perror("malloc");
+    // If we have a profile already, use it
+    if (loadFile) {
+        CSC_NoiseProfile **profiles, *profile;
+        int count = csc_noiseProfileRead(loadFile, &profiles);
+        if (count < 0) {
+            fprintf(stderr, "%s: Invalid noise profile file\n", loadFile);
             return 1;
         }
-        learnIn = malloc(48000 * sizeof(float));
-        if (learnIn == NULL) {
-            perror("malloc");
+        profile = csc_noiseProfileFind(profiles, count, track);
+        if (!profile) {
+            fprintf(stderr, "%s: No noise profile for %s\n", loadFile, track);
             return 1;
         }
-        learnOut = malloc(48000 * sizeof(float));
-        if (learnOut == NULL) {
+        if (profile->channels != channels) {
+            fprintf(stderr, "%s: Noise profile for %s has %d channels, not %d\n",
+                loadFile, track, profile->channels, channels);
+            return 1;
+        }
+
+        for (ci = 0; ci < channels; ci++) {
+            denoiser.amounts[ci] = profile->amounts[ci];
+            denoiser.windowCounts[ci] = profile->windowCounts[ci];
+            denoiser.profiles[ci] = malloc(NREPEL_PROFILE_SIZE * sizeof(float));
+            if (!denoiser.profiles[ci]) {
+                perror("malloc");
+                return 1;
+            }
+            memcpy(denoiser.profiles[ci],
+                profile->bins + ci * CSC_NOISE_PROFILE_BINS,
+                NREPEL_PROFILE_SIZE * sizeof(float));
+
+            // Put the serial instance in the state learning would have
+            nrepel_connect_port(sts[ci], NREPEL_AMOUNT, &denoiser.amounts[ci]);
+            nrepel_set_profile(sts[ci], denoiser.profiles[ci],
+                denoiser.windowCounts[ci]);
+            easeIn(sts[ci]);
+        }
+
+        csc_noiseProfileFreeAll(profiles, count);
+
+    } else if (learnFile) {
+        // If we're learning, learn!
+        const float *learnBuf;
+        float *learnIn;
+        size_t learnRd, learnSz;
+        CSC_PcmIn *learnPcm;
+        learnSz = 48000*channels;
+        learnIn = malloc(48000 * sizeof(float));
+        if (learnIn == NULL) {
             perror("malloc");
             return 1;
         }
 
         // Read it in
-        learnRd = 0;
-        while (learnRd < learnSz) {
-            rd = read(learnFd, ((char *) learnBuf) + learnRd, learnSz);
-            if (rd <= 0)
-                break;
-            learnRd += rd;
-        }
-        if (learnRd < learnSz) {
-            perror(learnFile);
+        learnPcm = csc_pcmOpenIn(learnFd);
+        learnBuf = csc_pcmRead(learnPcm, learnSz * sizeof(float), &learnRd);
+        if (learnRd < learnSz * sizeof(float)) {
+            fprintf(stderr, "%s: Not enough noise to learn from\n", learnFile);
             return 1;
         }
 
@@ -200,9 +361,6 @@ int main(int argc, char **argv)
         for (ci = 0; ci < channels; ci++) {
             float max, ra;
 
-            nrepel_connect_port(sts[ci], NREPEL_INPUT, learnIn);
-            nrepel_connect_port(sts[ci], NREPEL_OUTPUT, learnOut);
-
             // Extract one channel
             for (i = ci, oi = 0;
                  i < learnSz;
@@ -224,78 +382,104 @@ int main(int argc, char **argv)
             if (ra < 12)
                 ra = 12;
             nrepel_connect_port(sts[ci], NREPEL_AMOUNT, &ra);
+            denoiser.amounts[ci] = ra;
 
-            // Process it many times to learn
-            for (i = 0; i < 128; i++)
-                nrepel_run(sts[ci], 48000);
+            // Learn from it
+            nrepel_learn(sts[ci], learnIn, 48000, LEARN_REPEATS);
+            easeIn(sts[ci]);
 
-            // Switch off learning
-            max = 0;
-            nrepel_connect_port(sts[ci], NREPEL_N_LEARN, &max);
+            // Remember what we learned for any further instances
+            denoiser.profiles[ci] = calloc(NREPEL_PROFILE_SIZE, sizeof(float));
+            if (!denoiser.profiles[ci]) {
+                perror("malloc");
+                return 1;
+            }
+            if (!nrepel_get_profile(sts[ci], denoiser.profiles[ci],
+                    &denoiser.windowCounts[ci])) {
+                free(denoiser.profiles[ci]);
+                denoiser.profiles[ci] = NULL;
+            }
         }
 
+        csc_pcmCloseIn(learnPcm);
         close(learnFd);
-        free(learnOut);
         free(learnIn);
-        free(learnBuf);
+
+        // Save what we learned for later runs
+        for (ci = 0; saveFile && ci < channels; ci++) {
+            if (!denoiser.profiles[ci]) {
+                fprintf(stderr, "%s: No noise profile learned, not saving\n", learnFile);
+                saveFile = NULL;
+            }
+        }
+        if (saveFile) {
+            CSC_NoiseProfile *profile = csc_noiseProfileNew(track, channels);
+            profile->learned = time(NULL);
+            for (ci = 0; ci < channels; ci++) {
+                profile->amounts[ci] = denoiser.amounts[ci];
+                profile->windowCounts[ci] = denoiser.windowCounts[ci];
+                memcpy(profile->bins + ci * CSC_NOISE_PROFILE_BINS,
+                    denoiser.profiles[ci],
+                    NREPEL_PROFILE_SIZE * sizeof(float));
+            }
+            if (csc_noiseProfileWrite(saveFile, &profile, 1) < 0)
+                return 1;
+            csc_noiseProfileFree(profile);
+        }
 
     } else {
         float amt = 10;
-        for (ci = 0; ci < channels; ci++)
+        for (ci = 0; ci < channels; ci++) {
             nrepel_connect_port(sts[ci], NREPEL_AMOUNT, &amt);
+            denoiser.amounts[ci] = amt;
+        }
 
     }
 
-    // Prepare for the real task
-    for (ci = 0; ci < channels; ci++) {
-        nrepel_connect_port(sts[ci], NREPEL_INPUT, inFrame);
-        nrepel_connect_port(sts[ci], NREPEL_OUTPUT, outFrame);
-    }
+    denoiser.sts = sts;
+    if (jobs > 1) {
+        // With multiple jobs, denoise chunks of the input in parallel
+        if (csc_chunkPipe(inFd, outFd, channels, FRAME_SIZE,
+                hops(chunkSeconds), hops(warmupSeconds),
+                FADE_HOPS * NREPEL_HOP, jobs, denoiseChunk, &denoiser) < 0)
+            return 1;
 
-    while (1) {
-        // Read in a frame
-        total = 0;
-        while (total < frameSz) {
-            rd = read(inFd, ((char *) rawFrame) + total, frameSz - total);
-            if (rd <= 0)
-                break;
-            total += rd;
+    } else {
+        // Otherwise, continue with what we learned
+        outFrames = malloc(channels * sizeof(float *));
+        if (!outFrames) {
+            perror("malloc");
+            return 1;
         }
-        if (total == 0)
-            break;
-        memset(((char *) rawFrame) + total, 0, frameSz - total);
-
-        // Go channel by channel
         for (ci = 0; ci < channels; ci++) {
-            // Extract one channel
-            for (i = ci, oi = 0;
-                 i < frameCt;
-                 (i += channels), oi++) {
-                inFrame[oi] = rawFrame[i];
+            outFrames[ci] = malloc(FRAME_SIZE * sizeof(float));
+            if (!outFrames[ci]) {
+                perror("malloc");
+                return 1;
             }
+            nrepel_connect_port(sts[ci], NREPEL_OUTPUT, outFrames[ci]);
+        }
+        denoiser.outFrames = outFrames;
 
-            // Process it
-            nrepel_run(sts[ci], FRAME_SIZE);
+        // Process each channel on its own thread
+        if (csc_chanPipe(inFd, outFd, channels, sizeof(float), FRAME_SIZE,
+                denoise, &denoiser) < 0)
+            return 1;
 
-            // Convert it back
-            for (i = ci, oi = 0;
-                 i < frameCt;
-                 (i += channels), oi++) {
-                rawFrame[i] = outFrame[oi];
-            }
-        }
+        for (ci = 0; ci < channels; ci++)
+            free(outFrames[ci]);
+        free(outFrames);
 
-        // Now output it again
-        write(outFd, rawFrame, frameSz);
     }
 
-    for (ci = 0; ci < channels; ci++)
+    for (ci = 0; ci < channels; ci++) {
         nrepel_cleanup(sts[ci]);
-
+        free(denoiser.profiles[ci]);
+    }
     free(sts);
-    free(inFrame);
-    free(outFrame);
-    free(rawFrame);
+    free(denoiser.amounts);
+    free(denoiser.profiles);
+    free(denoiser.windowCounts);
 
     if (inFd != 0)
         close(inFd);
@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _POSIX_SOURCE 1
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "atomicfile.h"
+#include "cscript.h"
+#include "configfile.h"
+#include "probe.h"
+
+// Get the table for a stream, growing the stream list if needed
+static CSC_HashTable *streamTable(CSC_Probe *probe, int idx)
+{
+    if (idx >= probe->nbStreams) {
+        probe->streams = GC_REALLOC(probe->streams, (idx + 1) * sizeof(CSC_HashTable *));
+        for (int si = probe->nbStreams; si <= idx; si++)
+            probe->streams[si] = csc_newHashTable();
+        probe->nbStreams = idx + 1;
+    }
+    return probe->streams[idx];
+}
+
+// Unquote and unescape a flat-format value
+static CORD unquote(char *val)
+{
+    size_t len = strlen(val);
+    if (len < 2 || val[0] != '"' || val[len-1] != '"')
+        return CORD_from_char_star(val);
+
+    char *ret = GC_MALLOC_ATOMIC(len);
+    size_t ri = 0;
+    for (size_t vi = 1; vi < len - 1; vi++) {
+        char c = val[vi];
+        if (c == '\\' && vi + 1 < len - 1) {
+            c = val[++vi];
+            if (c == 'n') c = '\n';
+            else if (c == 'r') c = '\r';
+        }
+        ret[ri++] = c;
+    }
+    ret[ri] = 0;
+    return ret;
+}
+
+// Parse the flat ffprobe output into a probe
+static void parse(CSC_Probe *probe, CORD output)
+{
+    char *line = CORD_to_char_star(output);
+    while (*line) {
+        char *next = strchr(line, '\n');
+        if (next)
+            *next++ = 0;
+        else
+            next = line + strlen(line);
+        size_t len = strlen(line);
+        if (len && line[len-1] == '\r')
+            line[len-1] = 0;
+
+        char *eq = strchr(line, '=');
+        if (eq) {
+            *eq = 0;
+            CORD val = unquote(eq + 1);
+
+            if (!strncmp(line, "format.", 7)) {
+                csc_htAdd(probe->format, line + 7, (void *) val);
+
+            } else if (!strncmp(line, "streams.stream.", 15)) {
+                char *key;
+                long idx = strtol(line + 15, &key, 10);
+                if (key != line + 15 && *key == '.' && idx >= 0)
+                    csc_htAdd(streamTable(probe, idx), key + 1, (void *) val);
+
+            }
+        }
+
+        line = next;
+    }
+}
+
+/* Caches live in the current directory, named for the input file with the
+ * given suffix */
+static CORD cacheFileFor(char *cInputFile, CORD suffix)
+{
+    char *base = strrchr(cInputFile, '/');
+#ifdef _WIN32
+    char *wbase = strrchr(cInputFile, '\\');
+    if (wbase > base) base = wbase;
+#endif
+    base = base ? base + 1 : cInputFile;
+    return csc_casprintf("%s%r", base, suffix);
+}
+
+// Caches are keyed by the input's size and modification time
+static CORD cacheHeaderFor(char *cInputFile)
+{
+    struct stat sbuf;
+    if (stat(cInputFile, &sbuf) != 0)
+        return NULL;
+    return csc_casprintf("plip-probe %s %s\n",
+        csc_asprintf("%lld", (long long) sbuf.st_size),
+        csc_asprintf("%lld", (long long) sbuf.st_mtime));
+}
+
+// Read a cache, or return NULL if it's missing or stale
+static CORD readCache(CORD cacheFile, CORD header)
+{
+    if (!header || !csc_fileExists(cacheFile))
+        return NULL;
+    CORD cache = csc_readFile(cacheFile);
+    size_t headerLen = CORD_len(header);
+    if (cache && !CORD_cmp(CORD_substr(cache, 0, headerLen), header))
+        return CORD_substr(cache, headerLen, CORD_len(cache) - headerLen);
+    return NULL;
+}
+
+/* Write a cache atomically, since several processes may probe the same input
+ * at once */
+static void writeCache(CORD cacheFile, CORD header, CORD output)
+{
+    CSC_AtomicFile *af = csc_atomicOpen(CORD_to_char_star(cacheFile));
+    if (!af)
+        return;
+    csc_atomicClose(af, CORD_put(CORD_cat(header, output), af->fh) == 1);
+}
+
+// Probe a file, using the cache if possible
+CSC_Probe *csc_probe(CORD inputFile)
+{
+    CSC_Probe *probe = GC_NEW(CSC_Probe);
+    probe->nbStreams = 0;
+    probe->format = csc_newHashTable();
+    probe->streams = NULL;
+
+    char *cInputFile = CORD_to_char_star(inputFile);
+    CORD cacheFile = cacheFileFor(cInputFile, ".probe");
+    CORD header = cacheHeaderFor(cInputFile);
+
+    // Check the cache
+    CORD output = readCache(cacheFile, header);
+
+    if (!output) {
+        // Actually probe it
+        if (csc_runl(CSC_STDOUT, &output,
+            csc_config("programs.ffprobe"), "-print_format", "flat",
+            "-show_format", "-show_streams", cInputFile, NULL) != 0)
+            output = CORD_EMPTY;
+
+        // And remember it
+        if (header && CORD_len(output))
+            writeCache(cacheFile, header, output);
+    }
+
+    parse(probe, output);
+    return probe;
+}
+
+// Remove a file's probe cache
+void csc_probeForget(CORD inputFile)
+{
+    unlink(CORD_to_char_star(cacheFileFor(CORD_to_char_star(inputFile),
+        ".probe")));
+}
+
+// Get a format value
+CORD csc_probeFormat(CSC_Probe *probe, CORD key)
+{
+    return csc_htGet(probe->format, key);
+}
+
+// Get a stream value
+CORD csc_probeStream(CSC_Probe *probe, int idx, CORD key)
+{
+    if (idx < 0 || idx >= probe->nbStreams)
+        return NULL;
+    return csc_htGet(probe->streams[idx], key);
+}
+
+static int cmpDouble(const void *lv, const void *rv)
+{
+    double l = *(const double *) lv, r = *(const double *) rv;
+    return (l > r) - (l < r);
+}
+
+// Index the keyframes of a stream, using the cache if possible
+double *csc_probeKeyframes(CORD inputFile, int idx, size_t *count)
+{
+    char *cInputFile = CORD_to_char_star(inputFile);
+    CORD cacheFile = cacheFileFor(cInputFile, csc_casprintf(".%s.keyframes",
+        csc_asprintf("%d", idx)));
+    CORD header = cacheHeaderFor(cInputFile);
+
+    // Check the cache
+    CORD output = readCache(cacheFile, header);
+
+    if (!output) {
+        // Only the packets need to be read, not decoded
+        if (csc_runl(CSC_STDOUT, &output,
+            csc_config("programs.ffprobe"), "-v", "error",
+            "-select_streams", csc_asprintf("%d", idx),
+            "-show_entries", "packet=pts_time,flags", "-of", "csv=p=0",
+            cInputFile, NULL) != 0)
+            output = CORD_EMPTY;
+
+        if (header && CORD_len(output))
+            writeCache(cacheFile, header, output);
+    }
+
+    // Each line is the time and flags of a packet
+    char *line = CORD_to_char_star(output);
+    size_t ct = 0, sz = 1024;
+    double *keyframes = GC_MALLOC_ATOMIC(sz * sizeof(double));
+    while (*line) {
+        char *next = strchr(line, '\n');
+        if (next)
+            *next++ = 0;
+        else
+            next = line + strlen(line);
+
+        char *flags;
+        double time = strtod(line, &flags);
+        if (flags != line && *flags == ',' && flags[1] == 'K') {
+            if (ct == sz) {
+                sz *= 2;
+                keyframes = GC_REALLOC(keyframes, sz * sizeof(double));
+            }
+            keyframes[ct++] = time;
+        }
+
+        line = next;
+    }
+
+    // Packets are in decoding order
+    qsort(keyframes, ct, sizeof(double), cmpDouble);
+    *count = ct;
+    return keyframes;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PROBE_H
+#define PROBE_H 1
+
+#include "hashtable.h"
+
+/* The result of probing a media file. Both the format and each stream are
+ * tables of the flat ffprobe keys, e.g. "nb_streams" in the format or
+ * "codec_type" and "tags.title" in a stream, with unquoted values. */
+typedef struct CSC_Probe_ {
+    int nbStreams;
+    CSC_HashTable *format;
+    CSC_HashTable **streams;
+} CSC_Probe;
+
+/* Probe a file. The result is cached in a .probe file in the current
+ * directory, and the cache is reused as long as the input file's size and
+ * modification time match. Never returns NULL, but may return a probe with no
+ * streams. */
+CSC_Probe *csc_probe(CORD inputFile);
+
+/* Remove a file's probe cache, for when the file itself is removed */
+void csc_probeForget(CORD inputFile);
+
+/* Get a format value, or NULL if it's not present */
+CORD csc_probeFormat(CSC_Probe *probe, CORD key);
+
+/* Get a stream value, or NULL if it's not present */
+CORD csc_probeStream(CSC_Probe *probe, int idx, CORD key);
+
+/* Index the keyframes of a stream: the sorted times of its keyframes, in
+ * seconds. The index is cached in the current directory like a probe. */
+double *csc_probeKeyframes(CORD inputFile, int idx, size_t *count);
+
+#endif
@@ -14,22 +14,23 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#define GC_THREADS 1
+
 #include <float.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
 #include "arg.h"
-#include "buffer.h"
 #include "cscript.h"
 #include "configfile.h"
+#include "envelope.h"
 
 static CORD ffmpeg = "ffmpeg";
 
-BUFFER(charp, char *);
-
 struct Mark {
     char op;
     char status;
@@ -39,26 +40,49 @@ struct Mark {
 
 #define BUFSZ 4096
 
+/* The detector works like ffmpeg's amix,dynaudnorm,silencedetect=-25dB, which
+ * it replaces, but on the tracks' envelopes rather than their audio. The
+ * tracks are mixed a block at a time, frames of blocks are normalized by the
+ * quietest gain of their neighborhood, and any long enough run of quiet blocks
+ * is a silence. */
+#define BLOCK CSC_ENVELOPE_BLOCK
+#define FRAME_BLOCKS 32 // 500ms at 48kHz, dynaudnorm's frame
+#define NEIGHBORHOOD 15 // frames on each side
+#define PEAK 0.95
+#define MAX_GAIN 10
+#define THRESHOLD_DB -25
+#define MIN_SILENCE 2 // seconds
+
+// A track being decoded for its envelope
+struct Decoder {
+    int fd;
+    pthread_t thread;
+    CSC_Envelope *env;
+};
+
+// The marks from stdin, and the rate of the envelopes
+struct Detector {
+    struct Mark marks[2];
+    int rate;
+};
+
 void usage(void);
 struct Mark readMark(struct Mark prior);
 void writeMark(struct Mark mark);
+static CSC_Envelope *decodeEnvelope(int fd);
+static void *decodeThread(void *vdec);
+static void silence(struct Detector *d, size_t startBlock, size_t endBlock);
 
 int main(int argc, char **argv)
 {
     ARG_VARS;
 
     int audioCt = 0;
-    struct Buffer_charp cl;
+    char **audioFiles = NULL;
     const char *configFile = NULL;
-    struct Mark marks[2];
-    char buf[BUFSZ];
-    float silenceStart, silenceEnd;
 
     csc_init(argv[0]);
 
-    INIT_BUFFER(cl);
-    WRITE_ONE_BUFFER(cl, NULL); /* To be ffmpeg */
-
     ARG_NEXT();
     while (argType) {
         ARG(h, help) {
@@ -67,9 +91,8 @@ int main(int argc, char **argv)
         } else ARG(c, config) {
             configFile = arg;
         } else if (argType == ARG_VAL) {
-            WRITE_ONE_BUFFER(cl, "-i");
-            WRITE_ONE_BUFFER(cl, arg);
-            audioCt++;
+            audioFiles = GC_REALLOC(audioFiles, (audioCt + 1) * sizeof(char *));
+            audioFiles[audioCt++] = arg;
         } else {
             usage();
             exit(1);
@@ -79,74 +102,172 @@ int main(int argc, char **argv)
 
     csc_configInit(configFile);
     ffmpeg = csc_config("programs.ffmpeg");
-    cl.buf[0] = CORD_to_char_star(ffmpeg);
 
-    // Start reading marks from stdin
-    marks[0].op = 'o';
-    marks[0].status = 'o';
-    marks[0].val = 0;
-    marks[1] = readMark(marks[0]);
-
-    // Make the rest of our ffmpeg command
-    WRITE_ONE_BUFFER(cl, "-filter_complex");
-    CORD filter = NULL, step;
-    for (int i = 0; i < audioCt; i++) {
-        step = csc_casprintf("[%d:a]", i);
-        filter = CORD_cat(filter, step);
-    }
+    struct Detector *d = GC_NEW(struct Detector);
+    d->rate = 48000;
 
-    step = csc_casprintf("amix=%d,dynaudnorm,silencedetect=-25dB[aud]", audioCt);
-    filter = CORD_cat(filter, step);
-    WRITE_ONE_BUFFER(cl, CORD_to_char_star(filter));
-    WRITE_ONE_BUFFER(cl, "-map");
-    WRITE_ONE_BUFFER(cl, "[aud]");
-    WRITE_ONE_BUFFER(cl, "-f");
-    WRITE_ONE_BUFFER(cl, "null");
-    WRITE_ONE_BUFFER(cl, "-");
-    WRITE_ONE_BUFFER(cl, NULL);
-
-    // And start ffmpeg
-    int silPipeFd = csc_runp(-1, CSC_STDERR, cl.buf);
-    FILE *silPipe = fdopen(silPipeFd, "rb");
-    buf[BUFSZ-1] = 0;
+    // Start reading marks from stdin
+    d->marks[0].op = 'o';
+    d->marks[0].status = 'o';
+    d->marks[0].val = 0;
+    d->marks[1] = readMark(d->marks[0]);
 
-    // Read all the silence info
-    while (fgets(buf, BUFSZ-1, silPipe)) {
-        CORD *matches;
-        matches = csc_match("silence_start: ([0-9\\.]*)", buf);
-        if (matches) {
-            silenceStart = atof(CORD_to_char_star(matches[1]));
+    /* Use each track's envelope if aproc left one, or decode it if not. Each
+     * decoder is read in its own thread, so they run side by side. */
+    CSC_Envelope **envs = GC_MALLOC(audioCt * sizeof(CSC_Envelope *));
+    struct Decoder *decoders = GC_MALLOC(audioCt * sizeof(struct Decoder));
+    for (int ai = 0; ai < audioCt; ai++) {
+        decoders[ai].fd = -1;
+        envs[ai] = csc_envelopeRead(CORD_to_char_star(
+            CORD_cat(audioFiles[ai], CSC_ENVELOPE_SUFFIX)),
+            CORD_to_char_star(audioFiles[ai]));
+        if (envs[ai] && envs[ai]->rate == d->rate)
             continue;
+        csc_envelopeFree(envs[ai]);
+        envs[ai] = NULL;
+        decoders[ai].fd = csc_runpl(-1, CSC_STDOUT,
+            ffmpeg, "-nostdin", "-i", audioFiles[ai],
+            "-f", "f32le", "-ac", "2", "-ar", "48000", "-", NULL);
+        if (decoders[ai].fd < 0) {
+            fprintf(stderr, "plip-silencemarks: Failed to decode %s\n", audioFiles[ai]);
+            exit(1);
         }
+        if (GC_pthread_create(&decoders[ai].thread, NULL, decodeThread, &decoders[ai]) != 0)
+            CRASH("pthread_create");
+    }
+    size_t blocks = 0;
+    for (int ai = 0; ai < audioCt; ai++) {
+        if (decoders[ai].fd >= 0) {
+            pthread_join(decoders[ai].thread, NULL);
+            envs[ai] = decoders[ai].env;
+        }
+        if (envs[ai]->levels[0].count > blocks)
+            blocks = envs[ai]->levels[0].count;
+    }
 
-        matches = csc_match("silence_end: ([0-9\\.]*)", buf);
-        if (!matches)
-            continue;
+    /* Mix the blocks. Like amix, we divide by the tracks still playing. The
+     * tracks are taken to be uncorrelated, so their powers add, and the
+     * peaks are assumed to coincide. */
+    size_t frames = (blocks + FRAME_BLOCKS - 1) / FRAME_BLOCKS;
+    float *power = GC_MALLOC_ATOMIC((blocks + 1) * sizeof(float));
+    float *gains = GC_MALLOC_ATOMIC((frames + 1) * sizeof(float));
+    for (size_t fi = 0; fi < frames; fi++)
+        gains[fi] = MAX_GAIN;
+    for (size_t bi = 0; bi < blocks; bi++) {
+        float sumPower = 0, sumPeak = 0;
+        int live = 0;
+        for (int ai = 0; ai < audioCt; ai++) {
+            const CSC_EnvelopeLevel *level = &envs[ai]->levels[0];
+            int channels = envs[ai]->channels;
+            if (bi >= level->count)
+                continue;
+            const CSC_EnvelopeBlock *block = level->blocks + bi * channels;
+            float chanPower = 0, chanPeak = 0;
+            for (int ci = 0; ci < channels; ci++) {
+                float peak = fmaxf(-block[ci].min, block[ci].max);
+                chanPower += block[ci].rms * block[ci].rms;
+                chanPeak = fmaxf(chanPeak, peak);
+            }
+            sumPower += chanPower / channels;
+            sumPeak += chanPeak;
+            live++;
+        }
+        power[bi] = sumPower / ((float) live * live);
 
-        silenceEnd = atof(CORD_to_char_star(matches[1]));
+        // dynaudnorm's gain for this frame alone
+        float peak = sumPeak / live;
+        float *gain = &gains[bi / FRAME_BLOCKS];
+        if (peak * *gain > PEAK)
+            *gain = PEAK / peak;
+    }
 
-        // Make sure we're looking at the right gap
-        while (marks[1].val < silenceEnd) {
-            writeMark(marks[1]);
-            marks[0] = marks[1];
-            marks[1] = readMark(marks[0]);
-        }
-        if (marks[0].val >= silenceStart)
-            continue;
+    /* Normalize each frame and look for silence in it. Like dynaudnorm, the
+     * gain is the least gain of the frame's neighborhood, so that quiet
+     * frames near loud ones aren't boosted into noise. */
+    float threshold = pow(10, THRESHOLD_DB / 10.0);
+    long long silenceStart = -1;
+    for (size_t fi = 0; fi < frames; fi++) {
+        size_t from = (fi > NEIGHBORHOOD) ? fi - NEIGHBORHOOD : 0;
+        size_t to = fi + NEIGHBORHOOD;
+        if (to >= frames)
+            to = frames - 1;
+        float gain = MAX_GAIN;
+        for (size_t ni = from; ni <= to; ni++)
+            gain = fminf(gain, gains[ni]);
 
-        // Now account for the silence if applicable
-        if (marks[0].status == 'i')
-            printf("o%f\ni%f\n", silenceStart+0.5, silenceEnd-0.5);
+        // Compare each block against the threshold
+        float frameThreshold = threshold / (gain * gain);
+        for (size_t bi = fi * FRAME_BLOCKS; bi < blocks && bi < (fi + 1) * FRAME_BLOCKS; bi++) {
+            if (power[bi] < frameThreshold) {
+                if (silenceStart < 0)
+                    silenceStart = bi;
+            } else if (silenceStart >= 0) {
+                silence(d, silenceStart, bi);
+                silenceStart = -1;
+            }
+        }
     }
+    if (silenceStart >= 0)
+        silence(d, silenceStart, blocks);
 
     // Finish up any remaining input marks
-    while (marks[1].op != '_') {
+    while (d->marks[1].op != '_') {
+        writeMark(d->marks[1]);
+        d->marks[0] = d->marks[1];
+        d->marks[1] = readMark(d->marks[0]);
+    }
+
+    return 0;
+}
+
+// Make the envelope of a track without one, from stereo f32 audio on fd
+static CSC_Envelope *decodeEnvelope(int fd)
+{
+#define FRAMES 4096
+    CSC_Envelope *env = csc_envelopeNew(48000, 2);
+    float *buf = GC_MALLOC_ATOMIC(FRAMES * 2 * sizeof(float));
+    FILE *fh = fdopen(fd, "rb");
+    size_t rd;
+    if (fh) {
+        while ((rd = fread(buf, 2 * sizeof(float), FRAMES, fh)) > 0)
+            csc_envelopeAdd(env, buf, rd);
+        fclose(fh);
+    }
+    csc_envelopeFinish(env);
+    return env;
+#undef FRAMES
+}
+
+// decodeEnvelope in a thread
+static void *decodeThread(void *vdec)
+{
+    struct Decoder *dec = vdec;
+    dec->env = decodeEnvelope(dec->fd);
+    return NULL;
+}
+
+// Merge a detected silence into the marks
+static void silence(struct Detector *d, size_t startBlock, size_t endBlock)
+{
+    struct Mark *marks = d->marks;
+    float silenceStart = (double) startBlock * BLOCK / d->rate;
+    float silenceEnd = (double) endBlock * BLOCK / d->rate;
+
+    if (silenceEnd - silenceStart < MIN_SILENCE)
+        return;
+
+    // Make sure we're looking at the right gap
+    while (marks[1].val < silenceEnd) {
         writeMark(marks[1]);
         marks[0] = marks[1];
         marks[1] = readMark(marks[0]);
     }
+    if (marks[0].val >= silenceStart)
+        return;
 
-    return 0;
+    // Now account for the silence if applicable
+    if (marks[0].status == 'i')
+        printf("o%f\ni%f\n", silenceStart+0.5, silenceEnd-0.5);
 }
 
 void usage()
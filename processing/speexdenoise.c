@@ -15,6 +15,7 @@
  */
 
 #include <fcntl.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,33 +27,105 @@
 #endif
 
 #include "arg.h"
+#include "chanpipe.h"
 
 #include "speex/speex_preprocess.h"
 
+/* Built with SPEEX_FFTW, this is plip-speexfftwdenoise: it links the floating
+ * point, SSE, FFTW build of speexdsp, and reads and writes f32le instead of
+ * s16le */
+#ifdef SPEEX_FFTW
+#include <fftw3.h>
+#include "atomicfile.h"
+#define PROGRAM "plip-speexfftwdenoise"
+typedef float sample_t;
+#else
+#define PROGRAM "plip-speexdenoise"
+typedef short sample_t;
+#endif
+
 #include "licenses.h"
 
 #define FRAME_SIZE 960
 
 void usage()
 {
-    fprintf(stderr, "Use: plip-speexdenoise [-i|--input <input file>] [-o|--output <output file>] [channels]\n\n");
+    fprintf(stderr, "Use: " PROGRAM " [-i|--input <input file>] [-o|--output <output file>]\n"
+#ifdef SPEEX_FFTW
+        "       [-w|--wisdom <FFTW wisdom file>]\n"
+#endif
+        "       [channels]\n\n");
+}
+
+#ifdef SPEEX_FFTW
+/* Plan with the wisdom in this file, and save it if planning learned anything.
+ * Other processes may be reading it, so the new wisdom replaces it whole. */
+static void planWithWisdom(const char *wisdomFile, SpeexPreprocessState **sts,
+    int channels)
+{
+    char *before, *after;
+    int ci;
+
+    if (wisdomFile)
+        fftwf_import_wisdom_from_filename(wisdomFile);
+    before = fftwf_export_wisdom_to_string();
+
+    for (ci = 0; ci < channels; ci++)
+        sts[ci] = speex_preprocess_state_init(FRAME_SIZE, 48000);
+
+    after = fftwf_export_wisdom_to_string();
+    if (wisdomFile && before && after && strcmp(before, after)) {
+        CSC_AtomicFile *af = csc_atomicOpen(wisdomFile);
+        if (af) {
+            fftwf_export_wisdom_to_file(af->fh);
+            csc_atomicClose(af, !ferror(af->fh));
+        }
+    }
+    fftwf_free(before);
+    fftwf_free(after);
+}
+#endif
+
+// Denoise one frame of one channel
+static void denoise(void *vsts, int channel, void *frame, size_t frames)
+{
+    SpeexPreprocessState **sts = vsts;
+#ifdef SPEEX_FFTW
+    // The preprocessor only takes 16-bit samples, but this build works in float
+    float *samples = frame;
+    spx_int16_t buf[FRAME_SIZE];
+    size_t i;
+    for (i = 0; i < frames; i++) {
+        float s = samples[i] * 32768.0f;
+        if (s > 32767.0f) s = 32767.0f;
+        else if (s < -32768.0f) s = -32768.0f;
+        buf[i] = (spx_int16_t) lrintf(s);
+    }
+    speex_preprocess_run(sts[channel], buf);
+    for (i = 0; i < frames; i++)
+        samples[i] = buf[i] / 32768.0f;
+#else
+    speex_preprocess_run(sts[channel], frame);
+#endif
 }
 
 int main(int argc, char **argv)
 {
-    size_t frameCt, frameSz;
-    short *rawFrame;
-    short *frame;
-    int i, oi, ci;
+    int i, ci;
     int channels = 1;
-    ssize_t rd, total;
     SpeexPreprocessState **sts;
     char *inFile = NULL, *outFile = NULL;
+#ifdef SPEEX_FFTW
+    char *wisdomFile = NULL;
+#endif
     int inFd = 0, outFd = 1;
 
     ARG_VARS;
 
     fprintf(stderr, "The speexdsp-denoise library used by this software is licensed under the following terms:\n\n%s\n---\n\n", speexdsp_license);
+#ifdef SPEEX_FFTW
+    fprintf(stderr, "The fftw library used by this software is licensed under the following terms:\n\n%s\n---\n\n", fftw_license);
+#endif
 
 #ifdef _WIN32
     setmode(0, O_BINARY);
@@ -76,6 +149,11 @@ int main(int argc, char **argv)
         } else ARGN(l, learn) {
             ARG_GET();
             // Speex can't learn
+#ifdef SPEEX_FFTW
+        } else ARGN(w, wisdom) {
+            ARG_GET();
+            wisdomFile = arg;
+#endif
         } else if (argType == ARG_VAL) {
             channels = atoi(arg);
         } else {
@@ -109,28 +187,19 @@ int main(int argc, char **argv)
         }
     }
 
-    // Allocate our frames
-    frameCt = FRAME_SIZE * channels;
-    frameSz = frameCt * sizeof(short);
-    rawFrame = malloc(frameSz);
-    if (!rawFrame) {
-        perror("malloc");
-        return 1;
-    }
-    frame = malloc(FRAME_SIZE * sizeof(short));
-    if (!frame) {
-        perror("malloc");
-        return 1;
-    }
-
     // And our denoiser state
     sts = malloc(channels * sizeof(SpeexPreprocessState *));
     if (!sts) {
         perror("malloc");
         return 1;
     }
-    for (ci = 0; ci < channels; ci++) {
+#ifdef SPEEX_FFTW
+    planWithWisdom(wisdomFile, sts, channels);
+#else
+    for (ci = 0; ci < channels; ci++)
         sts[ci] = speex_preprocess_state_init(FRAME_SIZE, 48000);
+#endif
+    for (ci = 0; ci < channels; ci++) {
         i=1;
         speex_preprocess_ctl(sts[ci], SPEEX_PREPROCESS_SET_DENOISE, &i);
         i=0;
@@ -139,49 +208,15 @@ int main(int argc, char **argv)
         speex_preprocess_ctl(sts[ci], SPEEX_PREPROCESS_SET_DEREVERB, &i);
     }
 
-    while (1) {
-        // Read in a frame
-        total = 0;
-        while (total < frameSz) {
-            rd = read(inFd, ((char *) rawFrame) + total, frameSz - total);
-            if (rd <= 0)
-                break;
-            total += rd;
-        }
-        if (total == 0)
-            break;
-        memset(((char *) rawFrame) + total, 0, frameSz - total);
-
-        // Go channel by channel
-        for (ci = 0; ci < channels; ci++) {
-            // Extract one channel
-            for (i = ci, oi = 0;
-                 i < frameCt;
-                 (i += channels), oi++) {
-                frame[oi] = rawFrame[i];
-            }
-
-            // Process it
-            speex_preprocess_run(sts[ci], frame);
-
-            // Convert it back
-            for (i = ci, oi = 0;
-                 i < frameCt;
-                 (i += channels), oi++) {
-                rawFrame[i] = frame[oi];
-            }
-        }
-
-        // Now output it again
-        write(outFd, rawFrame, frameSz);
-    }
+    // Process each channel on its own thread
+    if (csc_chanPipe(inFd, outFd, channels, sizeof(sample_t), FRAME_SIZE,
+            denoise, sts) < 0)
+        return 1;
 
     for (ci = 0; ci < channels; ci++)
         speex_preprocess_state_destroy(sts[ci]);
 
     free(sts);
-    free(frame);
-    free(rawFrame);
 
     if (inFd != 0)
         close(inFd);
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "synth.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+void csc_synthesize(const char *file, int channels, double seconds)
+{
+    FILE *fh = fopen(file, "wb");
+    if (!fh) {
+        perror(file);
+        exit(1);
+    }
+
+    size_t frames = seconds * 48000;
+    uint32_t rng = 0x12345678;
+    double phase = 0;
+    float *frame = malloc(channels * sizeof(float));
+    if (!frame) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        double t = i / 48000.0;
+        double syl = fmod(t, 0.4) / 0.4;
+        double env = (fmod(t, CSC_SYNTH_PAUSE_PERIOD) < 5 && syl < 0.7) ? sin(M_PI * syl / 0.7) : 0;
+        double pitch = 120 + 40 * sin(2 * M_PI * 0.3 * t);
+        phase += 2 * M_PI * pitch / 48000;
+        double voice = 0;
+        for (int h = 1; h <= 8; h++)
+            voice += sin(phase * h) / h;
+        for (int ci = 0; ci < channels; ci++) {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            double noise = (rng / 4294967296.0 - 0.5) * 0.02;
+            double hum = 0.005 * sin(2 * M_PI * 60 * t);
+            frame[ci] = 0.2 * env * voice * (ci ? 0.7 : 1) + noise + hum;
+        }
+        fwrite(frame, sizeof(float), channels, fh);
+    }
+
+    free(frame);
+    fclose(fh);
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SYNTH_H
+#define SYNTH_H 1
+
+/* The synthetic audio pauses from PAUSE_START to PAUSE_END seconds of every
+ * PAUSE_PERIOD, leaving only noise */
+#define CSC_SYNTH_PAUSE_PERIOD 7
+#define CSC_SYNTH_PAUSE_START 5.25
+#define CSC_SYNTH_PAUSE_END 6.75
+
+/* Write seconds of deterministic, speech-like 48kHz f32le audio to a file:
+ * syllables of gliding harmonics, separated by pauses, over a constant bed of
+ * noise and hum. Exits on error. */
+void csc_synthesize(const char *file, int channels, double seconds);
+
+#endif
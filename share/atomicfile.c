@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "atomicfile.h"
+#include "helpers.h"
+
+// Start writing a file
+CSC_AtomicFile *csc_atomicOpen(const char *file)
+{
+    CSC_AtomicFile *af;
+    size_t len = strlen(file) + 32;
+
+    SF(af, calloc, NULL, (1, sizeof(CSC_AtomicFile)));
+    SF(af->file, malloc, NULL, (len));
+    SF(af->tmp, malloc, NULL, (len));
+    strcpy(af->file, file);
+
+    // The temporary file is named for the process, so processes don't collide
+    snprintf(af->tmp, len, "%s.%lu.tmp", file, (unsigned long) getpid());
+    af->fh = fopen(af->tmp, "wb");
+    if (!af->fh) {
+        perror(af->tmp);
+        free(af->file);
+        free(af->tmp);
+        free(af);
+        return NULL;
+    }
+    return af;
+}
+
+// Finish writing a file
+int csc_atomicClose(CSC_AtomicFile *af, int ok)
+{
+    int ret = ok ? 0 : -1;
+
+    if (fclose(af->fh) != 0)
+        ret = -1;
+
+    // Replace the old file
+    if (ret == 0) {
+#ifdef _WIN32
+        unlink(af->file);
+#endif
+        if (rename(af->tmp, af->file) != 0)
+            ret = -1;
+    }
+    if (ret != 0) {
+        perror(af->file);
+        unlink(af->tmp);
+    }
+
+    free(af->file);
+    free(af->tmp);
+    free(af);
+    return ret;
+}
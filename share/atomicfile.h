@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef ATOMICFILE_H
+#define ATOMICFILE_H 1
+
+#include <stdio.h>
+
+/* A file being written atomically: it's written to a temporary file beside it,
+ * which then replaces it whole, so readers (including other processes) never
+ * see it partially written. Only one writer per process should write any
+ * given file at a time. */
+typedef struct CSC_AtomicFile_ {
+    FILE *fh; // write to this
+    char *file, *tmp;
+} CSC_AtomicFile;
+
+/* Start writing a file. Returns NULL, having reported the error, if the
+ * temporary file can't be created. */
+CSC_AtomicFile *csc_atomicOpen(const char *file);
+
+/* Finish writing a file. If ok is nonzero and the temporary file closes
+ * cleanly, it replaces the file. Otherwise, it's deleted and the error
+ * reported. Returns 0 or -1 on error. */
+int csc_atomicClose(CSC_AtomicFile *af, int ok);
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chanpipe.h"
+#include "pcmio.h"
+
+// Number of blocks in flight
+#define SLOTS 4
+
+// Units per block
+#define BLOCK_UNITS 32
+
+enum SlotState {
+    SLOT_EMPTY,
+    SLOT_READ,
+    SLOT_PROCESSED
+};
+
+// A block in flight
+struct Slot {
+    enum SlotState state;
+    size_t seq; // which block this is
+    size_t frames; // 0 for end of input
+    int done; // channels processed
+    char **chans; // samples for each channel
+};
+
+struct ChanPipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct Slot slots[SLOTS];
+
+    CSC_PcmIn *in;
+    int outFd, channels;
+    size_t sampleSize, unit, blockFrames;
+    CSC_ChannelFn fn;
+    void *arg;
+    int error;
+};
+
+// A worker's view of the pipeline
+struct Worker {
+    struct ChanPipe *cp;
+    int channel;
+};
+
+// Wait for a slot to reach a state for the given block
+static struct Slot *waitSlot(struct ChanPipe *cp, size_t seq, enum SlotState state)
+{
+    struct Slot *slot = &cp->slots[seq % SLOTS];
+    while (slot->seq != seq || slot->state != state)
+        pthread_cond_wait(&cp->cond, &cp->lock);
+    return slot;
+}
+
+static void *reader(void *vcp)
+{
+    struct ChanPipe *cp = vcp;
+    size_t frameSz = cp->sampleSize * cp->channels;
+    size_t blockSz = cp->blockFrames * frameSz;
+    size_t unitSz = frameSz * cp->unit;
+    char *pad = NULL;
+
+    for (size_t seq = 0;; seq++) {
+        // Wait for the slot to be free
+        pthread_mutex_lock(&cp->lock);
+        struct Slot *slot = &cp->slots[seq % SLOTS];
+        while (slot->state != SLOT_EMPTY)
+            pthread_cond_wait(&cp->cond, &cp->lock);
+        pthread_mutex_unlock(&cp->lock);
+
+        // Read in a block
+        size_t rd;
+        const char *raw = csc_pcmRead(cp->in, blockSz, &rd);
+        size_t units = (rd + unitSz - 1) / unitSz;
+
+        // Pad the last block to a whole unit
+        if (rd < units * unitSz) {
+            if (!pad)
+                pad = csc_pcmAlloc(blockSz);
+            memcpy(pad, raw, rd);
+            memset(pad + rd, 0, units * unitSz - rd);
+            raw = pad;
+        }
+
+        // And split it into channels
+        csc_pcmDeinterleave((void *const *) slot->chans, raw, cp->channels,
+            cp->sampleSize, units * cp->unit);
+
+        pthread_mutex_lock(&cp->lock);
+        slot->seq = seq;
+        slot->frames = units * cp->unit;
+        slot->done = 0;
+        slot->state = SLOT_READ;
+        pthread_cond_broadcast(&cp->cond);
+        pthread_mutex_unlock(&cp->lock);
+
+        if (!units)
+            break;
+    }
+
+    csc_pcmFree(pad);
+    return NULL;
+}
+
+static void *worker(void *vw)
+{
+    struct Worker *w = vw;
+    struct ChanPipe *cp = w->cp;
+    size_t unitSz = cp->unit * cp->sampleSize;
+
+    for (size_t seq = 0;; seq++) {
+        pthread_mutex_lock(&cp->lock);
+        struct Slot *slot = waitSlot(cp, seq, SLOT_READ);
+        pthread_mutex_unlock(&cp->lock);
+        if (!slot->frames)
+            break;
+
+        // Process our channel a unit at a time
+        char *buf = slot->chans[w->channel];
+        for (size_t off = 0; off < slot->frames; off += cp->unit) {
+            cp->fn(cp->arg, w->channel, buf, cp->unit);
+            buf += unitSz;
+        }
+
+        pthread_mutex_lock(&cp->lock);
+        if (++slot->done == cp->channels) {
+            slot->state = SLOT_PROCESSED;
+            pthread_cond_broadcast(&cp->cond);
+        }
+        pthread_mutex_unlock(&cp->lock);
+    }
+
+    return NULL;
+}
+
+static void *writer(void *vcp)
+{
+    struct ChanPipe *cp = vcp;
+    size_t frameSz = cp->sampleSize * cp->channels;
+    char *raw = csc_pcmAlloc(cp->blockFrames * frameSz);
+
+    for (size_t seq = 0;; seq++) {
+        pthread_mutex_lock(&cp->lock);
+        struct Slot *slot = &cp->slots[seq % SLOTS];
+        while (slot->seq != seq ||
+               (slot->state != SLOT_PROCESSED &&
+                !(slot->state == SLOT_READ && !slot->frames)))
+            pthread_cond_wait(&cp->cond, &cp->lock);
+        pthread_mutex_unlock(&cp->lock);
+        if (!slot->frames)
+            break;
+
+        // Merge the channels back and write them out
+        if (!cp->error) {
+            csc_pcmInterleave(raw, (const void *const *) slot->chans,
+                cp->channels, cp->sampleSize, slot->frames);
+            if (csc_pcmWrite(cp->outFd, raw, slot->frames * frameSz) < 0) {
+                perror("write");
+                cp->error = 1;
+            }
+        }
+
+        pthread_mutex_lock(&cp->lock);
+        slot->state = SLOT_EMPTY;
+        pthread_cond_broadcast(&cp->cond);
+        pthread_mutex_unlock(&cp->lock);
+    }
+
+    csc_pcmFree(raw);
+    return NULL;
+}
+
+// Run a channel pipeline
+int csc_chanPipe(int inFd, int outFd, int channels, size_t sampleSize,
+    size_t unit, CSC_ChannelFn fn, void *arg)
+{
+    struct ChanPipe cp;
+    pthread_t readerTh, writerTh, *workerThs;
+    struct Worker *workers;
+    int ci, ret = 0;
+
+    pthread_mutex_init(&cp.lock, NULL);
+    pthread_cond_init(&cp.cond, NULL);
+    cp.in = csc_pcmOpenIn(inFd);
+    cp.outFd = outFd;
+    cp.channels = channels;
+    cp.sampleSize = sampleSize;
+    cp.unit = unit;
+    cp.blockFrames = unit * BLOCK_UNITS;
+    cp.fn = fn;
+    cp.arg = arg;
+    cp.error = 0;
+
+    for (int si = 0; si < SLOTS; si++) {
+        struct Slot *slot = &cp.slots[si];
+        slot->state = SLOT_EMPTY;
+        slot->seq = (size_t) -1;
+        slot->chans = malloc(channels * sizeof(char *));
+        if (!slot->chans) {
+            perror("malloc");
+            return -1;
+        }
+        for (ci = 0; ci < channels; ci++)
+            slot->chans[ci] = csc_pcmAlloc(cp.blockFrames * sampleSize);
+    }
+    workerThs = malloc(channels * sizeof(pthread_t));
+    workers = malloc(channels * sizeof(struct Worker));
+    if (!workerThs || !workers) {
+        perror("malloc");
+        return -1;
+    }
+
+    // Start everything up
+    if (pthread_create(&readerTh, NULL, reader, &cp) != 0 ||
+        pthread_create(&writerTh, NULL, writer, &cp) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
+    for (ci = 0; ci < channels; ci++) {
+        workers[ci].cp = &cp;
+        workers[ci].channel = ci;
+        if (pthread_create(&workerThs[ci], NULL, worker, &workers[ci]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    // And wait for it all to finish
+    pthread_join(readerTh, NULL);
+    for (ci = 0; ci < channels; ci++)
+        pthread_join(workerThs[ci], NULL);
+    pthread_join(writerTh, NULL);
+    if (cp.error)
+        ret = -1;
+
+    for (int si = 0; si < SLOTS; si++) {
+        for (ci = 0; ci < channels; ci++)
+            csc_pcmFree(cp.slots[si].chans[ci]);
+        free(cp.slots[si].chans);
+    }
+    csc_pcmCloseIn(cp.in);
+    free(workerThs);
+    free(workers);
+    pthread_mutex_destroy(&cp.lock);
+    pthread_cond_destroy(&cp.cond);
+
+    return ret;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CHANPIPE_H
+#define CHANPIPE_H 1
+
+#include <stddef.h>
+
+/* Process one channel's samples in place. Called with exactly unit frames at a
+ * time, each channel always on the same thread. */
+typedef void (*CSC_ChannelFn)(void *arg, int channel, void *samples, size_t frames);
+
+/* Run a channel pipeline: a reader thread reads blocks of interleaved samples
+ * from inFd, one worker thread per channel processes its channel, and a writer
+ * thread writes the blocks to outFd in order. The input is padded with silence
+ * to a whole number of units. Returns 0 on success, -1 on error. */
+int csc_chanPipe(int inFd, int outFd, int channels, size_t sampleSize,
+    size_t unit, CSC_ChannelFn fn, void *arg);
+
+#endif
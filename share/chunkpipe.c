@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunkpipe.h"
+#include "pcmio.h"
+
+enum ChunkState {
+    CHUNK_EMPTY,
+    CHUNK_READ,
+    CHUNK_RUNNING,
+    CHUNK_PROCESSED
+};
+
+// A chunk in flight
+struct Chunk {
+    enum ChunkState state;
+    size_t seq;
+    size_t pre; // frames of earlier input before the chunk proper
+    size_t frames; // frames in the chunk proper, 0 for end of input
+    float **chans;
+};
+
+struct ChunkPipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct Chunk *chunks;
+    int slots;
+    int eof;
+
+    CSC_PcmIn *in;
+    int outFd, channels;
+    size_t unit, chunk, warmup, fade;
+    size_t padded; // largest chunk after padding
+    CSC_ChunkFn fn;
+    void *arg;
+    int error;
+};
+
+// Read the input into chunks
+static void reader(struct ChunkPipe *cp)
+{
+    int channels = cp->channels, ci;
+    size_t frameSz = channels * sizeof(float);
+    size_t unitSz = cp->unit * frameSz;
+    size_t histMax = cp->warmup + cp->fade, histLen = 0;
+    size_t posMod = 0; // frames so far, modulo the unit
+    float **hist = malloc(channels * sizeof(float *));
+    char *pad = NULL;
+
+    if (!hist) {
+        perror("malloc");
+        exit(1);
+    }
+    for (ci = 0; ci < channels; ci++)
+        hist[ci] = csc_pcmAlloc(histMax * sizeof(float) + 1);
+
+    for (size_t seq = 0;; seq++) {
+        // Wait for the slot to be free
+        pthread_mutex_lock(&cp->lock);
+        struct Chunk *c = &cp->chunks[seq % cp->slots];
+        while (c->state != CHUNK_EMPTY)
+            pthread_cond_wait(&cp->cond, &cp->lock);
+        pthread_mutex_unlock(&cp->lock);
+
+        // Read in the chunk. At the end, pad the input to a whole unit.
+        size_t rd, frames;
+        const char *raw = csc_pcmRead(cp->in, cp->chunk * frameSz, &rd);
+        if (rd == cp->chunk * frameSz) {
+            frames = cp->chunk;
+        } else {
+            size_t off = posMod * frameSz;
+            size_t padSz = (off + rd + unitSz - 1) / unitSz * unitSz - off;
+            if (padSz > rd) {
+                if (!pad)
+                    pad = csc_pcmAlloc(cp->padded * frameSz);
+                memcpy(pad, raw, rd);
+                memset(pad + rd, 0, padSz - rd);
+                raw = pad;
+            }
+            frames = padSz / frameSz;
+        }
+        posMod = (posMod + frames) % cp->unit;
+
+        if (frames) {
+            // Lead in with the input before it
+            float **chans = c->chans;
+            float *dest[channels];
+            for (ci = 0; ci < channels; ci++) {
+                memcpy(chans[ci], hist[ci], histLen * sizeof(float));
+                dest[ci] = chans[ci] + histLen;
+            }
+            csc_pcmDeinterleave((void *const *) dest, raw, channels,
+                sizeof(float), frames);
+
+            // And remember the end of this input for the next chunk
+            size_t total = histLen + frames;
+            c->pre = histLen;
+            histLen = total < histMax ? total : histMax;
+            for (ci = 0; ci < channels; ci++)
+                memcpy(hist[ci], chans[ci] + total - histLen, histLen * sizeof(float));
+        }
+
+        pthread_mutex_lock(&cp->lock);
+        c->seq = seq;
+        c->frames = frames;
+        c->state = CHUNK_READ;
+        if (!frames)
+            cp->eof = 1;
+        pthread_cond_broadcast(&cp->cond);
+        pthread_mutex_unlock(&cp->lock);
+
+        if (!frames)
+            break;
+    }
+
+    for (ci = 0; ci < channels; ci++)
+        csc_pcmFree(hist[ci]);
+    free(hist);
+    csc_pcmFree(pad);
+}
+
+// Process chunks, earliest first, until the input runs out
+static void *worker(void *vcp)
+{
+    struct ChunkPipe *cp = vcp;
+
+    pthread_mutex_lock(&cp->lock);
+    while (1) {
+        struct Chunk *c = NULL;
+        for (int si = 0; si < cp->slots; si++) {
+            struct Chunk *cand = &cp->chunks[si];
+            if (cand->state == CHUNK_READ && cand->frames &&
+                (!c || cand->seq < c->seq))
+                c = cand;
+        }
+        if (!c) {
+            if (cp->eof)
+                break;
+            pthread_cond_wait(&cp->cond, &cp->lock);
+            continue;
+        }
+        c->state = CHUNK_RUNNING;
+        pthread_mutex_unlock(&cp->lock);
+
+        cp->fn(cp->arg, c->chans, c->pre, c->pre + c->frames);
+
+        pthread_mutex_lock(&cp->lock);
+        c->state = CHUNK_PROCESSED;
+        pthread_cond_broadcast(&cp->cond);
+    }
+    pthread_mutex_unlock(&cp->lock);
+
+    return NULL;
+}
+
+// Write out a range of each channel
+static void writeRange(struct ChunkPipe *cp, float *const *chans, size_t off,
+    size_t frames, float *raw)
+{
+    const float *src[cp->channels];
+    if (!frames || cp->error)
+        return;
+    for (int ci = 0; ci < cp->channels; ci++)
+        src[ci] = chans[ci] + off;
+    csc_pcmInterleave(raw, (const void *const *) src, cp->channels,
+        sizeof(float), frames);
+    if (csc_pcmWrite(cp->outFd, raw, frames * cp->channels * sizeof(float)) < 0) {
+        perror("write");
+        cp->error = 1;
+    }
+}
+
+// Stitch the chunks back together in order
+static void *writer(void *vcp)
+{
+    struct ChunkPipe *cp = vcp;
+    int channels = cp->channels, ci;
+    float **tail = malloc(channels * sizeof(float *));
+    float *raw = csc_pcmAlloc((cp->fade + cp->padded) * channels * sizeof(float));
+    size_t tailLen = 0;
+
+    if (!tail) {
+        perror("malloc");
+        exit(1);
+    }
+    for (ci = 0; ci < channels; ci++)
+        tail[ci] = csc_pcmAlloc(cp->fade * sizeof(float) + 1);
+
+    for (size_t seq = 0;; seq++) {
+        pthread_mutex_lock(&cp->lock);
+        struct Chunk *c = &cp->chunks[seq % cp->slots];
+        while (c->seq != seq ||
+               (c->state != CHUNK_PROCESSED &&
+                !(c->state == CHUNK_READ && !c->frames)))
+            pthread_cond_wait(&cp->cond, &cp->lock);
+        pthread_mutex_unlock(&cp->lock);
+
+        if (!c->frames) {
+            // Flush the held-back end
+            writeRange(cp, tail, 0, tailLen, raw);
+            break;
+        }
+
+        // Crossfade from the end of the last chunk into this one
+        size_t start = c->pre - tailLen;
+        for (ci = 0; ci < channels; ci++) {
+            float *cur = c->chans[ci] + start;
+            for (size_t i = 0; i < tailLen; i++) {
+                float w = (i + 0.5f) / tailLen;
+                cur[i] = tail[ci][i] * (1 - w) + cur[i] * w;
+            }
+        }
+
+        // Write all but the end, which the next chunk will fade from
+        size_t end = c->pre + c->frames;
+        size_t hold = cp->fade < c->frames ? cp->fade : c->frames;
+        writeRange(cp, c->chans, start, end - hold - start, raw);
+        for (ci = 0; ci < channels; ci++)
+            memcpy(tail[ci], c->chans[ci] + end - hold, hold * sizeof(float));
+        tailLen = hold;
+
+        pthread_mutex_lock(&cp->lock);
+        c->state = CHUNK_EMPTY;
+        pthread_cond_broadcast(&cp->cond);
+        pthread_mutex_unlock(&cp->lock);
+    }
+
+    for (ci = 0; ci < channels; ci++)
+        csc_pcmFree(tail[ci]);
+    free(tail);
+    csc_pcmFree(raw);
+    return NULL;
+}
+
+// Run a time-sliced pipeline
+int csc_chunkPipe(int inFd, int outFd, int channels, size_t unit, size_t chunk,
+    size_t warmup, size_t fade, int jobs, CSC_ChunkFn fn, void *arg)
+{
+    struct ChunkPipe cp;
+    pthread_t writerTh, *workerThs;
+    int si, ci, wi;
+
+    if (jobs < 1)
+        jobs = 1;
+
+    /* Every chunk but the first needs a full lead-in, and every chunk but the
+     * last needs to be long enough to fade from */
+    if (chunk < warmup + fade)
+        chunk = warmup + fade;
+    if (chunk < unit)
+        chunk = unit;
+
+    pthread_mutex_init(&cp.lock, NULL);
+    pthread_cond_init(&cp.cond, NULL);
+    cp.slots = jobs + 2;
+    cp.eof = 0;
+    cp.in = csc_pcmOpenIn(inFd);
+    cp.outFd = outFd;
+    cp.channels = channels;
+    cp.unit = unit;
+    cp.chunk = chunk;
+    cp.warmup = warmup;
+    cp.fade = fade;
+    cp.padded = chunk + unit;
+    cp.fn = fn;
+    cp.arg = arg;
+    cp.error = 0;
+
+    cp.chunks = calloc(cp.slots, sizeof(struct Chunk));
+    workerThs = malloc(jobs * sizeof(pthread_t));
+    if (!cp.chunks || !workerThs) {
+        perror("malloc");
+        return -1;
+    }
+    for (si = 0; si < cp.slots; si++) {
+        struct Chunk *c = &cp.chunks[si];
+        c->state = CHUNK_EMPTY;
+        c->seq = (size_t) -1;
+        c->chans = malloc(channels * sizeof(float *));
+        if (!c->chans) {
+            perror("malloc");
+            return -1;
+        }
+        for (ci = 0; ci < channels; ci++)
+            c->chans[ci] = csc_pcmAlloc((warmup + fade + cp.padded) * sizeof(float));
+    }
+
+    // Start the workers and writer, and read on this thread
+    for (wi = 0; wi < jobs; wi++) {
+        if (pthread_create(&workerThs[wi], NULL, worker, &cp) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    if (pthread_create(&writerTh, NULL, writer, &cp) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
+    reader(&cp);
+
+    for (wi = 0; wi < jobs; wi++)
+        pthread_join(workerThs[wi], NULL);
+    pthread_join(writerTh, NULL);
+
+    for (si = 0; si < cp.slots; si++) {
+        for (ci = 0; ci < channels; ci++)
+            csc_pcmFree(cp.chunks[si].chans[ci]);
+        free(cp.chunks[si].chans);
+    }
+    free(cp.chunks);
+    free(workerThs);
+    csc_pcmCloseIn(cp.in);
+    pthread_mutex_destroy(&cp.lock);
+    pthread_cond_destroy(&cp.cond);
+
+    return cp.error ? -1 : 0;
+}
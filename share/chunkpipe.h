@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CHUNKPIPE_H
+#define CHUNKPIPE_H 1
+
+#include <stddef.h>
+
+/* Process one chunk of f32 samples, one buffer per channel, in place. The first
+ * warmup frames precede the chunk proper, and are only there to let the
+ * processor's state settle; their output is discarded. */
+typedef void (*CSC_ChunkFn)(void *arg, float *const *chans, size_t warmup,
+    size_t frames);
+
+/* Run a time-sliced pipeline: the input is cut into chunks of the given size,
+ * each preceded by up to warmup+fade frames of the input before it, and the
+ * chunks are processed on jobs threads. The output is stitched back together
+ * in order, crossfading over fade frames at each seam. As with csc_chanPipe,
+ * the input is padded with silence to a whole number of units. Returns 0 on
+ * success, -1 on error. */
+int csc_chunkPipe(int inFd, int outFd, int channels, size_t unit, size_t chunk,
+    size_t warmup, size_t fade, int jobs, CSC_ChunkFn fn, void *arg);
+
+#endif
@@ -221,6 +221,19 @@ CORD *csc_glob(CORD pattern)
     return ret;
 }
 
+// Count the processors available to us
+int csc_cpuCount(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors;
+#else
+    long ct = sysconf(_SC_NPROCESSORS_ONLN);
+    return (ct > 0) ? ct : 1;
+#endif
+}
+
 // Absolute-ize a path
 CORD csc_absolute(CORD path)
 {
@@ -491,6 +504,12 @@ int csc_runl(int fds, CORD *into, const char *arg, ...)
  * capture them. An output fd is returned, or -1 for error. If stdinFd is
  * provided, it is closed. */
 int csc_runp(int stdinFd, int fds, char *const argv[])
+{
+    return csc_runpProc(stdinFd, fds, argv, NULL);
+}
+
+// runp, also returning the child process
+int csc_runpProc(int stdinFd, int fds, char *const argv[], CSC_Proc *proc)
 {
     if (csc_verbose) {
         VERBOSE("pipe");
@@ -560,6 +579,11 @@ int csc_runp(int stdinFd, int fds, char *const argv[])
         CloseHandle(cstdout[0]);
         return -1;
     }
+    CloseHandle(pi.hThread);
+    if (proc)
+        *proc = pi.hProcess;
+    else
+        CloseHandle(pi.hProcess);
 
     // Now prepare output as an fd
     return _open_osfhandle((intptr_t) cstdout[0], _O_RDONLY);
@@ -602,6 +626,8 @@ int csc_runp(int stdinFd, int fds, char *const argv[])
         close(stdinFd);
     close(cstdout[1]);
 
+    if (proc)
+        *proc = cpid;
     return cstdout[0];
 
 #endif
@@ -637,6 +663,52 @@ int csc_runpl(int stdinFd, int fds, const char *arg, ...)
     return csc_runp(stdinFd, fds, argv);
 }
 
+// Wait for a child process to exit
+int csc_waitProc(CSC_Proc proc)
+{
+#ifdef _WIN32
+    DWORD ret;
+    WaitForSingleObject(proc, INFINITE);
+    if (!GetExitCodeProcess(proc, &ret))
+        ret = -1;
+    CloseHandle(proc);
+    return ret;
+
+#else
+    int ret;
+    if (waitpid(proc, &ret, 0) < 0)
+        return -1;
+    if (WIFEXITED(ret))
+        return WEXITSTATUS(ret);
+    return -1;
+
+#endif
+}
+
+// Make a pipe to feed a child's input
+bool csc_pipe(int fds[2])
+{
+#ifdef _WIN32
+    SECURITY_ATTRIBUTES sa = { 0 };
+    HANDLE r, w;
+    sa.nLength = sizeof(sa);
+    sa.bInheritHandle = TRUE;
+    if (!CreatePipe(&r, &w, &sa, 0))
+        return false;
+    SetHandleInformation(w, HANDLE_FLAG_INHERIT, 0);
+    fds[0] = _open_osfhandle((intptr_t) r, _O_RDONLY);
+    fds[1] = _open_osfhandle((intptr_t) w, _O_WRONLY);
+    return true;
+
+#else
+    if (pipe(fds) < 0)
+        return false;
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return true;
+
+#endif
+}
+
 // Wait for a pipeline by way of waiting for a pipe
 bool csc_wait(int fd)
 {
@@ -72,6 +72,9 @@ bool csc_fileExists(CORD filename);
 /* Portable globbing, just returns a NULL-terminated CORD array */
 CORD *csc_glob(CORD pattern);
 
+/* Count the processors available to us */
+int csc_cpuCount(void);
+
 /* Absolute-ize a path */
 CORD csc_absolute(CORD path);
 
@@ -105,6 +108,25 @@ int csc_runp(int stdinFd, int fds, char *const argv[]);
 /* runp with arguments directly */
 int csc_runpl(int stdinFd, int fds, const char *arg, ...);
 
+/* A child process, for waiting on with csc_waitProc */
+#ifdef _WIN32
+typedef void *CSC_Proc;
+#else
+typedef int CSC_Proc;
+#endif
+
+/* runp, also returning the child process in *proc, which must then be waited
+ * on with csc_waitProc */
+int csc_runpProc(int stdinFd, int fds, char *const argv[], CSC_Proc *proc);
+
+/* Wait for a child process to exit. Returns its exit code, or -1 for errors. */
+int csc_waitProc(CSC_Proc proc);
+
+/* Make a pipe to feed a child's input with runp. Only the read end is
+ * inherited by children, so that the child sees the end of its input when the
+ * write end is closed. Returns false for errors. */
+bool csc_pipe(int fds[2]);
+
 /* Wait for a pipeline by way of waiting for a pipe */
 bool csc_wait(int fd);
 
@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pcmio.h"
+
+// Alignment of our buffers
+#define PCM_ALIGN 64
+
+struct CSC_PcmIn {
+    int fd;
+
+    // If mapped, the map and our position in it
+    const char *map;
+    size_t mapSz, mapOff, pos;
+
+    // If not, our read buffer
+    char *buf;
+    size_t bufSz;
+};
+
+// Prepare to read PCM
+CSC_PcmIn *csc_pcmOpenIn(int fd)
+{
+    CSC_PcmIn *in = calloc(1, sizeof(CSC_PcmIn));
+    if (!in) {
+        perror("malloc");
+        exit(1);
+    }
+    in->fd = fd;
+
+#ifndef _WIN32
+    {
+        struct stat sbuf;
+        off_t start = lseek(fd, 0, SEEK_CUR);
+
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        // Map regular files
+        if (start >= 0 && fstat(fd, &sbuf) == 0 && S_ISREG(sbuf.st_mode) &&
+            sbuf.st_size > start &&
+            (uintmax_t) sbuf.st_size <= (uintmax_t) SIZE_MAX) {
+            void *map = mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                posix_madvise(map, sbuf.st_size, POSIX_MADV_SEQUENTIAL);
+                in->map = map;
+                in->mapSz = sbuf.st_size;
+                in->mapOff = in->pos = start;
+            }
+        }
+    }
+#endif
+
+    return in;
+}
+
+// Read up to len bytes
+const void *csc_pcmRead(CSC_PcmIn *in, size_t len, size_t *rd)
+{
+    size_t total = 0;
+    ssize_t r;
+
+    if (in->map) {
+        const char *ret = in->map + in->pos;
+        if (len > in->mapSz - in->pos)
+            len = in->mapSz - in->pos;
+        in->pos += len;
+        *rd = len;
+        return ret;
+    }
+
+    if (in->bufSz < len) {
+        csc_pcmFree(in->buf);
+        in->buf = csc_pcmAlloc(len);
+        in->bufSz = len;
+    }
+
+    while (total < len) {
+        r = read(in->fd, in->buf + total, len - total);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        total += r;
+    }
+    *rd = total;
+    return in->buf;
+}
+
+// Done reading PCM
+void csc_pcmCloseIn(CSC_PcmIn *in)
+{
+#ifndef _WIN32
+    if (in->map)
+        munmap((void *) in->map, in->mapSz);
+#endif
+    csc_pcmFree(in->buf);
+    free(in);
+}
+
+// Write all of a buffer
+int csc_pcmWrite(int fd, const void *vbuf, size_t len)
+{
+    const char *buf = vbuf;
+    ssize_t wr;
+    while (len) {
+        wr = write(fd, buf, len);
+        if (wr < 0 && errno == EINTR)
+            continue;
+        if (wr <= 0)
+            return -1;
+        buf += wr;
+        len -= wr;
+    }
+    return 0;
+}
+
+// Allocate an aligned buffer
+void *csc_pcmAlloc(size_t sz)
+{
+    void *ret;
+    if (!sz)
+        sz = 1;
+#ifdef _WIN32
+    ret = _aligned_malloc(sz, PCM_ALIGN);
+#else
+    if (posix_memalign(&ret, PCM_ALIGN, sz) != 0)
+        ret = NULL;
+#endif
+    if (!ret) {
+        perror("malloc");
+        exit(1);
+    }
+    return ret;
+}
+
+// Free an aligned buffer
+void csc_pcmFree(void *buf)
+{
+#ifdef _WIN32
+    _aligned_free(buf);
+#else
+    free(buf);
+#endif
+}
+
+// Stereo special cases
+static void deinterleave2s16(int16_t *l, int16_t *r, const int16_t *in, size_t frames)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 8 <= frames; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (in + i*2));
+        __m128i b = _mm_loadu_si128((const __m128i *) (in + i*2 + 8));
+        // Each 32-bit lane is one frame, left in the low half
+        __m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+        __m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+        __m128i ra = _mm_srai_epi32(a, 16);
+        __m128i rb = _mm_srai_epi32(b, 16);
+        _mm_storeu_si128((__m128i *) (l + i), _mm_packs_epi32(la, lb));
+        _mm_storeu_si128((__m128i *) (r + i), _mm_packs_epi32(ra, rb));
+    }
+#endif
+    for (; i < frames; i++) {
+        l[i] = in[i*2];
+        r[i] = in[i*2+1];
+    }
+}
+
+static void interleave2s16(int16_t *out, const int16_t *l, const int16_t *r, size_t frames)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 8 <= frames; i += 8) {
+        __m128i lv = _mm_loadu_si128((const __m128i *) (l + i));
+        __m128i rv = _mm_loadu_si128((const __m128i *) (r + i));
+        _mm_storeu_si128((__m128i *) (out + i*2), _mm_unpacklo_epi16(lv, rv));
+        _mm_storeu_si128((__m128i *) (out + i*2 + 8), _mm_unpackhi_epi16(lv, rv));
+    }
+#endif
+    for (; i < frames; i++) {
+        out[i*2] = l[i];
+        out[i*2+1] = r[i];
+    }
+}
+
+static void deinterleave2f32(float *l, float *r, const float *in, size_t frames)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= frames; i += 4) {
+        __m128 a = _mm_loadu_ps(in + i*2);
+        __m128 b = _mm_loadu_ps(in + i*2 + 4);
+        _mm_storeu_ps(l + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(r + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+#endif
+    for (; i < frames; i++) {
+        l[i] = in[i*2];
+        r[i] = in[i*2+1];
+    }
+}
+
+static void interleave2f32(float *out, const float *l, const float *r, size_t frames)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= frames; i += 4) {
+        __m128 lv = _mm_loadu_ps(l + i);
+        __m128 rv = _mm_loadu_ps(r + i);
+        _mm_storeu_ps(out + i*2, _mm_unpacklo_ps(lv, rv));
+        _mm_storeu_ps(out + i*2 + 4, _mm_unpackhi_ps(lv, rv));
+    }
+#endif
+    for (; i < frames; i++) {
+        out[i*2] = l[i];
+        out[i*2+1] = r[i];
+    }
+}
+
+/* The general case. Written per sample size so the compiler can vectorize the
+ * strided copies. */
+#define GENERAL(name, type) \
+static void deinterleave ## name(type *const *out, const type *in, int channels, size_t frames) \
+{ \
+    size_t i; \
+    int ci; \
+    for (ci = 0; ci < channels; ci++) { \
+        type *o = out[ci]; \
+        const type *s = in + ci; \
+        for (i = 0; i < frames; i++) \
+            o[i] = s[i*channels]; \
+    } \
+} \
+\
+static void interleave ## name(type *out, const type *const *in, int channels, size_t frames) \
+{ \
+    size_t i; \
+    int ci; \
+    for (ci = 0; ci < channels; ci++) { \
+        const type *s = in[ci]; \
+        type *o = out + ci; \
+        for (i = 0; i < frames; i++) \
+            o[i*channels] = s[i]; \
+    } \
+}
+GENERAL(s16, int16_t)
+GENERAL(f32, float)
+#undef GENERAL
+
+// Split interleaved samples into channels
+void csc_pcmDeinterleave(void *const *out, const void *in, int channels,
+    size_t sampleSize, size_t frames)
+{
+    if (channels == 1) {
+        memcpy(out[0], in, frames * sampleSize);
+
+    } else if (sampleSize == 2) {
+        if (channels == 2)
+            deinterleave2s16(out[0], out[1], in, frames);
+        else
+            deinterleaves16((int16_t *const *) out, in, channels, frames);
+
+    } else {
+        if (channels == 2)
+            deinterleave2f32(out[0], out[1], in, frames);
+        else
+            deinterleavef32((float *const *) out, in, channels, frames);
+
+    }
+}
+
+// Merge channels into interleaved samples
+void csc_pcmInterleave(void *out, const void *const *in, int channels,
+    size_t sampleSize, size_t frames)
+{
+    if (channels == 1) {
+        memcpy(out, in[0], frames * sampleSize);
+
+    } else if (sampleSize == 2) {
+        if (channels == 2)
+            interleave2s16(out, in[0], in[1], frames);
+        else
+            interleaves16(out, (const int16_t *const *) in, channels, frames);
+
+    } else {
+        if (channels == 2)
+            interleave2f32(out, in[0], in[1], frames);
+        else
+            interleavef32(out, (const float *const *) in, channels, frames);
+
+    }
+}
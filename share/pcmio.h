@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2022 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PCMIO_H
+#define PCMIO_H 1
+
+#include <stddef.h>
+
+/* Buffered PCM input. Regular files are mapped into memory where possible, and
+ * otherwise read in large aligned blocks. */
+typedef struct CSC_PcmIn CSC_PcmIn;
+
+/* Prepare to read PCM from this file descriptor, from its current position.
+ * The descriptor is not closed by csc_pcmCloseIn. */
+CSC_PcmIn *csc_pcmOpenIn(int fd);
+
+/* Read up to len bytes. Returns a pointer to the data, valid until the next
+ * read, and sets *rd to the amount actually read. *rd is only less than len at
+ * the end of the input. */
+const void *csc_pcmRead(CSC_PcmIn *in, size_t len, size_t *rd);
+
+// Done reading PCM
+void csc_pcmCloseIn(CSC_PcmIn *in);
+
+// Write all of a buffer, retrying partial writes. Returns 0 or -1 on error.
+int csc_pcmWrite(int fd, const void *buf, size_t len);
+
+// Allocate and free buffers aligned for vector operations
+void *csc_pcmAlloc(size_t sz);
+void csc_pcmFree(void *buf);
+
+/* Split interleaved samples into one buffer per channel, or the reverse.
+ * sampleSize must be 2 (s16) or 4 (f32). */
+void csc_pcmDeinterleave(void *const *out, const void *in, int channels,
+    size_t sampleSize, size_t frames);
+void csc_pcmInterleave(void *out, const void *const *in, int channels,
+    size_t sampleSize, size_t frames);
+
+#endif